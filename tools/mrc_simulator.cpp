@@ -0,0 +1,315 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file tools/mrc_simulator.cpp
+ * \brief Replays an access trace and prints the LRU miss ratio curve.
+ *
+ * Usage:
+ *
+ *     mrc_simulator [options] TRACE_FILE
+ *
+ *     --binary              the trace is a sequence of 64-bit integers
+ *                           (default: text, the first token of each line is
+ *                           the key).
+ *     --sampling_rate=RATE  the initial SHARDS sampling rate, in (0, 1]
+ *                           (default: 1).
+ *     --max_samples=NUM     the maximal number of tracked keys
+ *                           (default: 1000000, 0 for no limit).
+ *     --compare=SIZE,...    also replays the trace on LRUCache and
+ *                           ShardedLRUCache with these capacities, each
+ *                           from 1 to INT_MAX.
+ *     --shards=NUM          the number of shards of ShardedLRUCache, at
+ *                           least 1 (default: 16).
+ */
+
+#include <getopt.h>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "vobla/lru_cache.h"
+#include "vobla/miss_ratio_curve.h"
+#include "vobla/sharded_lru_cache.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using vobla::LRUCache;
+using vobla::LRUCacheItem;
+using vobla::MissRatioCurve;
+using vobla::ShardedLRUCache;
+
+namespace {
+
+class TraceItem : public LRUCacheItem<uint64_t> {
+ public:
+  explicit TraceItem(uint64_t k) : key(k) {}
+
+  uint64_t cache_key() const { return key; }
+
+  uint64_t key;
+};
+
+/// Replays the trace on a cache implementation with the given capacity.
+class CacheSimulator {
+ public:
+  CacheSimulator(size_t capacity, size_t num_shards)
+      : capacity_(capacity), lru_(static_cast<int>(capacity)),
+        sharded_(capacity, num_shards),
+        value_(std::make_shared<bool>(true)) {
+  }
+
+  ~CacheSimulator() {
+    lru_.clear();
+  }
+
+  void access(uint64_t key) {
+    num_accesses_++;
+    if (lru_.find(key)) {
+      lru_.use(key);
+    } else {
+      lru_misses_++;
+      if (lru_.full()) {
+        lru_.evict();
+      }
+      lru_.insert(key, new TraceItem(key));
+    }
+
+    ShardedLRUCache<uint64_t, bool>::pointer_type value;
+    if (!sharded_.find(key, &value)) {
+      sharded_misses_++;
+      sharded_.insert(key, value_);
+    }
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  double lru_miss_ratio() const {
+    return num_accesses_ ? static_cast<double>(lru_misses_) / num_accesses_
+        : 0;
+  }
+
+  double sharded_miss_ratio() const {
+    return num_accesses_ ?
+        static_cast<double>(sharded_misses_) / num_accesses_ : 0;
+  }
+
+ private:
+  size_t capacity_;
+
+  LRUCache<TraceItem> lru_;
+
+  ShardedLRUCache<uint64_t, bool> sharded_;
+
+  std::shared_ptr<bool> value_;
+
+  uint64_t num_accesses_ = 0;
+
+  uint64_t lru_misses_ = 0;
+
+  uint64_t sharded_misses_ = 0;
+};
+
+void usage(const char* program) {
+  fprintf(stderr, "Usage: %s [--binary] [--sampling_rate=RATE] "
+          "[--max_samples=NUM] [--compare=SIZE,...] [--shards=NUM] "
+          "TRACE_FILE\n", program);
+}
+
+/// Parses a whole decimal number. Returns false if it is not one.
+bool parse_uint(const string& str, uint64_t* value) {
+  char* end = nullptr;
+  errno = 0;
+  *value = strtoull(str.c_str(), &end, 10);
+  return !str.empty() && *end == '\0' && errno != ERANGE && str[0] != '-';
+}
+
+/// Parses a sampling rate. Returns false if it is not in (0, 1].
+bool parse_rate(const string& str, double* rate) {
+  char* end = nullptr;
+  errno = 0;
+  *rate = strtod(str.c_str(), &end);
+  return !str.empty() && *end == '\0' && errno != ERANGE &&
+      *rate > 0 && *rate <= 1;
+}
+
+/// Parses a capacity of --compare. Returns 0 if it is not in [1, INT_MAX].
+size_t parse_capacity(const string& size) {
+  uint64_t capacity;
+  if (!parse_uint(size, &capacity) || capacity > INT_MAX) {
+    return 0;
+  }
+  return capacity;
+}
+
+/// Reports an invalid option value. Returns the exit code.
+int invalid_option(const char* program, const char* option,
+                   const string& value) {
+  fprintf(stderr, "Invalid value for --%s: '%s'\n", option, value.c_str());
+  usage(program);
+  return 1;
+}
+
+/// Parses the first token of a line of the text trace.
+uint64_t parse_key(const char* line, size_t length) {
+  size_t end = strcspn(line, " \t,\r\n");
+  char* num_end = nullptr;
+  uint64_t key = strtoull(line, &num_end, 10);
+  if (end > 0 && num_end == line + end) {
+    return key;
+  }
+  return MissRatioCurve::hash_key(line, end);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool binary = false;
+  double sampling_rate = 1.0;
+  size_t max_samples = 1000000;
+  size_t num_shards = 16;
+  vector<size_t> compare_sizes;
+
+  static struct option long_options[] = {
+    {"binary", no_argument, 0, 'b'},
+    {"sampling_rate", required_argument, 0, 'r'},
+    {"max_samples", required_argument, 0, 'm'},
+    {"compare", required_argument, 0, 'c'},
+    {"shards", required_argument, 0, 's'},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "br:m:c:s:h", long_options,
+                            nullptr)) != -1) {
+    switch (opt) {
+      case 'b':
+        binary = true;
+        break;
+      case 'r':
+        if (!parse_rate(optarg, &sampling_rate)) {
+          return invalid_option(argv[0], "sampling_rate", optarg);
+        }
+        break;
+      case 'm': {
+        uint64_t value;
+        if (!parse_uint(optarg, &value)) {
+          return invalid_option(argv[0], "max_samples", optarg);
+        }
+        max_samples = value;
+        break;
+      }
+      case 'c': {
+        std::stringstream sizes(optarg);
+        string size;
+        while (std::getline(sizes, size, ',')) {
+          size_t capacity = parse_capacity(size);
+          if (capacity == 0) {
+            return invalid_option(argv[0], "compare", size);
+          }
+          compare_sizes.push_back(capacity);
+        }
+        break;
+      }
+      case 's': {
+        uint64_t value;
+        if (!parse_uint(optarg, &value) || value == 0) {
+          return invalid_option(argv[0], "shards", optarg);
+        }
+        num_shards = value;
+        break;
+      }
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (optind + 1 != argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  FILE* trace = fopen(argv[optind], binary ? "rb" : "r");
+  if (!trace) {
+    fprintf(stderr, "Failed to open %s: %s\n", argv[optind], strerror(errno));
+    return 1;
+  }
+
+  MissRatioCurve mrc(sampling_rate, max_samples);
+  vector<unique_ptr<CacheSimulator>> simulators;
+  for (auto size : compare_sizes) {
+    simulators.emplace_back(new CacheSimulator(size, num_shards));
+  }
+  auto access = [&mrc, &simulators](uint64_t key) -> void {
+    mrc.access(key);
+    for (auto& simulator : simulators) {
+      simulator->access(key);
+    }
+  };
+
+  if (binary) {
+    vector<uint64_t> keys(64 * 1024);
+    size_t nread;
+    while ((nread = fread(keys.data(), sizeof(uint64_t), keys.size(),
+                          trace)) > 0) {
+      for (size_t i = 0; i < nread; i++) {
+        access(keys[i]);
+      }
+    }
+  } else {
+    char* line = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, trace)) > 0) {
+      if (line[0] == '#' || line[0] == '\n') {
+        continue;
+      }
+      access(parse_key(line, length));
+    }
+    free(line);
+  }
+  fclose(trace);
+
+  printf("# accesses: %lu, sampled: %lu, tracked keys: %lu, "
+         "sampling rate: %g\n",
+         static_cast<unsigned long>(mrc.num_accesses()),  // NOLINT
+         static_cast<unsigned long>(mrc.num_sampled_accesses()),  // NOLINT
+         static_cast<unsigned long>(mrc.num_tracked_keys()),  // NOLINT
+         mrc.sampling_rate());
+  printf("# cache_size miss_ratio\n");
+  for (const auto& point : mrc.curve()) {
+    printf("%lu %.6f\n", static_cast<unsigned long>(point.first),  // NOLINT
+           point.second);
+  }
+  if (!simulators.empty()) {
+    printf("\n# cache_size mrc_estimate lru_cache sharded_lru_cache\n");
+    for (const auto& simulator : simulators) {
+      printf("%lu %.6f %.6f %.6f\n",
+             static_cast<unsigned long>(simulator->capacity()),  // NOLINT
+             mrc.miss_ratio(simulator->capacity()),
+             simulator->lru_miss_ratio(), simulator->sharded_miss_ratio());
+    }
+  }
+  return 0;
+}
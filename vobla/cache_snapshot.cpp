@@ -0,0 +1,239 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/cache_snapshot.cpp
+ * \brief Implementation of cache snapshot files.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <string>
+#include "vobla/cache_snapshot.h"
+
+using std::string;
+
+namespace vobla {
+
+namespace {
+
+const char kMagic[] = "VOBLALRU";
+const size_t kMagicLength = 8;
+const uint32_t kVersion = 1;
+const uint32_t kFlagWithValues = 1;
+const uint32_t kEndOfRecords = 0xffffffff;
+const size_t kBufferSize = 1 << 20;
+
+void append_uint32(uint32_t value, string* buf) {
+  buf->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}  // namespace
+
+CacheSnapshotWriter::CacheSnapshotWriter(const string& path,
+                                         bool with_values)
+    : path_(path), tmp_path_(path + ".tmp"), with_values_(with_values),
+      file_(path + ".tmp", O_WRONLY | O_CREAT | O_TRUNC) {
+}
+
+CacheSnapshotWriter::~CacheSnapshotWriter() {
+  if (file_.fd() >= 0) {
+    file_.close();
+    unlink(tmp_path_.c_str());
+  }
+}
+
+Status CacheSnapshotWriter::open() {
+  auto status = file_.open();
+  if (!status.ok()) {
+    return status;
+  }
+  buffer_.reserve(kBufferSize);
+  buffer_.append(kMagic, kMagicLength);
+  append_uint32(kVersion, &buffer_);
+  append_uint32(with_values_ ? kFlagWithValues : 0, &buffer_);
+  return Status::OK;
+}
+
+Status CacheSnapshotWriter::append(const string& key, const string& value) {
+  append_uint32(key.size(), &buffer_);
+  buffer_.append(key);
+  if (with_values_) {
+    append_uint32(value.size(), &buffer_);
+    buffer_.append(value);
+  }
+  num_records_++;
+  if (buffer_.size() >= kBufferSize) {
+    return flush();
+  }
+  return Status::OK;
+}
+
+Status CacheSnapshotWriter::close() {
+  append_uint32(kEndOfRecords, &buffer_);
+  buffer_.append(reinterpret_cast<const char*>(&num_records_),
+                 sizeof(num_records_));
+  auto status = flush();
+  if (!status.ok()) {
+    return status;
+  }
+  if (fsync(file_.fd()) < 0) {
+    return Status::system_error(errno);
+  }
+  status = file_.close();
+  if (!status.ok()) {
+    return status;
+  }
+  if (rename(tmp_path_.c_str(), path_.c_str()) < 0) {
+    return Status::system_error(errno);
+  }
+  return Status::OK;
+}
+
+Status CacheSnapshotWriter::flush() {
+  const char* data = buffer_.data();
+  size_t remaining = buffer_.size();
+  while (remaining > 0) {
+    ssize_t written = ::write(file_.fd(), data, remaining);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return Status::system_error(errno);
+    }
+    data += written;
+    remaining -= written;
+  }
+  buffer_.clear();
+  return Status::OK;
+}
+
+CacheSnapshotReader::CacheSnapshotReader(const string& path)
+    : path_(path), file_(path, O_RDONLY) {
+}
+
+CacheSnapshotReader::~CacheSnapshotReader() {
+}
+
+Status CacheSnapshotReader::open() {
+  auto status = file_.open();
+  if (!status.ok()) {
+    return status;
+  }
+  string magic;
+  status = read(kMagicLength, &magic);
+  if (!status.ok() || magic != string(kMagic, kMagicLength)) {
+    return Status(-EINVAL, "Not a cache snapshot: " + path_);
+  }
+  uint32_t version = 0;
+  uint32_t flags = 0;
+  status = read_uint32(&version);
+  if (status.ok()) {
+    status = read_uint32(&flags);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  if (version != kVersion) {
+    return Status(-EINVAL, "Unsupported cache snapshot version.");
+  }
+  with_values_ = flags & kFlagWithValues;
+  return Status::OK;
+}
+
+Status CacheSnapshotReader::next(string* key, string* value, bool* eof) {
+  *eof = false;
+  uint32_t length = 0;
+  auto status = read_uint32(&length);
+  if (!status.ok()) {
+    return status;
+  }
+  if (length == kEndOfRecords) {
+    string count;
+    status = read(sizeof(num_records_), &count);
+    if (!status.ok()) {
+      return status;
+    }
+    uint64_t expected = 0;
+    memcpy(&expected, count.data(), sizeof(expected));
+    if (expected != num_records_) {
+      return Status(-EIO, "The cache snapshot is corrupted.");
+    }
+    *eof = true;
+    return Status::OK;
+  }
+  status = read(length, key);
+  if (!status.ok()) {
+    return status;
+  }
+  value->clear();
+  if (with_values_) {
+    status = read_uint32(&length);
+    if (status.ok()) {
+      status = read(length, value);
+    }
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  num_records_++;
+  return Status::OK;
+}
+
+Status CacheSnapshotReader::fill(size_t length) {
+  while (buffer_.size() - offset_ < length) {
+    buffer_.erase(0, offset_);
+    offset_ = 0;
+    size_t old_size = buffer_.size();
+    size_t chunk = std::max(kBufferSize, length - old_size);
+    buffer_.resize(old_size + chunk);
+    ssize_t nread = ::read(file_.fd(), &buffer_[old_size], chunk);
+    buffer_.resize(old_size + std::max<ssize_t>(nread, 0));
+    if (nread < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return Status::system_error(errno);
+    }
+    if (nread == 0) {
+      return Status(-EIO, "The cache snapshot is truncated.");
+    }
+  }
+  return Status::OK;
+}
+
+Status CacheSnapshotReader::read(size_t length, string* buf) {
+  auto status = fill(length);
+  if (status.ok()) {
+    buf->assign(buffer_, offset_, length);
+    offset_ += length;
+  }
+  return status;
+}
+
+Status CacheSnapshotReader::read_uint32(uint32_t* value) {
+  auto status = fill(sizeof(*value));
+  if (status.ok()) {
+    memcpy(value, buffer_.data() + offset_, sizeof(*value));
+    offset_ += sizeof(*value);
+  }
+  return status;
+}
+
+}  // namespace vobla
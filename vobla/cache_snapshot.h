@@ -0,0 +1,182 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/cache_snapshot.h
+ * \brief Persists the contents of a cache to warm it up after restarting.
+ *
+ * A snapshot file is a sequence of (key, value) records, written from the
+ * hottest entry to the coldest one:
+ *
+ *     header:  "VOBLALRU" | uint32 version | uint32 flags
+ *     record:  uint32 key length | key [| uint32 value length | value]
+ *     footer:  uint32 0xffffffff | uint64 number of records
+ *
+ * The values are only stored if the snapshot is written with values
+ * (flags & 1). All integers are in the host byte order.
+ */
+
+#ifndef VOBLA_CACHE_SNAPSHOT_H_
+#define VOBLA_CACHE_SNAPSHOT_H_
+
+#include <boost/utility.hpp>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include "vobla/file.h"
+#include "vobla/status.h"
+
+namespace vobla {
+
+/**
+ * \class SnapshotKeyCodec vobla/cache_snapshot.h
+ * \brief Encodes the cache keys into bytes and decodes them back.
+ *
+ * It supports arithmetic types and std::string. Specialize it for other key
+ * types.
+ */
+template <typename T, typename Enable = void>
+struct SnapshotKeyCodec;
+
+/// \cond
+template <typename T>
+struct SnapshotKeyCodec<
+    T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+  static void encode(const T& key, std::string* buf) {
+    buf->assign(reinterpret_cast<const char*>(&key), sizeof(key));
+  }
+
+  static bool decode(const std::string& buf, T* key) {
+    if (buf.size() != sizeof(T)) {
+      return false;
+    }
+    memcpy(key, buf.data(), sizeof(T));
+    return true;
+  }
+};
+
+template <>
+struct SnapshotKeyCodec<std::string> {
+  static void encode(const std::string& key, std::string* buf) {
+    *buf = key;
+  }
+
+  static bool decode(const std::string& buf, std::string* key) {
+    *key = buf;
+    return true;
+  }
+};
+/// \endcond
+
+/**
+ * \class CacheSnapshotWriter vobla/cache_snapshot.h
+ * \brief Streams cache entries into a snapshot file.
+ *
+ * The records are buffered and written in large blocks. The snapshot is
+ * written to a temporary file, which is renamed to the final path on
+ * close(), so a crash never leaves a partial snapshot behind.
+ */
+class CacheSnapshotWriter : boost::noncopyable {
+ public:
+  /// Constructs a writer. `with_values` decides whether values are stored.
+  CacheSnapshotWriter(const std::string& path, bool with_values);
+
+  /// Discards the temporary file if close() has not been called.
+  ~CacheSnapshotWriter();
+
+  /// Creates the temporary file and writes the header.
+  Status open();
+
+  /// Appends one entry. `value` is ignored if the values are not stored.
+  Status append(const std::string& key, const std::string& value);
+
+  /// Writes the footer and moves the snapshot to its final path.
+  Status close();
+
+  /// Returns the number of appended entries.
+  uint64_t num_records() const {
+    return num_records_;
+  }
+
+ private:
+  Status flush();
+
+  std::string path_;
+
+  std::string tmp_path_;
+
+  bool with_values_;
+
+  File file_;
+
+  std::string buffer_;
+
+  uint64_t num_records_ = 0;
+};
+
+/**
+ * \class CacheSnapshotReader vobla/cache_snapshot.h
+ * \brief Reads the entries of a snapshot file, hottest first.
+ */
+class CacheSnapshotReader : boost::noncopyable {
+ public:
+  explicit CacheSnapshotReader(const std::string& path);
+
+  ~CacheSnapshotReader();
+
+  /// Opens the snapshot and verifies its header.
+  Status open();
+
+  /// Returns true if the snapshot stores values.
+  bool with_values() const {
+    return with_values_;
+  }
+
+  /**
+   * \brief Reads the next entry.
+   * \param[out] key the encoded key.
+   * \param[out] value the value, or an empty string if values are not stored.
+   * \param[out] eof set to true when all entries have been read.
+   * \return an error if the snapshot is truncated or corrupted.
+   */
+  Status next(std::string* key, std::string* value, bool* eof);
+
+ private:
+  /// Makes sure that there are at least `length` unread bytes in the buffer.
+  Status fill(size_t length);
+
+  /// Reads exactly `length` bytes.
+  Status read(size_t length, std::string* buf);
+
+  Status read_uint32(uint32_t* value);
+
+  std::string path_;
+
+  File file_;
+
+  std::string buffer_;
+
+  size_t offset_ = 0;
+
+  bool with_values_ = false;
+
+  uint64_t num_records_ = 0;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_CACHE_SNAPSHOT_H_
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "vobla/cache_snapshot.h"
+#include "vobla/file.h"
+#include "vobla/sharded_lru_cache.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace vobla {
+
+class CacheSnapshotTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    dir_.reset(new TemporaryDirectory);
+    path_ = dir_->path() + "/snapshot";
+  }
+
+  unique_ptr<TemporaryDirectory> dir_;
+  string path_;
+};
+
+TEST_F(CacheSnapshotTest, TestWriteAndRead) {
+  CacheSnapshotWriter writer(path_, true);
+  ASSERT_TRUE(writer.open().ok());
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_TRUE(writer.append("key" + std::to_string(i),
+                              string(i, 'v')).ok());
+  }
+  // The snapshot is invisible until it is closed.
+  EXPECT_NE(0, access(path_.c_str(), F_OK));
+  EXPECT_TRUE(writer.close().ok());
+  EXPECT_EQ(1000u, writer.num_records());
+
+  CacheSnapshotReader reader(path_);
+  ASSERT_TRUE(reader.open().ok());
+  EXPECT_TRUE(reader.with_values());
+  string key;
+  string value;
+  bool eof = false;
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_TRUE(reader.next(&key, &value, &eof).ok());
+    ASSERT_FALSE(eof);
+    EXPECT_EQ("key" + std::to_string(i), key);
+    EXPECT_EQ(string(i, 'v'), value);
+  }
+  EXPECT_TRUE(reader.next(&key, &value, &eof).ok());
+  EXPECT_TRUE(eof);
+}
+
+TEST_F(CacheSnapshotTest, TestTruncatedSnapshot) {
+  {
+    CacheSnapshotWriter writer(path_, false);
+    ASSERT_TRUE(writer.open().ok());
+    EXPECT_TRUE(writer.append("abc", "ignored").ok());
+    EXPECT_TRUE(writer.append("def", "").ok());
+    EXPECT_TRUE(writer.close().ok());
+  }
+  ASSERT_EQ(0, truncate(path_.c_str(), 8 + 8 + 7 + 5));
+
+  CacheSnapshotReader reader(path_);
+  ASSERT_TRUE(reader.open().ok());
+  EXPECT_FALSE(reader.with_values());
+  string key;
+  string value;
+  bool eof = false;
+  EXPECT_TRUE(reader.next(&key, &value, &eof).ok());
+  EXPECT_EQ("abc", key);
+  EXPECT_EQ("", value);
+  EXPECT_FALSE(reader.next(&key, &value, &eof).ok());
+}
+
+TEST_F(CacheSnapshotTest, TestOpenInvalidSnapshot) {
+  CacheSnapshotReader missing(path_);
+  EXPECT_FALSE(missing.open().ok());
+
+  File file = File::open(path_, O_WRONLY | O_CREAT);
+  ASSERT_EQ(11, write(file.fd(), "not a cache", 11));
+  file.close();
+  CacheSnapshotReader reader(path_);
+  EXPECT_EQ(-EINVAL, reader.open().error());
+}
+
+typedef ShardedLRUCache<int, string> cache_type;
+
+TEST_F(CacheSnapshotTest, TestSaveAndLoadShardedLRUCache) {
+  cache_type cache(100, 4);
+  for (int i = 0; i < 100; i++) {
+    cache.insert(i, std::make_shared<string>(std::to_string(i)));
+  }
+  auto serializer = [](const string& value, string* buf) -> Status {
+    *buf = value;
+    return Status::OK;
+  };
+  ASSERT_TRUE(cache.save_snapshot(path_, serializer).ok());
+
+  // Restores the hottest half of the snapshot.
+  cache_type restored(48, 4);
+  auto deserializer = [](const int& key, const string& buf,
+                         cache_type::pointer_type* value) -> Status {
+    value->reset(new string(buf));
+    return Status::OK;
+  };
+  size_t num_loaded = 0;
+  ASSERT_TRUE(restored.load_snapshot(path_, deserializer, &num_loaded).ok());
+  EXPECT_EQ(num_loaded, restored.size());
+  EXPECT_GE(48u, num_loaded);
+
+  cache_type::pointer_type value;
+  int num_hot = 0;
+  for (int i = 52; i < 100; i++) {
+    if (restored.find(i, &value)) {
+      EXPECT_EQ(std::to_string(i), *value);
+      num_hot++;
+    }
+  }
+  // Shards are not perfectly balanced, but most restored keys are hot ones.
+  EXPECT_GT(num_hot, 36);
+}
+
+TEST_F(CacheSnapshotTest, TestLoadKeysOnlySnapshotInRecencyOrder) {
+  cache_type cache(16, 1);
+  for (int i = 0; i < 16; i++) {
+    cache.insert(i, std::make_shared<string>(std::to_string(i)));
+  }
+  ASSERT_TRUE(cache.save_snapshot(path_).ok());
+
+  vector<int> load_order;
+  cache_type restored(16, 1);
+  auto reload = [&load_order](const int& key, const string& buf,
+                              cache_type::pointer_type* value) -> Status {
+    EXPECT_TRUE(buf.empty());
+    load_order.push_back(key);
+    if (key % 2) {
+      return Status(-ENOENT, "Odd keys are gone.");
+    }
+    value->reset(new string(std::to_string(key * 10)));
+    return Status::OK;
+  };
+  ASSERT_TRUE(restored.load_snapshot(path_, reload).ok());
+  ASSERT_EQ(16u, load_order.size());
+  for (int i = 0; i < 16; i++) {
+    EXPECT_EQ(15 - i, load_order[i]);
+  }
+  EXPECT_EQ(8u, restored.size());
+
+  // The restored LRU order is preserved: the coldest key is evicted first.
+  restored.insert(100, std::make_shared<string>("100"));
+  restored.insert(100, std::make_shared<string>("100"));
+  for (int i = 0; i < 9; i++) {
+    restored.insert(200 + i, std::make_shared<string>("new"));
+  }
+  cache_type::pointer_type value;
+  EXPECT_FALSE(restored.find(0, &value));
+  EXPECT_FALSE(restored.find(2, &value));
+  EXPECT_TRUE(restored.find(14, &value));
+  EXPECT_EQ("140", *value);
+}
+
+TEST_F(CacheSnapshotTest, TestSaveSnapshotWhileTheCacheChanges) {
+  cache_type cache(4000, 1);
+  for (int i = 0; i < 1000; i++) {
+    cache.insert(i, std::make_shared<string>(std::to_string(i)));
+  }
+  // Changes the cache between the batches: the erased keys include the
+  // snapshot cursor, and the used or new keys move in front of it.
+  auto serializer = [&cache](const string& value, string* buf) -> Status {
+    int key = std::stoi(value);
+    cache_type::pointer_type found;
+    cache.erase(key - static_cast<int>(cache_type::kSnapshotBatch));
+    cache.find(key - 2 * static_cast<int>(cache_type::kSnapshotBatch),
+               &found);
+    cache.insert(10000 + key, std::make_shared<string>("new"));
+    *buf = value;
+    return Status::OK;
+  };
+  ASSERT_TRUE(cache.save_snapshot(path_, serializer).ok());
+
+  vector<int> load_order;
+  cache_type restored(4000, 1);
+  auto reload = [&load_order](const int& key, const string& buf,
+                              cache_type::pointer_type* value) -> Status {
+    EXPECT_EQ(std::to_string(key), buf);
+    load_order.push_back(key);
+    value->reset(new string(buf));
+    return Status::OK;
+  };
+  ASSERT_TRUE(restored.load_snapshot(path_, reload).ok());
+  ASSERT_GT(load_order.size(), cache_type::kSnapshotBatch);
+  EXPECT_EQ(999, load_order[0]);
+  // Each key is written once, in the recency order of the walk.
+  for (size_t i = 1; i < load_order.size(); i++) {
+    EXPECT_LT(load_order[i], load_order[i - 1]);
+  }
+}
+
+}  // namespace vobla
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/cache_stats.cpp
+ * \brief Implementation of the cache statistics.
+ */
+
+#include <cmath>
+#include <mutex>
+#include "vobla/cache_stats.h"
+
+namespace vobla {
+
+const bool NullCacheStats::kEnabled;
+const bool CacheStats::kEnabled;
+const size_t CacheStats::kNumAgeBuckets;
+
+namespace {
+
+/// The resolution of the recent window: a history point is kept for every
+/// 1/16 of the window.
+const int kWindowResolution = 16;
+
+}  // namespace
+
+CacheStats::CacheStats(size_t num_slots) {
+  resize(num_slots);
+}
+
+CacheStats::~CacheStats() {
+}
+
+void CacheStats::resize(size_t num_slots) {
+  num_slots_ = num_slots ? num_slots : 1;
+  // Value-initialization zeros the counters.
+  slots_.reset(new Slot[num_slots_]());
+  std::lock_guard<std::mutex> lock(history_mutex_);
+  history_.clear();
+}
+
+void CacheStats::set_window(double seconds) {
+  std::lock_guard<std::mutex> lock(history_mutex_);
+  window_ = seconds;
+  history_.clear();
+}
+
+// static
+size_t CacheStats::age_bucket(double age) {
+  double ms = age * 1000;
+  if (ms < 1) {
+    return 0;
+  }
+  size_t bucket = static_cast<size_t>(std::log2(ms)) + 1;
+  return bucket < kNumAgeBuckets ? bucket : kNumAgeBuckets - 1;
+}
+
+CacheStatsSnapshot CacheStats::snapshot(double now) {
+  CacheStatsSnapshot result;
+  result.eviction_ages.resize(kNumAgeBuckets);
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < num_slots_; i++) {
+    const Slot& slot = slots_[i];
+    result.hits += slot.hits.load(std::memory_order_relaxed);
+    result.misses += slot.misses.load(std::memory_order_relaxed);
+    result.inserts += slot.inserts.load(std::memory_order_relaxed);
+    result.evictions += slot.evictions.load(std::memory_order_relaxed);
+    bytes += slot.bytes.load(std::memory_order_relaxed);
+    for (size_t b = 0; b < kNumAgeBuckets; b++) {
+      result.eviction_ages[b] +=
+          slot.eviction_ages[b].load(std::memory_order_relaxed);
+    }
+  }
+  result.bytes = static_cast<int64_t>(bytes);
+
+  std::lock_guard<std::mutex> lock(history_mutex_);
+  if (history_.empty() ||
+      now - history_.back().time >= window_ / kWindowResolution) {
+    history_.push_back(HistoryPoint{now, result.hits, result.misses});
+  }
+  // The base of the window is the newest point that is at least window_
+  // old, or the oldest point if there is no such point.
+  while (history_.size() > 1 && now - history_[1].time >= window_) {
+    history_.pop_front();
+  }
+  const HistoryPoint& base = history_.front();
+  if (base.time == now) {
+    result.recent_hits = result.hits;
+    result.recent_misses = result.misses;
+  } else {
+    result.recent_hits = result.hits - base.hits;
+    result.recent_misses = result.misses - base.misses;
+    result.recent_window = now - base.time;
+  }
+  return result;
+}
+
+}  // namespace vobla
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/cache_stats.h
+ * \brief Statistics policies of the caches.
+ *
+ * A cache takes a statistics policy as a template parameter and calls its
+ * record_*() hooks. NullCacheStats does nothing, so the hooks compile out;
+ * CacheStats keeps the counters in per-slot (e.g., per-shard) cache lines,
+ * so recording never contends between the slots.
+ */
+
+#ifndef VOBLA_CACHE_STATS_H_
+#define VOBLA_CACHE_STATS_H_
+
+#include <boost/utility.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "vobla/clock.h"
+
+namespace vobla {
+
+/**
+ * \class CacheStatsSnapshot vobla/cache_stats.h
+ * \brief The statistics of a cache at a point in time.
+ */
+struct CacheStatsSnapshot {
+  uint64_t hits = 0;
+
+  uint64_t misses = 0;
+
+  uint64_t inserts = 0;
+
+  uint64_t evictions = 0;
+
+  /// The total charge (by default in bytes) of the cached values.
+  int64_t bytes = 0;
+
+  /**
+   * \brief The histogram of the residency ages of the evicted values.
+   *
+   * Bucket 0 counts the ages below 1 ms, and bucket `i` counts the ages in
+   * [2^(i-1), 2^i) ms. The last bucket also counts all older values.
+   */
+  std::vector<uint64_t> eviction_ages;
+
+  /// The hits within the recent window.
+  uint64_t recent_hits = 0;
+
+  /// The misses within the recent window.
+  uint64_t recent_misses = 0;
+
+  /// The length of the recent window in seconds.
+  double recent_window = 0;
+
+  /// Returns the hit ratio since the cache was created.
+  double hit_ratio() const {
+    return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0;
+  }
+
+  /// Returns the hit ratio within the recent window.
+  double recent_hit_ratio() const {
+    return recent_hits + recent_misses ?
+        static_cast<double>(recent_hits) / (recent_hits + recent_misses) : 0;
+  }
+};
+
+/**
+ * \class NullCacheStats vobla/cache_stats.h
+ * \brief The statistics policy that records nothing.
+ */
+class NullCacheStats : boost::noncopyable {
+ public:
+  static const bool kEnabled = false;
+
+  /// Nothing is stored in the cache entries.
+  struct Stamp {};
+
+  void resize(size_t) {}
+
+  void record_hit(size_t) {}
+
+  void record_miss(size_t) {}
+
+  void record_insert(size_t, size_t, Clock*, Stamp*) {}
+
+  void record_remove(size_t, const Stamp&) {}
+
+  void record_eviction(size_t, const Stamp&, Clock*) {}
+
+  CacheStatsSnapshot snapshot(double now) {
+    return CacheStatsSnapshot();
+  }
+};
+
+/**
+ * \class CacheStats vobla/cache_stats.h
+ * \brief Counts hits, misses, inserts, evictions, bytes and the residency
+ * ages of the evicted values.
+ *
+ * The counters are split into slots, each on its own cache lines. A slot
+ * must only be written by one thread at a time (e.g., while holding the
+ * lock of a cache shard), but snapshot() can be called concurrently.
+ *
+ * snapshot() also reports the hit ratio over the recent window, measured
+ * from the snapshots taken at least `window` seconds ago.
+ */
+class CacheStats : boost::noncopyable {
+ public:
+  static const bool kEnabled = true;
+
+  static const size_t kNumAgeBuckets = 32;
+
+  /// The insertion time and the charge of a cached value.
+  struct Stamp {
+    double inserted_at = 0;
+
+    size_t charge = 0;
+  };
+
+  /// Constructs the statistics with `num_slots` slots.
+  explicit CacheStats(size_t num_slots = 1);
+
+  ~CacheStats();
+
+  /// Resets the statistics to `num_slots` slots. It is not thread-safe.
+  void resize(size_t num_slots);
+
+  /// Sets the length of the recent window in seconds. Defaults to 60.
+  void set_window(double seconds);
+
+  void record_hit(size_t slot) {
+    increase(&slots_[slot].hits, 1);
+  }
+
+  void record_miss(size_t slot) {
+    increase(&slots_[slot].misses, 1);
+  }
+
+  /// Records an insertion and stamps the inserted value.
+  void record_insert(size_t slot, size_t charge, Clock* clock,
+                     Stamp* stamp) {
+    stamp->inserted_at = clock->now();
+    stamp->charge = charge;
+    increase(&slots_[slot].inserts, 1);
+    increase(&slots_[slot].bytes, charge);
+  }
+
+  /// Records the removal of a value that is not an eviction.
+  void record_remove(size_t slot, const Stamp& stamp) {
+    increase(&slots_[slot].bytes, -stamp.charge);
+  }
+
+  void record_eviction(size_t slot, const Stamp& stamp, Clock* clock) {
+    Slot& s = slots_[slot];
+    increase(&s.evictions, 1);
+    increase(&s.bytes, -stamp.charge);
+    increase(&s.eviction_ages[age_bucket(clock->now() - stamp.inserted_at)],
+             1);
+  }
+
+  /// Sums up the slots. `now` is the current time of the cache's clock.
+  CacheStatsSnapshot snapshot(double now);
+
+  /// Returns the histogram bucket of an age in seconds.
+  static size_t age_bucket(double age);
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> hits;
+
+    std::atomic<uint64_t> misses;
+
+    std::atomic<uint64_t> inserts;
+
+    std::atomic<uint64_t> evictions;
+
+    /// Wraps around on removals; read as a signed value.
+    std::atomic<uint64_t> bytes;
+
+    std::atomic<uint64_t> eviction_ages[kNumAgeBuckets];
+
+    /// Keeps the slots on separate cache lines.
+    char padding[64];
+  };
+
+  /// A past total of hits and misses, to compute the recent hit ratio.
+  struct HistoryPoint {
+    double time;
+
+    uint64_t hits;
+
+    uint64_t misses;
+  };
+
+  /// Only the owner of the slot writes the counter, so it does not need an
+  /// atomic read-modify-write.
+  static void increase(std::atomic<uint64_t>* counter, uint64_t delta) {
+    counter->store(counter->load(std::memory_order_relaxed) + delta,
+                   std::memory_order_relaxed);
+  }
+
+  size_t num_slots_ = 0;
+
+  std::unique_ptr<Slot[]> slots_;
+
+  double window_ = 60;
+
+  std::mutex history_mutex_;
+
+  std::deque<HistoryPoint> history_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_CACHE_STATS_H_
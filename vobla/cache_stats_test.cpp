@@ -0,0 +1,114 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include "vobla/cache_stats.h"
+#include "vobla/clock.h"
+#include "vobla/sharded_lru_cache.h"
+
+using std::string;
+
+namespace vobla {
+
+typedef ShardedLRUCache<int, string, std::hash<int>, CacheStats> cache_type;
+
+TEST(CacheStatsTest, TestNullStatsAddNothing) {
+  EXPECT_TRUE(std::is_empty<NullCacheStats>::value);
+  EXPECT_TRUE(std::is_empty<NullCacheStats::Stamp>::value);
+}
+
+TEST(CacheStatsTest, TestAgeBuckets) {
+  EXPECT_EQ(0u, CacheStats::age_bucket(0));
+  EXPECT_EQ(0u, CacheStats::age_bucket(0.0005));
+  EXPECT_EQ(1u, CacheStats::age_bucket(0.001));
+  EXPECT_EQ(2u, CacheStats::age_bucket(0.003));
+  EXPECT_EQ(10u, CacheStats::age_bucket(1));
+  EXPECT_EQ(CacheStats::kNumAgeBuckets - 1, CacheStats::age_bucket(1e10));
+}
+
+TEST(CacheStatsTest, TestCountersOfShardedLRUCache) {
+  FakeClock clock(100);
+  cache_type cache(2, 1, nullptr, &clock);
+  cache.set_charger([](const int&, const cache_type::pointer_type& value) {
+      return value->size();
+    });
+  cache.insert(1, std::make_shared<string>("a"));
+  cache.insert(2, std::make_shared<string>("bb"));
+  cache_type::pointer_type value;
+  EXPECT_TRUE(cache.find(1, &value));
+  EXPECT_FALSE(cache.find(3, &value));
+
+  auto stats = cache.stats_snapshot();
+  EXPECT_EQ(1u, stats.hits);
+  EXPECT_EQ(1u, stats.misses);
+  EXPECT_EQ(2u, stats.inserts);
+  EXPECT_EQ(0u, stats.evictions);
+  EXPECT_EQ(3, stats.bytes);
+  EXPECT_DOUBLE_EQ(0.5, stats.hit_ratio());
+
+  // Evicts 2 after 2 seconds.
+  clock.advance(2);
+  cache.insert(3, std::make_shared<string>("ccc"));
+  // Replaces the value of 1.
+  cache.insert(1, std::make_shared<string>("dddd"));
+  EXPECT_TRUE(cache.erase(3));
+
+  stats = cache.stats_snapshot();
+  EXPECT_EQ(4u, stats.inserts);
+  EXPECT_EQ(1u, stats.evictions);
+  EXPECT_EQ(4, stats.bytes);
+  ASSERT_EQ(CacheStats::kNumAgeBuckets, stats.eviction_ages.size());
+  EXPECT_EQ(1u, stats.eviction_ages[CacheStats::age_bucket(2)]);
+
+  cache.clear();
+  EXPECT_EQ(0, cache.stats_snapshot().bytes);
+}
+
+TEST(CacheStatsTest, TestRecentHitRatio) {
+  FakeClock clock(0);
+  cache_type cache(16, 4, nullptr, &clock);
+  cache.stats()->set_window(10);
+  cache.insert(1, std::make_shared<string>("1"));
+  cache_type::pointer_type value;
+  for (int i = 0; i < 10; i++) {
+    cache.find(1, &value);
+  }
+  auto stats = cache.stats_snapshot();
+  EXPECT_DOUBLE_EQ(1.0, stats.recent_hit_ratio());
+
+  clock.advance(10);
+  for (int i = 0; i < 10; i++) {
+    cache.find(2, &value);
+  }
+  stats = cache.stats_snapshot();
+  EXPECT_DOUBLE_EQ(0.5, stats.hit_ratio());
+  EXPECT_DOUBLE_EQ(0, stats.recent_hit_ratio());
+  EXPECT_DOUBLE_EQ(10, stats.recent_window);
+
+  clock.advance(10);
+  for (int i = 0; i < 30; i++) {
+    cache.find(1, &value);
+  }
+  stats = cache.stats_snapshot();
+  EXPECT_DOUBLE_EQ(0.8, stats.hit_ratio());
+  EXPECT_DOUBLE_EQ(1.0, stats.recent_hit_ratio());
+  EXPECT_EQ(30u, stats.recent_hits);
+}
+
+}  // namespace vobla
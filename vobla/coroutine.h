@@ -0,0 +1,648 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/coroutine.h
+ * \brief C++20 coroutines that resume on an Executor.
+ *
+ * A chain of async steps reads like blocking code:
+ *
+ * ~~~~~~~~~{cpp}
+ * coro::Task<int> handle(ThreadPool* pool, ScheduledExecutor* timers) {
+ *   co_await coro::schedule(pool);      // Continues in a worker.
+ *   co_await coro::sleep_for(timers, 0.01);
+ *   std::vector<coro::Task<int>> reads;
+ *   for (auto& key : keys) {
+ *     reads.push_back(read(pool, key));
+ *   }
+ *   std::vector<int> values = co_await coro::when_all(std::move(reads));
+ *   co_return sum(values);
+ * }
+ *
+ * int total = coro::sync_wait(handle(&pool, &timers));
+ * ~~~~~~~~~
+ *
+ * It needs a compiler with C++20 coroutines; otherwise this header is
+ * empty and VOBLA_HAS_COROUTINES is 0. The rest of vobla stays C++11.
+ */
+
+#ifndef VOBLA_COROUTINE_H_
+#define VOBLA_COROUTINE_H_
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define VOBLA_HAS_COROUTINES 1
+#else
+#define VOBLA_HAS_COROUTINES 0
+#endif
+
+#if VOBLA_HAS_COROUTINES
+
+#include <glog/logging.h>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>  // NOLINT(build/include_order)
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <optional>  // NOLINT(build/include_order)
+#include <utility>
+#include <vector>
+#include "vobla/executor.h"
+#include "vobla/scheduled_executor.h"
+
+namespace vobla {
+namespace coro {
+
+/**
+ * \class FrameAllocator vobla/coroutine.h
+ * \brief Recycles the coroutine frames in per-thread free lists.
+ *
+ * The frames are rounded up to kGranularity bytes. Up to kMaxCached frames
+ * of each size class up to kMaxSize are kept by the thread that frees
+ * them, so a steady stream of coroutines stops calling the global
+ * allocator. The larger frames go straight to it.
+ */
+class FrameAllocator {
+ public:
+  static constexpr size_t kGranularity = 64;
+
+  static constexpr size_t kNumClasses = 16;
+
+  static constexpr size_t kMaxSize = kGranularity * kNumClasses;
+
+  /// The maximal number of cached frames per size class and thread.
+  static constexpr size_t kMaxCached = 64;
+
+  static void* allocate(size_t size) {
+    if (size > kMaxSize) {
+      return ::operator new(size);
+    }
+    Cache& cache = local_cache();
+    size_t index = class_of(size);
+    FreeFrame* frame = cache.heads[index];
+    if (!frame) {
+      return ::operator new((index + 1) * kGranularity);
+    }
+    cache.heads[index] = frame->next;
+    cache.counts[index]--;
+    return frame;
+  }
+
+  static void deallocate(void* ptr, size_t size) {
+    if (size > kMaxSize) {
+      ::operator delete(ptr);
+      return;
+    }
+    Cache& cache = local_cache();
+    size_t index = class_of(size);
+    if (cache.counts[index] >= kMaxCached) {
+      ::operator delete(ptr);
+      return;
+    }
+    FreeFrame* frame = static_cast<FreeFrame*>(ptr);
+    frame->next = cache.heads[index];
+    cache.heads[index] = frame;
+    cache.counts[index]++;
+  }
+
+  /// Returns the number of frames cached by the calling thread.
+  static size_t num_cached() {
+    const Cache& cache = local_cache();
+    size_t total = 0;
+    for (size_t count : cache.counts) {
+      total += count;
+    }
+    return total;
+  }
+
+ private:
+  struct FreeFrame {
+    FreeFrame* next;
+  };
+
+  struct Cache {
+    ~Cache() {
+      for (FreeFrame* head : heads) {
+        while (head) {
+          FreeFrame* next = head->next;
+          ::operator delete(head);
+          head = next;
+        }
+      }
+    }
+
+    FreeFrame* heads[kNumClasses] = {};
+
+    size_t counts[kNumClasses] = {};
+  };
+
+  static size_t class_of(size_t size) {
+    return size == 0 ? 0 : (size - 1) / kGranularity;
+  }
+
+  static Cache& local_cache() {
+    thread_local Cache cache;
+    return cache;
+  }
+};
+
+template <typename T = void>
+class Task;
+
+namespace internal {
+
+/// Allocates the coroutine frames with FrameAllocator.
+struct FrameAllocated {
+  static void* operator new(size_t size) {
+    return FrameAllocator::allocate(size);
+  }
+
+  static void operator delete(void* ptr, size_t size) {
+    FrameAllocator::deallocate(ptr, size);
+  }
+};
+
+/// The promise parts shared by all Task types.
+class PromiseBase : public FrameAllocated {
+ public:
+  /// Resumes the awaiting coroutine, if any, when the task ends.
+  struct FinalAwaiter {
+    bool await_ready() noexcept {
+      return false;
+    }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> handle) noexcept {
+      std::coroutine_handle<> continuation = handle.promise().continuation_;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  /// The tasks are lazy: they start when awaited.
+  std::suspend_always initial_suspend() noexcept {
+    return {};
+  }
+
+  FinalAwaiter final_suspend() noexcept {
+    return {};
+  }
+
+  void unhandled_exception() {
+    error_ = std::current_exception();
+  }
+
+  void set_continuation(std::coroutine_handle<> continuation) {
+    continuation_ = continuation;
+  }
+
+ protected:
+  void rethrow_if_failed() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+ private:
+  std::coroutine_handle<> continuation_;
+
+  std::exception_ptr error_;
+};
+
+template <typename T>
+class Promise : public PromiseBase {
+ public:
+  Task<T> get_return_object();
+
+  template <typename U>
+  void return_value(U&& value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  /// Moves the result out, or rethrows the exception of the task.
+  T result() {
+    rethrow_if_failed();
+    return std::move(*value_);
+  }
+
+ private:
+  std::optional<T> value_;
+};
+
+template <>
+class Promise<void> : public PromiseBase {
+ public:
+  Task<void> get_return_object();
+
+  void return_void() {}
+
+  void result() {
+    rethrow_if_failed();
+  }
+};
+
+/// Starts a task and resumes the awaiting coroutine when it ends.
+template <typename T, bool WithResult>
+class TaskAwaiter {
+ public:
+  explicit TaskAwaiter(std::coroutine_handle<Promise<T>> handle)
+      : handle_(handle) {}
+
+  bool await_ready() noexcept {
+    return handle_.done();
+  }
+
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<> continuation) noexcept {
+    handle_.promise().set_continuation(continuation);
+    return handle_;
+  }
+
+  decltype(auto) await_resume() {
+    if constexpr (WithResult) {
+      return handle_.promise().result();
+    }
+  }
+
+ private:
+  std::coroutine_handle<Promise<T>> handle_;
+};
+
+}  // namespace internal
+
+/**
+ * \class Task vobla/coroutine.h
+ * \brief A lazy coroutine producing a `T`.
+ *
+ * It starts when it is awaited, runs in the awaiting thread until it
+ * suspends (e.g., on schedule()), and resumes the awaiting coroutine in
+ * the thread where it ends, without going through an executor. An
+ * exception escaping the coroutine is rethrown by `co_await`.
+ *
+ * A Task owns its frame, and can only be awaited once. Awaiting an empty
+ * (default-constructed or moved-from) Task is a programming error.
+ */
+template <typename T>
+class [[nodiscard]] Task {  // NOLINT(whitespace/braces)
+ public:
+  typedef internal::Promise<T> promise_type;
+
+  typedef std::coroutine_handle<promise_type> Handle;
+
+  Task() = default;
+
+  explicit Task(Handle handle) : handle_(handle) {}
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      reset();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+
+  Task(const Task&) = delete;
+
+  Task& operator=(const Task&) = delete;
+
+  ~Task() {
+    reset();
+  }
+
+  /// Returns true if it owns a coroutine.
+  bool valid() const {
+    return static_cast<bool>(handle_);
+  }
+
+  /// Returns true if the coroutine has ended.
+  bool done() const {
+    return handle_ && handle_.done();
+  }
+
+  /// Runs the task and returns its result.
+  internal::TaskAwaiter<T, true> operator co_await() const noexcept {
+    DCHECK(handle_) << "co_await on an empty task.";
+    return internal::TaskAwaiter<T, true>(handle_);
+  }
+
+  /// Runs the task without taking its result.
+  internal::TaskAwaiter<T, false> when_ready() const noexcept {
+    DCHECK(handle_) << "co_await on an empty task.";
+    return internal::TaskAwaiter<T, false>(handle_);
+  }
+
+  /// Returns the result of an ended task, or rethrows its exception.
+  T result() {
+    DCHECK(handle_) << "The result of an empty task.";
+    return handle_.promise().result();
+  }
+
+ private:
+  void reset() {
+    if (handle_) {
+      handle_.destroy();
+      handle_ = {};
+    }
+  }
+
+  Handle handle_;
+};
+
+namespace internal {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+  return Task<void>(
+      std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+/**
+ * \brief Runs a task to its end and calls `on_done(arg)`, which returns
+ * the coroutine to resume next.
+ *
+ * It is how the non-coroutines (sync_wait()) and the fan-outs (when_all())
+ * start the tasks and learn that they ended.
+ */
+class Driver {
+ public:
+  typedef std::coroutine_handle<> (*Callback)(void* arg);
+
+  class promise_type : public FrameAllocated {
+   public:
+    struct FinalAwaiter {
+      bool await_ready() noexcept {
+        return false;
+      }
+
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<promise_type> handle) noexcept {
+        promise_type& promise = handle.promise();
+        return promise.on_done_(promise.arg_);
+      }
+
+      void await_resume() noexcept {}
+    };
+
+    Driver get_return_object() {
+      return Driver(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept {
+      return {};
+    }
+
+    void return_void() {}
+
+    /// The task keeps its own exception.
+    void unhandled_exception() {
+      std::terminate();
+    }
+
+   private:
+    friend class Driver;
+
+    Callback on_done_ = nullptr;
+
+    void* arg_ = nullptr;
+  };
+
+  explicit Driver(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  Driver(Driver&& other) noexcept
+      : handle_(std::exchange(other.handle_, {})) {}
+
+  Driver(const Driver&) = delete;
+
+  Driver& operator=(const Driver&) = delete;
+
+  ~Driver() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  /// Starts the task in the calling thread.
+  void start(Callback on_done, void* arg) {
+    handle_.promise().on_done_ = on_done;
+    handle_.promise().arg_ = arg;
+    handle_.resume();
+  }
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+Driver drive(const Task<T>* task) {
+  co_await task->when_ready();
+}
+
+/// Blocks a thread until a Driver ends.
+class Latch {
+ public:
+  static std::coroutine_handle<> count_down(void* arg) {
+    Latch* latch = static_cast<Latch*>(arg);
+    // Notifies under the lock, since the waiter destroys the latch.
+    std::lock_guard<std::mutex> lock(latch->mutex_);
+    latch->done_ = true;
+    latch->cond_.notify_all();
+    return std::noop_coroutine();
+  }
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return done_; });
+  }
+
+ private:
+  std::mutex mutex_;
+
+  std::condition_variable cond_;
+
+  bool done_ = false;
+};
+
+/// Starts tasks and resumes the awaiting coroutine when all have ended.
+template <typename T>
+class WhenAllAwaiter {
+ public:
+  explicit WhenAllAwaiter(const std::vector<Task<T>>* tasks)
+      : tasks_(tasks), remaining_(0) {}
+
+  bool await_ready() noexcept {
+    return tasks_->empty();
+  }
+
+  bool await_suspend(std::coroutine_handle<> continuation) {
+    continuation_ = continuation;
+    // One extra count, so that the tasks that end before all have started
+    // do not resume the awaiting coroutine.
+    remaining_.store(tasks_->size() + 1);
+    drivers_.reserve(tasks_->size());
+    for (const auto& task : *tasks_) {
+      drivers_.push_back(drive(&task));
+    }
+    for (auto& driver : drivers_) {
+      driver.start(&WhenAllAwaiter::count_down, this);
+    }
+    return remaining_.fetch_sub(1) > 1;
+  }
+
+  void await_resume() noexcept {}
+
+ private:
+  static std::coroutine_handle<> count_down(void* arg) {
+    WhenAllAwaiter* self = static_cast<WhenAllAwaiter*>(arg);
+    if (self->remaining_.fetch_sub(1) == 1) {
+      return self->continuation_;
+    }
+    return std::noop_coroutine();
+  }
+
+  const std::vector<Task<T>>* tasks_;
+
+  std::vector<Driver> drivers_;
+
+  std::atomic<size_t> remaining_;
+
+  std::coroutine_handle<> continuation_;
+};
+
+}  // namespace internal
+
+/**
+ * \brief Runs a task in the calling thread, blocks until it ends, and
+ * returns its result or rethrows its exception.
+ *
+ * It bridges the blocking code to the coroutines, e.g., in main() or in
+ * tests. Calling it from a worker of the pool that the task resumes on
+ * can deadlock a small pool.
+ */
+template <typename T>
+T sync_wait(Task<T> task) {
+  internal::Latch latch;
+  {
+    internal::Driver driver = internal::drive(&task);
+    driver.start(&internal::Latch::count_down, &latch);
+    latch.wait();
+  }
+  return task.result();
+}
+
+/// Resumes the awaiting coroutine in the executor.
+class ScheduleAwaiter {
+ public:
+  explicit ScheduleAwaiter(Executor* executor) : executor_(executor) {}
+
+  bool await_ready() noexcept {
+    return false;
+  }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    executor_->post([handle] { handle.resume(); });
+  }
+
+  void await_resume() noexcept {}
+
+ private:
+  Executor* executor_;
+};
+
+/// `co_await schedule(&pool)` continues the coroutine in a worker of the
+/// pool.
+inline ScheduleAwaiter schedule(Executor* executor) {
+  return ScheduleAwaiter(executor);
+}
+
+/// Resumes the awaiting coroutine after a delay.
+class SleepAwaiter {
+ public:
+  SleepAwaiter(ScheduledExecutor* timers, double seconds)
+      : timers_(timers), seconds_(seconds) {}
+
+  bool await_ready() noexcept {
+    return seconds_ <= 0;
+  }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    timers_->run_after(seconds_, [handle] { handle.resume(); });
+  }
+
+  void await_resume() noexcept {}
+
+ private:
+  ScheduledExecutor* timers_;
+
+  double seconds_;
+};
+
+/**
+ * \brief `co_await sleep_for(&timers, seconds)` continues the coroutine
+ * on the executor of the timers after `seconds`, without blocking a
+ * thread.
+ */
+inline SleepAwaiter sleep_for(ScheduledExecutor* timers, double seconds) {
+  return SleepAwaiter(timers, seconds);
+}
+
+/**
+ * \brief Runs the tasks concurrently and returns their results in order.
+ *
+ * The tasks are started one by one in the awaiting thread, and each runs
+ * until its first suspension, so the tasks that should run in parallel
+ * start with `co_await schedule(pool)`. If some tasks throw, the exception
+ * of the first of them is rethrown after all have ended.
+ */
+template <typename T>
+Task<std::vector<T>> when_all(std::vector<Task<T>> tasks) {
+  co_await internal::WhenAllAwaiter<T>(&tasks);
+  std::vector<T> results;
+  results.reserve(tasks.size());
+  for (auto& task : tasks) {
+    results.push_back(task.result());
+  }
+  co_return results;
+}
+
+/// Runs the tasks concurrently and ends when all have ended.
+inline Task<void> when_all(std::vector<Task<void>> tasks) {
+  co_await internal::WhenAllAwaiter<void>(&tasks);
+  for (auto& task : tasks) {
+    task.result();
+  }
+}
+
+}  // namespace coro
+}  // namespace vobla
+
+#endif  // VOBLA_HAS_COROUTINES
+
+#endif  // VOBLA_COROUTINE_H_
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "vobla/coroutine.h"
+#include "vobla/scheduled_executor.h"
+#include "vobla/thread_pool.h"
+
+using std::vector;
+
+namespace vobla {
+namespace coro {
+
+namespace {
+
+Task<int> answer(bool* started) {
+  *started = true;
+  co_return 42;
+}
+
+Task<int> add_one(Task<int> task) {
+  int value = co_await task;
+  co_return value + 1;
+}
+
+Task<int> fail() {
+  throw std::runtime_error("failed");
+  co_return 0;
+}
+
+Task<std::thread::id> worker_id(ThreadPool* pool) {
+  co_await schedule(pool);
+  co_return std::this_thread::get_id();
+}
+
+Task<int> square(ThreadPool* pool, int value) {
+  co_await schedule(pool);
+  co_return value * value;
+}
+
+Task<> count(ThreadPool* pool, std::atomic<int>* counter) {
+  co_await schedule(pool);
+  (*counter)++;
+}
+
+}  // namespace
+
+TEST(CoroutineTest, TestTasksAreLazy) {
+  bool started = false;
+  Task<int> task = answer(&started);
+  EXPECT_TRUE(task.valid());
+  EXPECT_FALSE(started);
+  EXPECT_EQ(43, sync_wait(add_one(std::move(task))));
+  EXPECT_TRUE(started);
+}
+
+TEST(CoroutineTest, TestExceptions) {
+  EXPECT_THROW(sync_wait(add_one(fail())), std::runtime_error);
+}
+
+TEST(CoroutineTest, TestScheduleResumesOnExecutor) {
+  ThreadPool pool(2);
+  EXPECT_NE(std::this_thread::get_id(), sync_wait(worker_id(&pool)));
+}
+
+TEST(CoroutineTest, TestSleepFor) {
+  ThreadPool pool(1);
+  ScheduledExecutor timers(&pool);
+  auto start = std::chrono::steady_clock::now();
+  sync_wait([](ScheduledExecutor* timers) -> Task<> {
+      co_await sleep_for(timers, 0.01);
+    }(&timers));
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(10));
+}
+
+TEST(CoroutineTest, TestWhenAll) {
+  ThreadPool pool(4);
+  vector<Task<int>> squares;
+  for (int i = 0; i < 20; i++) {
+    squares.push_back(square(&pool, i));
+  }
+  vector<int> results = sync_wait(when_all(std::move(squares)));
+  ASSERT_EQ(20u, results.size());
+  for (int i = 0; i < 20; i++) {
+    EXPECT_EQ(i * i, results[i]);
+  }
+
+  std::atomic<int> counter(0);
+  vector<Task<>> counts;
+  for (int i = 0; i < 20; i++) {
+    counts.push_back(count(&pool, &counter));
+  }
+  sync_wait(when_all(std::move(counts)));
+  EXPECT_EQ(20, counter);
+
+  EXPECT_TRUE(sync_wait(when_all(vector<Task<int>>())).empty());
+
+  vector<Task<int>> failing;
+  failing.push_back(square(&pool, 2));
+  failing.push_back(fail());
+  EXPECT_THROW(sync_wait(when_all(std::move(failing))), std::runtime_error);
+}
+
+TEST(CoroutineTest, TestFramesAreRecycled) {
+  bool started = false;
+  sync_wait(answer(&started));
+  size_t cached = FrameAllocator::num_cached();
+  EXPECT_GT(cached, 0u);
+  // The same frames are reused and freed again.
+  sync_wait(answer(&started));
+  EXPECT_EQ(cached, FrameAllocator::num_cached());
+
+  void* frame = FrameAllocator::allocate(100);
+  cached = FrameAllocator::num_cached();
+  FrameAllocator::deallocate(frame, 100);
+  EXPECT_EQ(cached + 1, FrameAllocator::num_cached());
+  EXPECT_EQ(frame, FrameAllocator::allocate(100));
+  FrameAllocator::deallocate(frame, 100);
+}
+
+}  // namespace coro
+}  // namespace vobla
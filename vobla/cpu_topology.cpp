@@ -0,0 +1,251 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/cpu_topology.cpp
+ * \brief Implementation of CpuTopology.
+ */
+
+#if defined(linux) || defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include "vobla/cpu_topology.h"
+#include "vobla/sysinfo.h"
+
+namespace fs = boost::filesystem;
+using std::string;
+using std::vector;
+
+namespace vobla {
+
+namespace {
+
+/// Reads the first line of a file.
+bool read_line(const string& path, string* line) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (!file) {
+    return false;
+  }
+  char buffer[4096];
+  bool success = fgets(buffer, sizeof(buffer), file) != nullptr;
+  fclose(file);
+  if (success) {
+    *line = buffer;
+  }
+  return success;
+}
+
+/// Reads an integer from a file, or returns `fallback`.
+int read_int(const string& path, int fallback) {
+  string line;
+  if (!read_line(path, &line) || line.empty()) {
+    return fallback;
+  }
+  return atoi(line.c_str());
+}
+
+}  // namespace
+
+CpuTopology::CpuTopology() {
+}
+
+CpuTopology::CpuTopology(const vector<Cpu>& cpus) : cpus_(cpus) {
+  for (const auto& cpu : cpus_) {
+    if (nodes_.size() <= cpu.node) {
+      nodes_.resize(cpu.node + 1);
+    }
+    nodes_[cpu.node].push_back(cpu.id);
+  }
+}
+
+CpuTopology::~CpuTopology() {
+}
+
+// static
+Status CpuTopology::parse_cpu_list(const string& str, vector<int>* cpus) {
+  cpus->clear();
+  size_t pos = 0;
+  while (pos < str.size()) {
+    size_t end = str.find(',', pos);
+    if (end == string::npos) {
+      end = str.size();
+    }
+    string item = str.substr(pos, end - pos);
+    pos = end + 1;
+    if (item.empty() || item == "\n") {
+      continue;
+    }
+    char* rest;
+    long first = strtol(item.c_str(), &rest, 10);  // NOLINT
+    long last = first;  // NOLINT
+    if (*rest == '-') {
+      last = strtol(rest + 1, &rest, 10);
+    }
+    if (rest == item.c_str() || (*rest && *rest != '\n') || first < 0 ||
+        last < first) {
+      return Status(-EINVAL, "Invalid CPU list: " + str);
+    }
+    for (long cpu = first; cpu <= last; cpu++) {  // NOLINT
+      cpus->push_back(cpu);
+    }
+  }
+  return Status::OK;
+}
+
+// static
+CpuTopology CpuTopology::discover(const string& sysfs,
+                                  const vector<int>* allowed) {
+  CpuTopology topology;
+  string line;
+  vector<int> ids;
+  if (!read_line(sysfs + "/cpu/online", &line) ||
+      !parse_cpu_list(line, &ids).ok() || ids.empty()) {
+    ids.clear();
+    for (int i = 0; i < SysInfo::get_num_cpus(); i++) {
+      ids.push_back(i);
+    }
+  }
+  vector<int> affinity;
+  if (!allowed && get_process_affinity(&affinity).ok()) {
+    allowed = &affinity;
+  }
+  if (allowed) {
+    vector<int> sorted_allowed(*allowed);
+    std::sort(sorted_allowed.begin(), sorted_allowed.end());
+    vector<int> usable;
+    for (int id : ids) {
+      if (std::binary_search(sorted_allowed.begin(), sorted_allowed.end(),
+                             id)) {
+        usable.push_back(id);
+      }
+    }
+    if (!usable.empty()) {
+      ids.swap(usable);
+    }
+  }
+
+  // Node id -> CPUs, ordered by the node ids.
+  std::map<int, vector<int>> nodes;
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(sysfs + "/node", ec), end;
+       !ec && it != end; it.increment(ec)) {
+    string name = it->path().filename().string();
+    if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+        name.find_first_not_of("0123456789", 4) != string::npos) {
+      continue;
+    }
+    vector<int> cpus;
+    if (read_line(it->path().string() + "/cpulist", &line) &&
+        parse_cpu_list(line, &cpus).ok() && !cpus.empty()) {
+      nodes[atoi(name.c_str() + 4)] = cpus;
+    }
+  }
+  std::map<int, size_t> node_of_cpu;
+  for (const auto& node : nodes) {
+    for (int cpu : node.second) {
+      node_of_cpu[cpu] = topology.nodes_.size();
+    }
+    topology.nodes_.emplace_back();
+  }
+  if (topology.nodes_.empty()) {
+    topology.nodes_.emplace_back();
+  }
+
+  std::sort(ids.begin(), ids.end());
+  for (int id : ids) {
+    string dir = sysfs + "/cpu/cpu" + std::to_string(id) + "/topology/";
+    Cpu cpu;
+    cpu.id = id;
+    cpu.core = read_int(dir + "core_id", id);
+    cpu.package = read_int(dir + "physical_package_id", 0);
+    auto it = node_of_cpu.find(id);
+    cpu.node = it == node_of_cpu.end() ? 0 : it->second;
+    topology.cpus_.push_back(cpu);
+    topology.nodes_[cpu.node].push_back(id);
+  }
+  // Drops the nodes without online CPUs (e.g., memory-only nodes).
+  vector<size_t> renumber(topology.nodes_.size());
+  vector<vector<int>> nonempty;
+  for (size_t i = 0; i < topology.nodes_.size(); i++) {
+    renumber[i] = nonempty.size();
+    if (!topology.nodes_[i].empty()) {
+      nonempty.push_back(topology.nodes_[i]);
+    }
+  }
+  for (auto& cpu : topology.cpus_) {
+    cpu.node = renumber[cpu.node];
+  }
+  topology.nodes_.swap(nonempty);
+  return topology;
+}
+
+// static
+const CpuTopology& CpuTopology::machine() {
+  static const CpuTopology topology = discover();
+  return topology;
+}
+
+// static
+Status CpuTopology::get_process_affinity(vector<int>* cpus) {
+  cpus->clear();
+#if defined(linux) || defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set)) {
+    return Status::system_error(errno);
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus->push_back(cpu);
+    }
+  }
+  return Status::OK;
+#else
+  return Status(-ENOTSUP, "Process affinity is not supported.");
+#endif
+}
+
+// static
+Status CpuTopology::set_thread_affinity(const vector<int>& cpus) {
+#if defined(linux) || defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      return Status(-EINVAL, "Invalid CPU id.");
+    }
+    CPU_SET(cpu, &set);
+  }
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (ret) {
+    return Status::system_error(ret);
+  }
+  return Status::OK;
+#else
+  return Status(-ENOTSUP, "Thread affinity is not supported.");
+#endif
+}
+
+}  // namespace vobla
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/cpu_topology.h
+ * \brief The CPUs, cores and NUMA nodes of the machine.
+ */
+
+#ifndef VOBLA_CPU_TOPOLOGY_H_
+#define VOBLA_CPU_TOPOLOGY_H_
+
+#include <string>
+#include <vector>
+#include "vobla/status.h"
+
+namespace vobla {
+
+/**
+ * \class CpuTopology vobla/cpu_topology.h
+ * \brief Describes which logical CPUs share a core, a package and a NUMA
+ * node.
+ *
+ * On Linux, discover() reads it from sysfs:
+ *  - `cpu/online` lists the online CPUs;
+ *  - `cpu/cpuN/topology/{core_id,physical_package_id}` locate each CPU;
+ *  - `node/nodeN/cpulist` lists the CPUs of each NUMA node.
+ *
+ * Only the CPUs in the affinity mask of the process are kept, so that
+ * the threads are not bound to CPUs excluded by `taskset`, cpusets or a
+ * container. The NUMA nodes are renumbered from 0 in the order of their
+ * ids. Without sysfs, all `SysInfo::get_num_cpus()` CPUs are on one node.
+ */
+class CpuTopology {
+ public:
+  /// A logical CPU.
+  struct Cpu {
+    /// The id used by the affinity masks.
+    int id;
+
+    /// The physical core id, unique within a package.
+    int core;
+
+    int package;
+
+    /// The index of the NUMA node, from 0 to `num_nodes() - 1`.
+    size_t node;
+  };
+
+  /// Constructs an empty topology.
+  CpuTopology();
+
+  /// Constructs a topology from a list of CPUs, e.g., in tests.
+  explicit CpuTopology(const std::vector<Cpu>& cpus);
+
+  ~CpuTopology();
+
+  /**
+   * \brief Reads the topology of the CPUs that this process may use.
+   * \param sysfs the directory of the sysfs system devices, to be replaced
+   * in tests.
+   * \param allowed the CPUs to keep, or nullptr for the affinity mask of
+   * the process. If none of them is online, all online CPUs are kept.
+   */
+  static CpuTopology discover(
+      const std::string& sysfs = "/sys/devices/system",
+      const std::vector<int>* allowed = nullptr);
+
+  /// Returns the topology discovered once when first called.
+  static const CpuTopology& machine();
+
+  /// Parses a CPU list like "0-3,8,10-11".
+  static Status parse_cpu_list(const std::string& str,
+                               std::vector<int>* cpus);
+
+  /// Gets the CPUs in the affinity mask of the calling process.
+  static Status get_process_affinity(std::vector<int>* cpus);
+
+  /// Binds the calling thread to the given CPUs.
+  static Status set_thread_affinity(const std::vector<int>& cpus);
+
+  /// Returns the online CPUs ordered by id.
+  const std::vector<Cpu>& cpus() const {
+    return cpus_;
+  }
+
+  size_t num_cpus() const {
+    return cpus_.size();
+  }
+
+  size_t num_nodes() const {
+    return nodes_.size();
+  }
+
+  /// Returns the ids of the CPUs on a node.
+  const std::vector<int>& cpus_of_node(size_t node) const {
+    return nodes_[node];
+  }
+
+ private:
+  std::vector<Cpu> cpus_;
+
+  std::vector<std::vector<int>> nodes_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_CPU_TOPOLOGY_H_
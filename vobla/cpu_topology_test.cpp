@@ -0,0 +1,156 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "vobla/cpu_topology.h"
+#include "vobla/file.h"
+#include "vobla/sysinfo.h"
+
+namespace fs = boost::filesystem;
+using std::string;
+using std::vector;
+
+namespace vobla {
+
+class CpuTopologyTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    dir_.reset(new TemporaryDirectory);
+    sysfs_ = dir_->path();
+    // The fake CPUs are not in the affinity mask of the test process.
+    for (int cpu = 0; cpu < 1024; cpu++) {
+      all_cpus_.push_back(cpu);
+    }
+  }
+
+  void write(const string& path, const string& content) {
+    fs::path full = fs::path(sysfs_) / path;
+    fs::create_directories(full.parent_path());
+    FILE* file = fopen(full.string().c_str(), "w");
+    ASSERT_TRUE(file != nullptr);
+    fprintf(file, "%s\n", content.c_str());
+    fclose(file);
+  }
+
+  /// Two packages of two cores with two threads each, on two NUMA nodes.
+  void write_dual_socket() {
+    write("cpu/online", "0-7");
+    for (int cpu = 0; cpu < 8; cpu++) {
+      string dir = "cpu/cpu" + std::to_string(cpu) + "/topology/";
+      write(dir + "core_id", std::to_string(cpu % 4 / 2));
+      write(dir + "physical_package_id", std::to_string(cpu / 4));
+    }
+    write("node/node0/cpulist", "0-3");
+    write("node/node1/cpulist", "4-7");
+    // A memory-only node.
+    write("node/node2/cpulist", "");
+  }
+
+  std::unique_ptr<TemporaryDirectory> dir_;
+
+  string sysfs_;
+
+  vector<int> all_cpus_;
+};
+
+TEST_F(CpuTopologyTest, TestParseCpuList) {
+  vector<int> cpus;
+  EXPECT_TRUE(CpuTopology::parse_cpu_list("0-3,8,10-11\n", &cpus).ok());
+  EXPECT_EQ((vector<int>{0, 1, 2, 3, 8, 10, 11}), cpus);
+  EXPECT_TRUE(CpuTopology::parse_cpu_list("", &cpus).ok());
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_FALSE(CpuTopology::parse_cpu_list("3-1", &cpus).ok());
+  EXPECT_FALSE(CpuTopology::parse_cpu_list("a", &cpus).ok());
+}
+
+TEST_F(CpuTopologyTest, TestDiscover) {
+  write_dual_socket();
+  auto topology = CpuTopology::discover(sysfs_, &all_cpus_);
+  ASSERT_EQ(8u, topology.num_cpus());
+  EXPECT_EQ(2u, topology.num_nodes());
+  EXPECT_EQ((vector<int>{0, 1, 2, 3}), topology.cpus_of_node(0));
+  EXPECT_EQ((vector<int>{4, 5, 6, 7}), topology.cpus_of_node(1));
+  const auto& cpu = topology.cpus()[6];
+  EXPECT_EQ(6, cpu.id);
+  EXPECT_EQ(1, cpu.core);
+  EXPECT_EQ(1, cpu.package);
+  EXPECT_EQ(1u, cpu.node);
+}
+
+TEST_F(CpuTopologyTest, TestOfflineCpusAndNodeIds) {
+  write("cpu/online", "0,2-3");
+  write("node/node1/cpulist", "0-1");
+  write("node/node3/cpulist", "2-3");
+  auto topology = CpuTopology::discover(sysfs_, &all_cpus_);
+  ASSERT_EQ(3u, topology.num_cpus());
+  EXPECT_EQ(2u, topology.num_nodes());
+  EXPECT_EQ((vector<int>{0}), topology.cpus_of_node(0));
+  EXPECT_EQ((vector<int>{2, 3}), topology.cpus_of_node(1));
+  // Without the topology files.
+  EXPECT_EQ(2, topology.cpus()[1].core);
+}
+
+TEST_F(CpuTopologyTest, TestAffinityMask) {
+  write_dual_socket();
+  vector<int> allowed = {5, 1, 2, 42};
+  auto topology = CpuTopology::discover(sysfs_, &allowed);
+  ASSERT_EQ(3u, topology.num_cpus());
+  EXPECT_EQ(2u, topology.num_nodes());
+  EXPECT_EQ((vector<int>{1, 2}), topology.cpus_of_node(0));
+  EXPECT_EQ((vector<int>{5}), topology.cpus_of_node(1));
+
+  // The nodes without allowed CPUs are dropped.
+  allowed = {4, 5, 6, 7};
+  topology = CpuTopology::discover(sysfs_, &allowed);
+  EXPECT_EQ(1u, topology.num_nodes());
+  EXPECT_EQ((vector<int>{4, 5, 6, 7}), topology.cpus_of_node(0));
+  EXPECT_EQ(0u, topology.cpus()[0].node);
+
+  // None of the allowed CPUs is online.
+  allowed = {42};
+  topology = CpuTopology::discover(sysfs_, &allowed);
+  EXPECT_EQ(8u, topology.num_cpus());
+}
+
+TEST_F(CpuTopologyTest, TestFallbackWithoutSysfs) {
+  auto topology = CpuTopology::discover(sysfs_ + "/nonexistent",
+                                        &all_cpus_);
+  EXPECT_EQ(static_cast<size_t>(SysInfo::get_num_cpus()),
+            topology.num_cpus());
+  EXPECT_EQ(1u, topology.num_nodes());
+}
+
+TEST_F(CpuTopologyTest, TestMachine) {
+  const auto& topology = CpuTopology::machine();
+  EXPECT_GE(topology.num_cpus(), 1u);
+  EXPECT_GE(topology.num_nodes(), 1u);
+  vector<int> affinity;
+  ASSERT_TRUE(CpuTopology::get_process_affinity(&affinity).ok());
+  for (const auto& cpu : topology.cpus()) {
+    EXPECT_NE(affinity.end(),
+              std::find(affinity.begin(), affinity.end(), cpu.id));
+  }
+  EXPECT_TRUE(CpuTopology::set_thread_affinity(
+      topology.cpus_of_node(0)).ok());
+}
+
+}  // namespace vobla
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/event_count.cpp
+ * \brief Implementation of EventCount.
+ */
+
+#if defined(linux) || defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <climits>
+#include <mutex>
+#include "vobla/event_count.h"
+
+namespace vobla {
+
+EventCount::EventCount() : epoch_(0), waiters_(0) {
+}
+
+EventCount::~EventCount() {
+}
+
+#if defined(linux) || defined(__linux__)
+
+void EventCount::wait(Key key) {
+  // Sleeps only if no notification happened since prepare_wait(). Spurious
+  // wakeups are fine: the caller re-checks its condition.
+  while (epoch_.load(std::memory_order_acquire) == key) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_),
+            FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+  }
+  waiters_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void EventCount::wake(bool all) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAKE_PRIVATE,
+          all ? INT_MAX : 1, nullptr, nullptr, 0);
+}
+
+#else
+
+void EventCount::wait(Key key) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (epoch_.load(std::memory_order_acquire) == key) {
+    cond_.wait(lock);
+  }
+  waiters_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void EventCount::wake(bool all) {
+  // Taking the lock orders the epoch change before the waiters' checks.
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (all) {
+    cond_.notify_all();
+  } else {
+    cond_.notify_one();
+  }
+}
+
+#endif
+
+}  // namespace vobla
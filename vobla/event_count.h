@@ -0,0 +1,119 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/event_count.h
+ * \brief A condition variable for lock-free data structures.
+ */
+
+#ifndef VOBLA_EVENT_COUNT_H_
+#define VOBLA_EVENT_COUNT_H_
+
+#include <boost/utility.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace vobla {
+
+/**
+ * \class EventCount vobla/event_count.h
+ * \brief Lets threads wait for a condition on a lock-free data structure.
+ *
+ * A waiter announces itself with prepare_wait(), re-checks the condition,
+ * and then either calls cancel_wait() or wait(). A notifier changes the
+ * condition and calls notify_one() or notify_all(), which cost one fence
+ * and one load if nobody is waiting.
+ *
+ * ~~~~~~~~~{cpp}
+ * // Consumer.
+ * while (!queue.try_pop(&item)) {
+ *   auto key = event_count.prepare_wait();
+ *   if (queue.try_pop(&item)) {
+ *     event_count.cancel_wait();
+ *     break;
+ *   }
+ *   event_count.wait(key);
+ * }
+ * // Producer.
+ * queue.try_push(std::move(item));
+ * event_count.notify_one();
+ * ~~~~~~~~~
+ *
+ * It parks the threads on a futex on Linux, and on a condition variable
+ * elsewhere.
+ */
+class EventCount : boost::noncopyable {
+ public:
+  /// The epoch observed by prepare_wait().
+  typedef uint32_t Key;
+
+  EventCount();
+
+  ~EventCount();
+
+  /// Announces a waiter. Must be followed by cancel_wait() or wait().
+  Key prepare_wait() {
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+
+  /// Withdraws the waiter since the condition became true.
+  void cancel_wait() {
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /// Blocks until notified after prepare_wait() returned `key`.
+  void wait(Key key);
+
+  /// Wakes up one waiter.
+  void notify_one() {
+    notify(false);
+  }
+
+  /// Wakes up all waiters.
+  void notify_all() {
+    notify(true);
+  }
+
+ private:
+  void notify(bool all) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_seq_cst) == 0) {
+      return;
+    }
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    wake(all);
+  }
+
+  void wake(bool all);
+
+  std::atomic<uint32_t> epoch_;
+
+  std::atomic<uint32_t> waiters_;
+
+#if !defined(linux) && !defined(__linux__)
+  std::mutex mutex_;
+
+  std::condition_variable cond_;
+#endif
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_EVENT_COUNT_H_
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "vobla/event_count.h"
+
+using std::vector;
+
+namespace vobla {
+
+TEST(EventCountTest, TestCancelWait) {
+  EventCount event_count;
+  auto key = event_count.prepare_wait();
+  event_count.cancel_wait();
+  // Nobody is waiting.
+  event_count.notify_one();
+  key = event_count.prepare_wait();
+  event_count.notify_all();
+  // The notification after prepare_wait() is not lost.
+  event_count.wait(key);
+}
+
+TEST(EventCountTest, TestWaitForCondition) {
+  const int kNumWaiters = 4;
+  EventCount event_count;
+  std::atomic<int> value(0);
+  vector<std::thread> waiters;
+  for (int i = 0; i < kNumWaiters; i++) {
+    waiters.emplace_back([&event_count, &value, i] {
+        while (value.load() <= i) {
+          auto key = event_count.prepare_wait();
+          if (value.load() > i) {
+            event_count.cancel_wait();
+            break;
+          }
+          event_count.wait(key);
+        }
+      });
+  }
+  for (int i = 1; i <= kNumWaiters; i++) {
+    value = i;
+    event_count.notify_all();
+  }
+  for (auto& waiter : waiters) {
+    waiter.join();
+  }
+  EXPECT_EQ(kNumWaiters, value);
+}
+
+}  // namespace vobla
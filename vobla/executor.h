@@ -0,0 +1,138 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/executor.h
+ * \brief The interface of the objects that run tasks.
+ */
+
+#ifndef VOBLA_EXECUTOR_H_
+#define VOBLA_EXECUTOR_H_
+
+#include <boost/utility.hpp>
+#include <exception>
+#include <functional>
+#include <future>
+#include <type_traits>
+#include <utility>
+#include "vobla/task.h"
+
+namespace vobla {
+
+namespace internal {
+
+/// The result of calling `F` with `Args`. std::result_of is deprecated in
+/// C++17 and removed in C++20, where std::invoke_result replaces it.
+template <typename F, typename... Args>
+struct InvokeResult {
+#if __cplusplus >= 201703L
+  typedef typename std::invoke_result<F, Args...>::type type;
+#else
+  typedef typename std::result_of<F(Args...)>::type type;
+#endif
+};
+
+/// Runs `func` and stores its result or its exception into `promise`.
+template <typename R, typename F>
+void fulfill(std::promise<R>* promise, F* func) {
+  try {
+    promise->set_value((*func)());
+  } catch (...) {
+    promise->set_exception(std::current_exception());
+  }
+}
+
+template <typename F>
+void fulfill(std::promise<void>* promise, F* func) {
+  try {
+    (*func)();
+    promise->set_value();
+  } catch (...) {
+    promise->set_exception(std::current_exception());
+  }
+}
+
+/// A callable that fulfills a promise with the result of another callable.
+template <typename R, typename F>
+struct PromiseTask {
+  PromiseTask(std::promise<R>&& p, F&& f)
+      : promise(std::move(p)), func(std::move(f)) {}
+
+  void operator()() {
+    fulfill(&promise, &func);
+  }
+
+  std::promise<R> promise;
+
+  F func;
+};
+
+}  // namespace internal
+
+/**
+ * \class Executor vobla/executor.h
+ * \brief Runs tasks, e.g., in a thread pool.
+ *
+ * The subclasses implement execute(). The callers use:
+ *
+ *  - post(func) to run a callable without tracking it. It does not
+ *    allocate for small callables, but `func` must not throw.
+ *  - submit(func, args...) to get a std::future of the result (or of the
+ *    exception) of `func(args...)`.
+ */
+class Executor : boost::noncopyable {
+ public:
+  virtual ~Executor() {}
+
+  /// Runs the task at some point, maybe in another thread.
+  virtual void execute(Task task) = 0;
+
+  /// Runs a callable with no result.
+  template <typename F>
+  void post(F&& func) {
+    execute(Task(std::forward<F>(func)));
+  }
+
+  /// Runs a callable and returns the future of its result.
+  template <typename F>
+  std::future<typename internal::InvokeResult<
+                typename std::decay<F>::type>::type>
+  submit(F&& func) {
+    typedef typename std::decay<F>::type Func;
+    typedef typename internal::InvokeResult<Func>::type Result;
+    std::promise<Result> promise;
+    auto future = promise.get_future();
+    execute(Task(internal::PromiseTask<Result, Func>(
+        std::move(promise), Func(std::forward<F>(func)))));
+    return future;
+  }
+
+  /// Runs `func(args...)` and returns the future of its result. The
+  /// arguments are copied or moved, as in std::bind().
+  template <typename F, typename Arg, typename... Args>
+  std::future<typename internal::InvokeResult<
+                typename std::decay<F>::type&,
+                typename std::decay<Arg>::type&,
+                typename std::decay<Args>::type&...>::type>
+  submit(F&& func, Arg&& arg, Args&&... args) {
+    return submit(std::bind(std::forward<F>(func), std::forward<Arg>(arg),
+                            std::forward<Args>(args)...));
+  }
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_EXECUTOR_H_
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/fair_executor.cpp
+ * \brief Implementation of FairExecutor.
+ */
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+#include "vobla/fair_executor.h"
+
+namespace vobla {
+
+const size_t FairExecutor::kMaxBatch;
+
+FairExecutor::Tenant::Tenant(FairExecutor* parent,
+                             const TenantOptions& options)
+    : parent_(parent), options_(options) {
+}
+
+void FairExecutor::Tenant::execute(Task task) {
+  parent_->enqueue(this, &task);
+}
+
+Status FairExecutor::Tenant::try_execute(Task task) {
+  if (!parent_->enqueue(this, &task)) {
+    return Status(-EAGAIN, "The tenant queue is full.");
+  }
+  return Status::OK;
+}
+
+FairExecutor::TenantStats FairExecutor::Tenant::stats() const {
+  TenantStats stats;
+  std::lock_guard<std::mutex> lock(parent_->mutex_);
+  stats.queued = queue_.size();
+  stats.running = running_;
+  stats.completed = completed_;
+  stats.rejected = rejected_;
+  stats.queue_wait = queue_wait_;
+  return stats;
+}
+
+FairExecutor::FairExecutor(Executor* executor, size_t max_in_flight,
+                           Clock* clock)
+    : executor_(executor), max_in_flight_(std::max<size_t>(max_in_flight, 1)),
+      clock_(clock ? clock : Clock::real_clock()) {
+}
+
+FairExecutor::~FairExecutor() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return num_runners_ == 0 && num_queued_ == 0; });
+}
+
+FairExecutor::Tenant* FairExecutor::add_tenant() {
+  return add_tenant(TenantOptions());
+}
+
+FairExecutor::Tenant* FairExecutor::add_tenant(
+    const TenantOptions& options) {
+  TenantOptions checked = options;
+  if (!(checked.weight > 0)) {
+    LOG(WARNING) << "Invalid tenant weight " << checked.weight
+                 << ", using 1.";
+    checked.weight = 1;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  tenants_.emplace_back(new Tenant(this, checked));
+  return tenants_.back().get();
+}
+
+size_t FairExecutor::num_queued() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_queued_;
+}
+
+bool FairExecutor::enqueue(Tenant* tenant, Task* task) {
+  double now = clock_->now();
+  bool spawn = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t capacity = tenant->options_.queue_capacity;
+    if (capacity > 0 && tenant->queue_.size() >= capacity) {
+      tenant->rejected_++;
+      return false;
+    }
+    tenant->queue_.emplace_back();
+    tenant->queue_.back().task = std::move(*task);
+    tenant->queue_.back().enqueued_at = now;
+    num_queued_++;
+    activate_locked(tenant);
+    if (!active_.empty() && num_runners_ < max_in_flight_) {
+      num_runners_++;
+      spawn = true;
+    }
+  }
+  if (spawn) {
+    executor_->post([this] { run(); });
+  }
+  return true;
+}
+
+void FairExecutor::activate_locked(Tenant* tenant) {
+  size_t limit = tenant->options_.max_concurrency;
+  if (!tenant->active_ && !tenant->queue_.empty() &&
+      (limit == 0 || tenant->running_ < limit)) {
+    tenant->active_ = true;
+    active_.push_back(tenant);
+  }
+}
+
+bool FairExecutor::next_locked(double now, Task* task, Tenant** tenant) {
+  while (!active_.empty()) {
+    Tenant* head = active_.front();
+    if (head->deficit_ < 1) {
+      // Its turn is over. It earns its quantum for the next turn.
+      head->deficit_ += head->options_.weight;
+      active_.pop_front();
+      active_.push_back(head);
+      continue;
+    }
+    Tenant::Entry& entry = head->queue_.front();
+    head->queue_wait_.add(now - entry.enqueued_at);
+    *task = std::move(entry.task);
+    head->queue_.pop_front();
+    num_queued_--;
+    head->deficit_ -= 1;
+    head->running_++;
+    size_t limit = head->options_.max_concurrency;
+    if (head->queue_.empty()) {
+      // An idle tenant does not bank credit.
+      head->deficit_ = 0;
+      head->active_ = false;
+      active_.pop_front();
+    } else if (limit > 0 && head->running_ >= limit) {
+      head->active_ = false;
+      active_.pop_front();
+    }
+    *tenant = head;
+    return true;
+  }
+  return false;
+}
+
+void FairExecutor::run() {
+  Tenant* tenant = nullptr;
+  Task task;
+  for (size_t ran = 0; ; ++ran) {
+    double now = clock_->now();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (tenant) {
+        tenant->running_--;
+        tenant->completed_++;
+        activate_locked(tenant);
+        tenant = nullptr;
+      }
+      if (ran == kMaxBatch && !active_.empty()) {
+        break;
+      }
+      if (ran == kMaxBatch || !next_locked(now, &task, &tenant)) {
+        if (--num_runners_ == 0) {
+          idle_.notify_all();
+        }
+        return;
+      }
+    }
+    task();
+    task.reset();
+  }
+  // Yields the worker to the other users of the executor.
+  executor_->post([this] { run(); });
+}
+
+}  // namespace vobla
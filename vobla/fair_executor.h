@@ -0,0 +1,223 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/fair_executor.h
+ * \brief Fair sharing of an executor among tenants.
+ */
+
+#ifndef VOBLA_FAIR_EXECUTOR_H_
+#define VOBLA_FAIR_EXECUTOR_H_
+
+#include <boost/utility.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "vobla/clock.h"
+#include "vobla/executor.h"
+#include "vobla/histogram.h"
+#include "vobla/status.h"
+#include "vobla/task.h"
+
+namespace vobla {
+
+/**
+ * \class FairExecutor vobla/fair_executor.h
+ * \brief Shares an executor (e.g., a ThreadPool) among tenants with
+ * deficit round-robin.
+ *
+ * Each tenant is an Executor with its own queue. The FairExecutor keeps at
+ * most `max_in_flight` runner tasks on the underlying executor, so that a
+ * noisy tenant cannot fill the queue of the pool; the other tasks wait in
+ * the tenants' queues. Each runner takes the tasks by deficit round-robin
+ * over the tenants that have queued tasks: a tenant earns its weight in
+ * tasks each round, so under contention the tenants get throughput in
+ * proportion to their weights, whatever their submission rates are.
+ *
+ * ~~~~~~~~~{cpp}
+ * ThreadPool pool(8);
+ * FairExecutor fair(&pool, pool.num_threads());
+ * FairExecutor::TenantOptions batch_options;
+ * batch_options.max_concurrency = 2;
+ * batch_options.queue_capacity = 10000;
+ * FairExecutor::Tenant* batch = fair.add_tenant(batch_options);
+ * FairExecutor::Tenant* online = fair.add_tenant();
+ * batch->post([] { reindex(); });
+ * online->post([] { serve(); });
+ * ~~~~~~~~~
+ *
+ * A tenant can also cap how many of its tasks run at once, and how many
+ * wait. The scheduling takes amortized O(1) per task: the tenants that
+ * can run a task form a round-robin list, from which only the head is
+ * removed. A runner runs up to kMaxBatch tasks before it re-posts itself,
+ * to give the other users of the executor a turn.
+ *
+ * The tasks must not throw. The tenants live as long as the FairExecutor,
+ * whose destructor waits for all queued tasks.
+ */
+class FairExecutor : boost::noncopyable {
+ public:
+  /// The number of tasks that a runner runs before re-posting itself.
+  static const size_t kMaxBatch = 64;
+
+  /// The options of a tenant.
+  struct TenantOptions {
+    /// The share of the tenant, in tasks per round. It must be positive.
+    double weight = 1;
+
+    /// The maximal number of running tasks. 0 means no limit.
+    size_t max_concurrency = 0;
+
+    /// The maximal number of queued tasks. 0 means unbounded.
+    size_t queue_capacity = 0;
+  };
+
+  /// A snapshot of the counters of a tenant.
+  struct TenantStats {
+    size_t queued = 0;
+
+    size_t running = 0;
+
+    uint64_t completed = 0;
+
+    /// The tasks refused because the queue was full.
+    uint64_t rejected = 0;
+
+    /// The seconds between adding and starting each task.
+    Histogram queue_wait;
+  };
+
+  /// Runs the tasks of one tenant through its FairExecutor.
+  class Tenant : public Executor {
+   public:
+    /// Queues a task. It is dropped (and counted as rejected) if the
+    /// queue is full.
+    virtual void execute(Task task);
+
+    /// Queues a task. Returns -EAGAIN if the queue is full.
+    Status try_execute(Task task);
+
+    /// Queues a callable if the queue is not full.
+    template <typename F>
+    Status try_post(F&& func) {
+      return try_execute(Task(std::forward<F>(func)));
+    }
+
+    const TenantOptions& options() const {
+      return options_;
+    }
+
+    TenantStats stats() const;
+
+   private:
+    friend class FairExecutor;
+
+    struct Entry {
+      Task task;
+
+      double enqueued_at;
+    };
+
+    Tenant(FairExecutor* parent, const TenantOptions& options);
+
+    FairExecutor* parent_;
+
+    const TenantOptions options_;
+
+    /// The fields below are guarded by the parent's mutex.
+    std::deque<Entry> queue_;
+
+    /// The number of tasks it may still take in this round.
+    double deficit_ = 0;
+
+    size_t running_ = 0;
+
+    /// Whether it is in the round-robin list.
+    bool active_ = false;
+
+    uint64_t completed_ = 0;
+
+    uint64_t rejected_ = 0;
+
+    Histogram queue_wait_;
+  };
+
+  /**
+   * \brief Constructs a FairExecutor on `executor`.
+   * \param max_in_flight the number of tasks handed to `executor` at once,
+   * usually its number of threads.
+   * \param clock the clock of the waiting times. Defaults to the real
+   * clock.
+   */
+  FairExecutor(Executor* executor, size_t max_in_flight,
+               Clock* clock = nullptr);
+
+  /// Waits for all queued tasks. It must not be called from them.
+  ~FairExecutor();
+
+  /// Adds a tenant with the default options.
+  Tenant* add_tenant();
+
+  /// Adds a tenant.
+  Tenant* add_tenant(const TenantOptions& options);
+
+  /// Returns the number of queued tasks of all tenants.
+  size_t num_queued() const;
+
+ private:
+  /// Queues a task of a tenant, or returns false if its queue is full.
+  bool enqueue(Tenant* tenant, Task* task);
+
+  /// Takes the next task by deficit round-robin, at time `now`. The caller
+  /// holds mutex_.
+  bool next_locked(double now, Task* task, Tenant** tenant);
+
+  /// Adds a tenant to the round-robin list if it can run a task.
+  void activate_locked(Tenant* tenant);
+
+  /// Runs tasks until none can run, or kMaxBatch have run.
+  void run();
+
+  Executor* executor_;
+
+  const size_t max_in_flight_;
+
+  Clock* clock_;
+
+  mutable std::mutex mutex_;
+
+  std::vector<std::unique_ptr<Tenant>> tenants_;
+
+  /// The tenants with queued tasks that are below their concurrency limit.
+  std::deque<Tenant*> active_;
+
+  size_t num_queued_ = 0;
+
+  /// The number of runner tasks posted to the executor.
+  size_t num_runners_ = 0;
+
+  /// Notified when the last runner exits.
+  std::condition_variable idle_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_FAIR_EXECUTOR_H_
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vobla/clock.h"
+#include "vobla/fair_executor.h"
+#include "vobla/sim_executor.h"
+#include "vobla/thread_pool.h"
+
+using std::string;
+
+namespace vobla {
+
+TEST(FairExecutorTest, TestWeightedShares) {
+  SimExecutor sim(1);
+  FairExecutor fair(&sim, 1);
+  FairExecutor::TenantOptions heavy_options;
+  heavy_options.weight = 2;
+  FairExecutor::Tenant* heavy = fair.add_tenant(heavy_options);
+  FairExecutor::Tenant* light = fair.add_tenant();
+  EXPECT_DOUBLE_EQ(2, heavy->options().weight);
+  string order;
+  // The heavy tenant floods its queue first.
+  for (int i = 0; i < 30; i++) {
+    heavy->post([&order] { order += 'H'; });
+  }
+  for (int i = 0; i < 30; i++) {
+    light->post([&order] { order += 'L'; });
+  }
+  EXPECT_EQ(60u, fair.num_queued());
+  sim.run();
+  EXPECT_EQ(0u, fair.num_queued());
+  ASSERT_EQ(60u, order.size());
+  EXPECT_EQ("HHLHHLHHL", order.substr(0, 9));
+  string first = order.substr(0, 30);
+  EXPECT_EQ(20, std::count(first.begin(), first.end(), 'H'));
+  EXPECT_EQ(30u, heavy->stats().completed);
+  EXPECT_EQ(30u, light->stats().completed);
+}
+
+TEST(FairExecutorTest, TestQueueCapacityAndStats) {
+  FakeClock clock(100);
+  SimExecutor sim(1, &clock);
+  FairExecutor fair(&sim, 1, &clock);
+  FairExecutor::TenantOptions options;
+  options.queue_capacity = 2;
+  FairExecutor::Tenant* tenant = fair.add_tenant(options);
+  int count = 0;
+  EXPECT_TRUE(tenant->try_post([&count] { count++; }).ok());
+  tenant->post([&count] { count++; });
+  EXPECT_EQ(-EAGAIN, tenant->try_post([&count] { count++; }).error());
+  tenant->post([&count] { count++; });
+
+  auto stats = tenant->stats();
+  EXPECT_EQ(2u, stats.queued);
+  EXPECT_EQ(2u, stats.rejected);
+  clock.advance(5);
+  sim.run();
+  EXPECT_EQ(2, count);
+  stats = tenant->stats();
+  EXPECT_EQ(0u, stats.queued);
+  EXPECT_EQ(0u, stats.running);
+  EXPECT_EQ(2u, stats.completed);
+  EXPECT_EQ(2u, stats.queue_wait.count());
+  EXPECT_DOUBLE_EQ(5, stats.queue_wait.max());
+}
+
+TEST(FairExecutorTest, TestConcurrencyLimit) {
+  ThreadPool pool(4);
+  std::atomic<int> running(0);
+  std::atomic<int> max_running(0);
+  std::atomic<int> others(0);
+  {
+    FairExecutor fair(&pool, 4);
+    FairExecutor::TenantOptions options;
+    options.max_concurrency = 2;
+    FairExecutor::Tenant* limited = fair.add_tenant(options);
+    FairExecutor::Tenant* other = fair.add_tenant();
+    for (int i = 0; i < 20; i++) {
+      limited->post([&running, &max_running] {
+          int now = ++running;
+          int max = max_running;
+          while (now > max && !max_running.compare_exchange_weak(max, now)) {
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          running--;
+        });
+      other->post([&others] { others++; });
+    }
+  }
+  // The destructor waited for all tasks.
+  EXPECT_EQ(20, others);
+  EXPECT_EQ(0, running);
+  EXPECT_LE(max_running, 2);
+  EXPECT_GE(max_running, 1);
+}
+
+}  // namespace vobla
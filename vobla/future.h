@@ -0,0 +1,587 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/future.h
+ * \brief Futures and promises with continuations.
+ *
+ * Unlike std::future, a Future can chain a continuation with then(), which
+ * runs when the value is ready instead of blocking a thread in get():
+ *
+ * ~~~~~~~~~{cpp}
+ * Future<Status> done = run_async(&pool, [=] { return read_block(id); })
+ *     .then(&pool, [](Block block) { return decode(block); })
+ *     .then(&pool, [](Record record) { return write_async(record); });
+ * ~~~~~~~~~
+ *
+ * A continuation is posted to the given executor when the value becomes
+ * ready, or runs inline in the thread calling then() when the value is
+ * already ready. Without an executor, it runs in the thread that fulfills
+ * the promise.
+ *
+ * If the continuation returns a Future, the Future returned by then()
+ * becomes ready with that inner Future, so an asynchronous stage does not
+ * hold a worker either. An exception skips the following continuations and
+ * is rethrown by get().
+ */
+
+#ifndef VOBLA_FUTURE_H_
+#define VOBLA_FUTURE_H_
+
+#include <boost/utility.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "vobla/executor.h"
+#include "vobla/task.h"
+
+namespace vobla {
+
+template <typename T>
+class Future;
+
+template <typename T>
+class Promise;
+
+namespace internal {
+
+/// Stands for the value of a Future<void>.
+struct Unit {
+};
+
+/// The state shared by a Promise and its Future.
+template <typename T>
+class FutureState : boost::noncopyable {
+ public:
+  typedef typename std::conditional<std::is_void<T>::value, Unit, T>::type
+      Value;
+
+  FutureState() : ready_(false), executor_(nullptr) {}
+
+  template <typename... Args>
+  void set_value(Args&&... args) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    check_not_ready();
+    value_.reset(new Value(std::forward<Args>(args)...));
+    complete(&lock);
+  }
+
+  void set_exception(std::exception_ptr error) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    check_not_ready();
+    error_ = error;
+    complete(&lock);
+  }
+
+  bool ready() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ready_;
+  }
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!ready_) {
+      cond_.wait(lock);
+    }
+  }
+
+  /// Returns the exception, once ready.
+  std::exception_ptr error() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+  }
+
+  /// Moves the value out, once ready. Rethrows the exception instead.
+  Value take() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return std::move(*value_);
+  }
+
+  /**
+   * \brief Runs `task` when the state is ready.
+   *
+   * If it is already ready, `task` runs now. Otherwise it is posted to
+   * `executor`, or runs in the fulfilling thread if `executor` is null.
+   */
+  void set_continuation(Task task, Executor* executor) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ready_) {
+      lock.unlock();
+      task();
+      return;
+    }
+    continuation_ = std::move(task);
+    executor_ = executor;
+  }
+
+ private:
+  void check_not_ready() {
+    if (ready_) {
+      throw std::future_error(std::future_errc::promise_already_satisfied);
+    }
+  }
+
+  void complete(std::unique_lock<std::mutex>* lock) {
+    ready_ = true;
+    Task continuation = std::move(continuation_);
+    cond_.notify_all();
+    lock->unlock();
+    if (!continuation) {
+      return;
+    }
+    if (executor_) {
+      executor_->execute(std::move(continuation));
+    } else {
+      continuation();
+    }
+  }
+
+  std::mutex mutex_;
+
+  std::condition_variable cond_;
+
+  bool ready_;
+
+  std::unique_ptr<Value> value_;
+
+  std::exception_ptr error_;
+
+  Task continuation_;
+
+  Executor* executor_;
+};
+
+/// Fulfills one state with the value or the exception of another.
+template <typename T>
+struct Forward {
+  void operator()() {
+    std::exception_ptr error = from->error();
+    if (error) {
+      to->set_exception(error);
+    } else {
+      to->set_value(from->take());
+    }
+  }
+
+  std::shared_ptr<FutureState<T>> from;
+
+  std::shared_ptr<FutureState<T>> to;
+};
+
+/// Gives the internals access to the states of futures and promises.
+struct FutureAccess {
+  template <typename T>
+  static std::shared_ptr<FutureState<T>> state(Future<T>* future) {
+    return std::move(future->state_);
+  }
+
+  template <typename T>
+  static Future<T> make(std::shared_ptr<FutureState<T>> state) {
+    return Future<T>(std::move(state));
+  }
+};
+
+/// The value type of the Future returned by then(): a continuation
+/// returning Future<U> makes a Future<U>.
+template <typename T>
+struct Unwrap {
+  typedef T type;
+};
+
+template <typename T>
+struct Unwrap<Future<T>> {
+  typedef T type;
+};
+
+/// The result of calling `F` with the value of a Future<T>.
+template <typename F, typename T>
+struct CallResult {
+  typedef typename InvokeResult<F, T>::type type;
+};
+
+template <typename F>
+struct CallResult<F, void> {
+  typedef typename InvokeResult<F>::type type;
+};
+
+/// Calls `func` with the value of a ready state.
+template <typename T>
+struct Apply {
+  template <typename F>
+  static typename CallResult<F, T>::type call(F* func,
+                                              FutureState<T>* state) {
+    return (*func)(state->take());
+  }
+};
+
+template <>
+struct Apply<void> {
+  template <typename F>
+  static typename CallResult<F, void>::type call(F* func,
+                                                 FutureState<void>*) {
+    return (*func)();
+  }
+};
+
+/// Fulfills a state with the result of `call()`, of type `R`.
+template <typename R>
+struct Fulfill {
+  template <typename Call>
+  static void run(std::shared_ptr<FutureState<R>> state, Call call) {
+    state->set_value(call());
+  }
+};
+
+template <>
+struct Fulfill<void> {
+  template <typename Call>
+  static void run(std::shared_ptr<FutureState<void>> state, Call call) {
+    call();
+    state->set_value();
+  }
+};
+
+template <typename U>
+struct Fulfill<Future<U>> {
+  template <typename Call>
+  static void run(std::shared_ptr<FutureState<U>> state, Call call) {
+    Future<U> inner = call();
+    if (!inner.valid()) {
+      throw std::future_error(std::future_errc::no_state);
+    }
+    auto inner_state = FutureAccess::state(&inner);
+    inner_state->set_continuation(Task(Forward<U>{inner_state, state}),
+                                  nullptr);
+  }
+};
+
+/// The continuation that then() attaches to a state.
+template <typename T, typename F>
+struct Continuation {
+  typedef typename CallResult<F, T>::type Result;
+
+  typedef typename Unwrap<Result>::type Value;
+
+  void operator()() {
+    std::exception_ptr error = in->error();
+    if (error) {
+      out->set_exception(error);
+      return;
+    }
+    try {
+      Fulfill<Result>::run(out, [this] {
+          return Apply<T>::call(&func, in.get());
+        });
+    } catch (...) {
+      out->set_exception(std::current_exception());
+    }
+  }
+
+  std::shared_ptr<FutureState<T>> in;
+
+  std::shared_ptr<FutureState<Value>> out;
+
+  F func;
+};
+
+}  // namespace internal
+
+/**
+ * \class Future vobla/future.h
+ * \brief The value, or the exception, that a Promise provides later.
+ *
+ * A Future is move-only, and get() or then() consumes it.
+ */
+template <typename T>
+class Future {
+ public:
+  /// Constructs an invalid future.
+  Future() {}
+
+  Future(Future&& other) : state_(std::move(other.state_)) {}
+
+  Future& operator=(Future&& other) {
+    state_ = std::move(other.state_);
+    return *this;
+  }
+
+  /// Returns true if it refers to a state, i.e., it is not consumed.
+  bool valid() const {
+    return static_cast<bool>(state_);
+  }
+
+  /// Returns true if the value or the exception is available.
+  bool ready() const {
+    return state_->ready();
+  }
+
+  /// Blocks until ready.
+  void wait() const {
+    state_->wait();
+  }
+
+  /// Blocks until ready, then returns the value or rethrows the exception.
+  /// Calling it from a pool worker parks that worker; prefer then().
+  T get() {
+    std::shared_ptr<State> state = std::move(state_);
+    state->wait();
+    return static_cast<T>(state->take());
+  }
+
+  /// Calls `func(value)` in the thread that makes the value ready.
+  template <typename F>
+  Future<typename internal::Continuation<T, typename std::decay<F>::type>
+         ::Value>
+  then(F&& func) {
+    return then(nullptr, std::forward<F>(func));
+  }
+
+  /// Calls `func(value)` on `executor` once the value is ready, or inline
+  /// if it is ready already.
+  template <typename F>
+  Future<typename internal::Continuation<T, typename std::decay<F>::type>
+         ::Value>
+  then(Executor* executor, F&& func) {
+    typedef typename std::decay<F>::type Func;
+    typedef internal::Continuation<T, Func> Continuation;
+    typedef typename Continuation::Value Value;
+    std::shared_ptr<internal::FutureState<Value>> out(
+        new internal::FutureState<Value>);
+    std::shared_ptr<State> in = std::move(state_);
+    in->set_continuation(
+        Task(Continuation{in, out, Func(std::forward<F>(func))}), executor);
+    return Future<Value>(std::move(out));
+  }
+
+ private:
+  typedef internal::FutureState<T> State;
+
+  template <typename U>
+  friend class Future;
+
+  friend class Promise<T>;
+  friend struct internal::FutureAccess;
+
+  explicit Future(std::shared_ptr<State> state) : state_(std::move(state)) {}
+
+  Future(const Future&) = delete;
+
+  Future& operator=(const Future&) = delete;
+
+  std::shared_ptr<State> state_;
+};
+
+/**
+ * \class Promise vobla/future.h
+ * \brief Provides the value of a Future.
+ *
+ * Destroying a promise before setting it makes the future fail with
+ * std::future_errc::broken_promise.
+ */
+template <typename T>
+class Promise {
+ public:
+  Promise() : state_(new State), retrieved_(false) {}
+
+  Promise(Promise&& other)
+      : state_(std::move(other.state_)), retrieved_(other.retrieved_) {}
+
+  Promise& operator=(Promise&& other) {
+    abandon();
+    state_ = std::move(other.state_);
+    retrieved_ = other.retrieved_;
+    return *this;
+  }
+
+  ~Promise() {
+    abandon();
+  }
+
+  /// Returns the future. It can only be called once.
+  Future<T> get_future() {
+    if (retrieved_) {
+      throw std::future_error(std::future_errc::future_already_retrieved);
+    }
+    retrieved_ = true;
+    return Future<T>(state_);
+  }
+
+  /// Sets the value, which is built from `args` (none for Promise<void>).
+  template <typename... Args>
+  void set_value(Args&&... args) {
+    state_->set_value(std::forward<Args>(args)...);
+  }
+
+  void set_exception(std::exception_ptr error) {
+    state_->set_exception(error);
+  }
+
+ private:
+  typedef internal::FutureState<T> State;
+
+  Promise(const Promise&) = delete;
+
+  Promise& operator=(const Promise&) = delete;
+
+  void abandon() {
+    if (state_ && !state_->ready()) {
+      state_->set_exception(std::make_exception_ptr(
+          std::future_error(std::future_errc::broken_promise)));
+    }
+  }
+
+  std::shared_ptr<State> state_;
+
+  bool retrieved_;
+};
+
+/// Returns a ready future.
+template <typename T>
+Future<typename std::decay<T>::type> make_ready_future(T&& value) {
+  Promise<typename std::decay<T>::type> promise;
+  promise.set_value(std::forward<T>(value));
+  return promise.get_future();
+}
+
+inline Future<void> make_ready_future() {
+  Promise<void> promise;
+  promise.set_value();
+  return promise.get_future();
+}
+
+/// Returns a future holding an exception.
+template <typename T>
+Future<T> make_exceptional_future(std::exception_ptr error) {
+  Promise<T> promise;
+  promise.set_exception(error);
+  return promise.get_future();
+}
+
+/**
+ * \brief Runs `func()` on `executor`, and returns the future of its result.
+ *
+ * Like Executor::submit(), but the result is a Future. If `func` returns a
+ * Future, the result is forwarded from it.
+ */
+template <typename F>
+Future<typename internal::Continuation<void, typename std::decay<F>::type>
+       ::Value>
+run_async(Executor* executor, F&& func) {
+  Promise<void> start;
+  auto future = start.get_future().then(executor, std::forward<F>(func));
+  start.set_value();
+  return future;
+}
+
+namespace internal {
+
+template <typename T>
+struct WhenAll {
+  explicit WhenAll(size_t size) : states(size), remaining(size) {}
+
+  std::vector<std::shared_ptr<FutureState<T>>> states;
+
+  std::atomic<size_t> remaining;
+
+  Promise<std::vector<Future<T>>> promise;
+};
+
+template <typename T>
+struct WhenAny {
+  WhenAny() : done(false) {}
+
+  std::atomic<bool> done;
+
+  Promise<std::pair<size_t, Future<T>>> promise;
+};
+
+}  // namespace internal
+
+/**
+ * \brief Returns a future that becomes ready when all `futures` are.
+ *
+ * The result holds the input futures, all ready, in the same order, so
+ * that each value or exception can be retrieved separately.
+ */
+template <typename T>
+Future<std::vector<Future<T>>> when_all(std::vector<Future<T>> futures) {
+  typedef internal::WhenAll<T> Context;
+  std::shared_ptr<Context> context(new Context(futures.size()));
+  auto result = context->promise.get_future();
+  if (futures.empty()) {
+    context->promise.set_value();
+    return result;
+  }
+  for (size_t i = 0; i < futures.size(); ++i) {
+    context->states[i] = internal::FutureAccess::state(&futures[i]);
+  }
+  for (auto& state : context->states) {
+    state->set_continuation(Task([context] {
+        if (context->remaining.fetch_sub(1) != 1) {
+          return;
+        }
+        std::vector<Future<T>> ready;
+        for (auto& s : context->states) {
+          ready.push_back(internal::FutureAccess::make(std::move(s)));
+        }
+        context->promise.set_value(std::move(ready));
+      }), nullptr);
+  }
+  return result;
+}
+
+/**
+ * \brief Returns a future that becomes ready when any of `futures` is.
+ *
+ * The result holds the index and the first ready future. `futures` must
+ * not be empty.
+ */
+template <typename T>
+Future<std::pair<size_t, Future<T>>> when_any(
+    std::vector<Future<T>> futures) {
+  typedef internal::WhenAny<T> Context;
+  std::shared_ptr<Context> context(new Context);
+  auto result = context->promise.get_future();
+  if (futures.empty()) {
+    context->promise.set_exception(std::make_exception_ptr(
+        std::invalid_argument("when_any() takes at least one future.")));
+    return result;
+  }
+  for (size_t i = 0; i < futures.size(); ++i) {
+    auto state = internal::FutureAccess::state(&futures[i]);
+    state->set_continuation(Task([context, state, i] {
+        if (context->done.exchange(true)) {
+          return;
+        }
+        context->promise.set_value(
+            i, internal::FutureAccess::make(std::move(state)));
+      }), nullptr);
+  }
+  return result;
+}
+
+}  // namespace vobla
+
+#endif  // VOBLA_FUTURE_H_
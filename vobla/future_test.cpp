@@ -0,0 +1,163 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "vobla/future.h"
+#include "vobla/thread_pool.h"
+
+using std::string;
+using std::vector;
+
+namespace vobla {
+
+TEST(FutureTest, TestPromise) {
+  Promise<int> promise;
+  Future<int> future = promise.get_future();
+  EXPECT_TRUE(future.valid());
+  EXPECT_FALSE(future.ready());
+  EXPECT_THROW(promise.get_future(), std::future_error);
+  promise.set_value(5);
+  EXPECT_TRUE(future.ready());
+  EXPECT_THROW(promise.set_value(6), std::future_error);
+  EXPECT_EQ(5, future.get());
+  EXPECT_FALSE(future.valid());
+}
+
+TEST(FutureTest, TestBrokenPromise) {
+  Future<void> future;
+  {
+    Promise<void> promise;
+    future = promise.get_future();
+  }
+  EXPECT_THROW(future.get(), std::future_error);
+}
+
+TEST(FutureTest, TestThenRunsInlineWhenReady) {
+  auto caller = std::this_thread::get_id();
+  std::thread::id ran_in;
+  ThreadPool pool(1);
+  auto future = make_ready_future(string("abc")).then(
+      &pool, [&ran_in](string s) {
+        ran_in = std::this_thread::get_id();
+        return s.size();
+      });
+  EXPECT_TRUE(future.ready());
+  EXPECT_EQ(caller, ran_in);
+  EXPECT_EQ(3u, future.get());
+}
+
+TEST(FutureTest, TestThenRunsOnTheExecutor) {
+  ThreadPool pool(1);
+  Promise<int> promise;
+  std::thread::id ran_in;
+  auto future = promise.get_future().then(&pool, [&ran_in](int x) {
+      ran_in = std::this_thread::get_id();
+      return x * 2;
+    });
+  promise.set_value(21);
+  EXPECT_EQ(42, future.get());
+  EXPECT_NE(std::this_thread::get_id(), ran_in);
+}
+
+TEST(FutureTest, TestChains) {
+  ThreadPool pool(2);
+  auto future = run_async(&pool, [] { return 1; })
+      .then(&pool, [](int x) { return x + 1; })
+      .then(&pool, [](int x) { return std::to_string(x); })
+      .then([](string s) { return s + "!"; });
+  EXPECT_EQ("2!", future.get());
+
+  std::unique_ptr<int> ptr(new int(7));
+  auto moved = make_ready_future(std::move(ptr)).then(
+      [](std::unique_ptr<int> p) { return *p; });
+  EXPECT_EQ(7, moved.get());
+}
+
+TEST(FutureTest, TestContinuationsReturningFutures) {
+  ThreadPool pool(2);
+  Promise<int> inner;
+  auto inner_future = std::make_shared<Future<int>>(inner.get_future());
+  auto future = run_async(&pool, [] {})
+      .then(&pool, [inner_future] { return std::move(*inner_future); })
+      .then([](int x) { return x + 1; });
+  EXPECT_FALSE(future.ready());
+  inner.set_value(9);
+  EXPECT_EQ(10, future.get());
+}
+
+TEST(FutureTest, TestExceptionsSkipContinuations) {
+  ThreadPool pool(2);
+  bool ran = false;
+  auto future = run_async(&pool, []() -> int {
+      throw std::runtime_error("failed");
+    }).then(&pool, [&ran](int x) {
+      ran = true;
+      return x;
+    });
+  EXPECT_THROW(future.get(), std::runtime_error);
+  EXPECT_FALSE(ran);
+}
+
+TEST(FutureTest, TestWhenAll) {
+  ThreadPool pool(4);
+  vector<Future<int>> futures;
+  for (int i = 0; i < 10; i++) {
+    futures.push_back(run_async(&pool, [i] {
+        if (i == 3) {
+          throw std::runtime_error("three");
+        }
+        return i * i;
+      }));
+  }
+  auto all = when_all(std::move(futures)).get();
+  ASSERT_EQ(10u, all.size());
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(all[i].ready());
+    if (i == 3) {
+      EXPECT_THROW(all[i].get(), std::runtime_error);
+    } else {
+      EXPECT_EQ(i * i, all[i].get());
+    }
+  }
+  EXPECT_TRUE(when_all(vector<Future<int>>()).get().empty());
+}
+
+TEST(FutureTest, TestWhenAny) {
+  vector<Promise<string>> promises(3);
+  vector<Future<string>> futures;
+  for (auto& promise : promises) {
+    futures.push_back(promise.get_future());
+  }
+  auto any = when_any(std::move(futures));
+  EXPECT_FALSE(any.ready());
+  promises[1].set_value("one");
+  promises[2].set_value("two");
+  auto first = any.get();
+  EXPECT_EQ(1u, first.first);
+  EXPECT_EQ("one", first.second.get());
+  promises[0].set_value("zero");
+
+  EXPECT_THROW(when_any(vector<Future<string>>()).get(),
+               std::invalid_argument);
+}
+
+}  // namespace vobla
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/histogram.cpp
+ * \brief Implementation of Histogram.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "vobla/histogram.h"
+
+namespace vobla {
+
+const size_t Histogram::kSubBuckets;
+const size_t Histogram::kNumPowers;
+const size_t Histogram::kNumBuckets;
+constexpr double Histogram::kMinValue;
+
+Histogram::Histogram() : buckets_(kNumBuckets) {
+}
+
+Histogram::~Histogram() {
+}
+
+// static
+size_t Histogram::bucket_of(double value) {
+  if (!(value >= kMinValue)) {
+    return 0;
+  }
+  int exponent;
+  // value / kMinValue = fraction * 2^exponent, with fraction in [0.5, 1).
+  double fraction = std::frexp(value / kMinValue, &exponent);
+  size_t power = exponent - 1;
+  if (power >= kNumPowers) {
+    return kNumBuckets - 1;
+  }
+  size_t sub = static_cast<size_t>((fraction * 2 - 1) * kSubBuckets);
+  return 1 + power * kSubBuckets + std::min(sub, kSubBuckets - 1);
+}
+
+// static
+double Histogram::bucket_upper_bound(size_t bucket) {
+  if (bucket == 0) {
+    return kMinValue;
+  }
+  size_t power = (bucket - 1) / kSubBuckets;
+  size_t sub = (bucket - 1) % kSubBuckets;
+  return std::ldexp(kMinValue, power) *
+      (1 + static_cast<double>(sub + 1) / kSubBuckets);
+}
+
+void Histogram::add(double value) {
+  buckets_[bucket_of(value)]++;
+  count_++;
+  sum_ += value;
+  max_ = std::max(max_, value);
+}
+
+void Histogram::merge(const Histogram& other) {
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  max_ = std::max(max_, other.max_);
+}
+
+void Histogram::clear() {
+  std::fill(buckets_.begin(), buckets_.end(), 0);
+  count_ = 0;
+  sum_ = 0;
+  max_ = 0;
+}
+
+double Histogram::percentile(double p) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  double rank = std::max(1.0, std::ceil(p / 100 * count_));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::min(bucket_upper_bound(i), max_);
+    }
+  }
+  return max_;
+}
+
+}  // namespace vobla
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/histogram.h
+ * \brief A log-linear histogram of durations.
+ */
+
+#ifndef VOBLA_HISTOGRAM_H_
+#define VOBLA_HISTOGRAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vobla {
+
+/**
+ * \class Histogram vobla/histogram.h
+ * \brief Counts durations (in seconds) in log-linear buckets.
+ *
+ * Each power of two above kMinValue (1 us) is split into kSubBuckets
+ * buckets, so the percentiles have a relative error below 1 / kSubBuckets,
+ * from 1 us up to about 12 days.
+ *
+ * It is not thread-safe. The concurrent writers keep their own histograms
+ * and merge() them on demand.
+ */
+class Histogram {
+ public:
+  static const size_t kSubBuckets = 8;
+
+  static const size_t kNumPowers = 40;
+
+  static const size_t kNumBuckets = 1 + kNumPowers * kSubBuckets;
+
+  /// The upper bound of the first bucket.
+  static constexpr double kMinValue = 1e-6;
+
+  Histogram();
+
+  ~Histogram();
+
+  /// Adds a value.
+  void add(double value);
+
+  /// Adds all values of another histogram.
+  void merge(const Histogram& other);
+
+  /// Removes all values.
+  void clear();
+
+  /// Returns the number of values.
+  uint64_t count() const {
+    return count_;
+  }
+
+  /// Returns the sum of the values.
+  double sum() const {
+    return sum_;
+  }
+
+  /// Returns the mean of the values, or 0 if it is empty.
+  double mean() const {
+    return count_ ? sum_ / count_ : 0;
+  }
+
+  /// Returns the largest value.
+  double max() const {
+    return max_;
+  }
+
+  /**
+   * \brief Returns the `p`-th percentile, e.g., `percentile(99)`.
+   *
+   * It is the upper bound of the bucket holding the percentile, capped by
+   * max().
+   */
+  double percentile(double p) const;
+
+  /// Returns the bucket index of a value.
+  static size_t bucket_of(double value);
+
+  /// Returns the upper bound of a bucket.
+  static double bucket_upper_bound(size_t bucket);
+
+ private:
+  std::vector<uint64_t> buckets_;
+
+  uint64_t count_ = 0;
+
+  double sum_ = 0;
+
+  double max_ = 0;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_HISTOGRAM_H_
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include "vobla/histogram.h"
+
+namespace vobla {
+
+TEST(HistogramTest, TestBuckets) {
+  EXPECT_EQ(0u, Histogram::bucket_of(0));
+  EXPECT_EQ(0u, Histogram::bucket_of(-1));
+  EXPECT_EQ(0u, Histogram::bucket_of(0.5e-6));
+  EXPECT_EQ(1u, Histogram::bucket_of(1e-6));
+  EXPECT_EQ(1u + Histogram::kSubBuckets, Histogram::bucket_of(2e-6));
+  EXPECT_EQ(Histogram::kNumBuckets - 1, Histogram::bucket_of(1e10));
+  for (double value : {1e-6, 3.3e-5, 0.001, 0.25, 1.0, 42.0}) {
+    size_t bucket = Histogram::bucket_of(value);
+    EXPECT_LT(value, Histogram::bucket_upper_bound(bucket));
+    EXPECT_GE(value, Histogram::bucket_upper_bound(bucket - 1));
+  }
+}
+
+TEST(HistogramTest, TestPercentiles) {
+  Histogram hist;
+  EXPECT_EQ(0, hist.percentile(50));
+  for (int i = 1; i <= 100; i++) {
+    hist.add(i * 0.001);
+  }
+  EXPECT_EQ(100u, hist.count());
+  EXPECT_NEAR(0.0505, hist.mean(), 1e-9);
+  EXPECT_DOUBLE_EQ(0.1, hist.max());
+  EXPECT_NEAR(0.050, hist.percentile(50), 0.050 / Histogram::kSubBuckets);
+  EXPECT_NEAR(0.099, hist.percentile(99), 0.099 / Histogram::kSubBuckets);
+  EXPECT_DOUBLE_EQ(0.1, hist.percentile(100));
+}
+
+TEST(HistogramTest, TestMerge) {
+  Histogram a;
+  Histogram b;
+  a.add(0.001);
+  b.add(0.002);
+  b.add(1);
+  a.merge(b);
+  EXPECT_EQ(3u, a.count());
+  EXPECT_DOUBLE_EQ(1, a.max());
+  a.clear();
+  EXPECT_EQ(0u, a.count());
+  EXPECT_EQ(0, a.sum());
+}
+
+}  // namespace vobla
@@ -18,24 +18,155 @@
 #define VOBLA_LRU_CACHE_H_
 
 #include <boost/utility.hpp>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <list>
 #include <unordered_map>
-#include "vobla/stl_util.h"
+#include <utility>
 
 namespace vobla {
 
+template <typename Item, typename Key, const int Capacity, typename LRUList,
+          typename Ctn>
+class LRUCache;
+
+template <typename Item>
+class LRUCacheHandle;
+
 /**
  * \class LRUCacheItem
  * \brief a basic template class for lru cache items.
+ *
+ * Each item carries an intrusive, atomic pin count, which is used by
+ * LRUCacheHandle. Pinning an item does not allocate memory.
  */
 template <typename Key>
 class LRUCacheItem {
  public:
   typedef Key cache_key_type;
+
+  LRUCacheItem() : pins_(0) {}
+
+  /// The pin count is not copied.
+  LRUCacheItem(const LRUCacheItem&) : pins_(0) {}
+
+  LRUCacheItem& operator=(const LRUCacheItem&) {
+    return *this;
+  }
+
   virtual ~LRUCacheItem() {}
+
   virtual cache_key_type cache_key() const = 0;
+
+  /// Returns true if any LRUCacheHandle refers to this item.
+  bool pinned() const {
+    return (pins_.load(std::memory_order_acquire) & ~kDetached) != 0;
+  }
+
+ private:
+  template <typename I, typename K, const int C, typename L, typename T>
+  friend class LRUCache;
+
+  template <typename I>
+  friend class LRUCacheHandle;
+
+  /// Set when the item has been removed from the cache while being pinned.
+  static const uint32_t kDetached = 1u << 31;
+
+  void pin() const {
+    pins_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /// Returns true if the caller dropped the last pin of a detached item.
+  bool unpin() const {
+    return pins_.fetch_sub(1, std::memory_order_acq_rel) == (kDetached | 1);
+  }
+
+  /// Returns true if the item is not pinned and can be deleted right away.
+  bool detach() const {
+    return (pins_.fetch_or(kDetached, std::memory_order_acq_rel) &
+            ~kDetached) == 0;
+  }
+
+  mutable std::atomic<uint32_t> pins_;
+};
+
+/**
+ * \class LRUCacheHandle vobla/lru_cache.h
+ * \brief A reference-counted handle that pins an item of a LRUCache.
+ *
+ * A pinned item is never chosen by LRUCache::victim(). If the item is
+ * removed from the cache while being pinned, it is deleted when the last
+ * handle is dropped. Copying and dropping handles are lock-free, so the
+ * item can be used without holding the lock that guards the cache.
+ */
+template <typename Item>
+class LRUCacheHandle {
+ public:
+  typedef Item value_type;
+  typedef Item* pointer_type;
+
+  /// Constructs an empty handle.
+  LRUCacheHandle() : item_(nullptr) {}
+
+  LRUCacheHandle(const LRUCacheHandle& rhs) : item_(rhs.item_) {
+    if (item_) {
+      item_->pin();
+    }
+  }
+
+  LRUCacheHandle(LRUCacheHandle&& rhs) : item_(rhs.item_) {
+    rhs.item_ = nullptr;
+  }
+
+  ~LRUCacheHandle() {
+    reset();
+  }
+
+  LRUCacheHandle& operator=(LRUCacheHandle rhs) {
+    std::swap(item_, rhs.item_);
+    return *this;
+  }
+
+  /// Unpins the item and makes this handle empty.
+  void reset() {
+    if (item_ && item_->unpin()) {
+      delete item_;
+    }
+    item_ = nullptr;
+  }
+
+  pointer_type get() const {
+    return item_;
+  }
+
+  value_type& operator*() const {
+    return *item_;
+  }
+
+  pointer_type operator->() const {
+    return item_;
+  }
+
+  explicit operator bool() const {
+    return item_ != nullptr;
+  }
+
+ private:
+  template <typename I, typename K, const int C, typename L, typename T>
+  friend class LRUCache;
+
+  /// Only LRUCache can pin an item, while holding its lock.
+  explicit LRUCacheHandle(pointer_type item) : item_(item) {
+    if (item_) {
+      item_->pin();
+    }
+  }
+
+  pointer_type item_;
 };
 
 /**
@@ -43,6 +174,10 @@ class LRUCacheItem {
  * \brief A generic Least-Recent-Used(LRU) cache template.
  * \tparam Item the type of the entity stored in this LRUCache.
  * \tparam Key the type of the key that is used to locat LRUCacheItem.
+ *
+ * LRUCache is not thread-safe. When it is shared by threads, use pin() to
+ * obtain a LRUCacheHandle under the lock, and access the item through the
+ * handle after releasing the lock.
  */
 template <typename Item, typename Key = typename Item::cache_key_type,
   const int Capacity = 1024, typename LRUList = typename std::list<Item*>,
@@ -52,6 +187,7 @@ class LRUCache : boost::noncopyable {
   typedef Item value_type;
   typedef Item* pointer_type;
   typedef Key key_type;
+  typedef LRUCacheHandle<Item> handle_type;
 
   explicit LRUCache(int cap = Capacity) : capacity_(cap) {
   }
@@ -103,6 +239,49 @@ class LRUCache : boost::noncopyable {
     this->insert(item->cache_key(), item);
   }
 
+  /**
+   * \brief Inserts a new item as the least recently used one.
+   *
+   * It is used to restore a cache from the hottest item to the coldest one.
+   */
+  void insert_least_recent(const Key &key, pointer_type item) {
+    assert(!full());
+    assert(cache_.find(key) == cache_.end());
+    lru_.push_front(item);
+    cache_.insert(typename container_type::value_type(key, lru_.begin()));
+  }
+
+  /**
+   * \brief Calls `func(item)` on each item, from the most recently used one
+   * to the least recently used one.
+   */
+  template <typename Function>
+  void for_each(Function func) const {
+    for (auto it = lru_.rbegin(); it != lru_.rend(); ++it) {
+      func(*it);
+    }
+  }
+
+  /// Returns the most recently used item, or nullptr if it is empty.
+  pointer_type most_recent() const {
+    return lru_.empty() ? nullptr : lru_.back();
+  }
+
+  /**
+   * \brief Returns the item used right before the item of `key`, or nullptr
+   * if it is the least recently used item or the key does not exist.
+   *
+   * Time complexity: O(1)
+   */
+  pointer_type older(const Key& key) const {
+    auto it = cache_.find(key);
+    if (it == cache_.end() || it->second == lru_.begin()) {
+      return nullptr;
+    }
+    auto pos = it->second;
+    return *--pos;
+  }
+
   /**
    * \brief Finds an item's pointer with key
    *
@@ -117,23 +296,94 @@ class LRUCache : boost::noncopyable {
     return ret;
   }
 
+  /**
+   * \brief Finds an item and pins it.
+   * \return A handle to the item, or an empty handle if the key does not
+   * exist.
+   *
+   * The item stays valid as long as the handle lives, even if it is removed
+   * from the cache in the meantime.
+   *
+   * Time complexity: O(1)
+   */
+  handle_type pin(const Key& key) const {
+    return handle_type(find(key));
+  }
+
   /**
    * \brief Finds the victim item and remove it from this LRU cache.
-   * \return The pointer to the victim item.
+   * \return The pointer to the victim item, or nullptr if all items are
+   * pinned.
+   *
+   * Pinned items are skipped and moved to the most recently used end, since
+   * they are being used.
    *
    * \note After calling victim(), this LRU cache does not hold the ownership
    * of the victim item anymore.
    */
   pointer_type victim() {
-    if (lru_.empty()) {
+    for (size_t i = lru_.size(); i > 0; --i) {
+      pointer_type ret = lru_.front();
+      if (!ret->pinned()) {
+        lru_.pop_front();
+        cache_.erase(ret->cache_key());
+        return ret;
+      }
+      lru_.splice(lru_.end(), lru_, lru_.begin());
+    }
+    return nullptr;
+  }
+
+  /**
+   * \brief Deletes the least recently used item that is not pinned.
+   * \return false if there is no such item.
+   */
+  bool evict() {
+    pointer_type item = victim();
+    delete item;
+    return item != nullptr;
+  }
+
+  /**
+   * \brief Removes the item with the given key from this LRU cache.
+   * \return The pointer to the removed item, or nullptr if the key does not
+   * exist.
+   *
+   * \note Same as victim(), the caller takes the ownership of the item. The
+   * item must not be pinned; use remove() instead for pinned items.
+   */
+  pointer_type erase(const Key& key) {
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
       return nullptr;
     }
-    pointer_type ret = lru_.front();
-    lru_.pop_front();
-    cache_.erase(ret->cache_key());
+    pointer_type ret = *(it->second);
+    assert(!ret->pinned());
+    lru_.erase(it->second);
+    cache_.erase(it);
     return ret;
   }
 
+  /**
+   * \brief Removes and deletes the item with the given key.
+   *
+   * If the item is pinned, it is deleted when its last handle is dropped.
+   * \return false if the key does not exist.
+   */
+  bool remove(const Key& key) {
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
+      return false;
+    }
+    pointer_type item = *(it->second);
+    lru_.erase(it->second);
+    cache_.erase(it);
+    if (item->detach()) {
+      delete item;
+    }
+    return true;
+  }
+
   /// Uses a item with the given key, and move it to the head
   void use(const Key &key) {
     auto it = cache_.find(key);
@@ -145,9 +395,13 @@ class LRUCache : boost::noncopyable {
     cache_[value->cache_key()] = --lru_.end();
   }
 
-  /// Clears all items.
+  /// Clears all items. The pinned items are deleted when being unpinned.
   void clear() {
-    delete_pointers(lru_);
+    for (auto item : lru_) {
+      if (item->detach()) {
+        delete item;
+      }
+    }
     lru_.clear();
     cache_.clear();
   }
@@ -17,10 +17,14 @@
 #include <gtest/gtest.h>
 #include <time.h>
 #include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include "vobla/lru_cache.h"
 
 using std::string;
@@ -40,6 +44,23 @@ class CacheItem : public LRUCacheItem<int> {
 
 typedef LRUCache<CacheItem, CacheItem::cache_key_type, 32> lru_type;
 
+/// Counts the number of live items.
+class CountedItem : public CacheItem {
+ public:
+  CountedItem(int key, int value, std::atomic<int>* counter)
+      : CacheItem(key, value), count(counter) {
+    (*count)++;
+  }
+
+  ~CountedItem() {
+    (*count)--;
+  }
+
+  std::atomic<int>* count;
+};
+
+typedef LRUCache<CountedItem, int, 32> counted_lru_type;
+
 TEST(LRUCacheTest, TestInert) {
   lru_type lru;
   CacheItem i0(1, 1);
@@ -101,4 +122,148 @@ TEST(LRUCacheTest, TestLeastRecentItems) {
   EXPECT_TRUE(lru.empty());
 }
 
+TEST(LRUCacheTest, TestErase) {
+  lru_type lru;
+  for (int i = 0; i < 10; i++) {
+    lru.insert(i, new CacheItem(i, i));
+  }
+  unique_ptr<CacheItem> item(lru.erase(5));
+  ASSERT_TRUE(item != nullptr);
+  EXPECT_EQ(5, item->k);
+  EXPECT_EQ(nullptr, lru.erase(5));
+  EXPECT_EQ(nullptr, lru.find(5));
+  EXPECT_EQ(size_t(9), lru.size());
+  lru.clear();
+}
+
+TEST(LRUCacheTest, TestPinnedItemsAreNotVictims) {
+  std::atomic<int> live(0);
+  counted_lru_type lru;
+  for (int i = 0; i < 4; i++) {
+    lru.insert(i, new CountedItem(i, i, &live));
+  }
+  auto handle = lru.pin(0);
+  ASSERT_TRUE(static_cast<bool>(handle));
+  EXPECT_TRUE(handle->pinned());
+  EXPECT_FALSE(lru.pin(100));
+
+  // Item 0 is the least recently used one, but it is pinned.
+  unique_ptr<CountedItem> item(lru.victim());
+  EXPECT_EQ(1, item->k);
+  item.reset();
+  EXPECT_TRUE(lru.evict());
+  EXPECT_TRUE(lru.evict());
+  // Only the pinned item is left.
+  EXPECT_FALSE(lru.evict());
+  EXPECT_EQ(nullptr, lru.victim());
+  EXPECT_EQ(1u, lru.size());
+
+  handle.reset();
+  EXPECT_FALSE(lru.find(0)->pinned());
+  EXPECT_TRUE(lru.evict());
+  EXPECT_EQ(0, live);
+}
+
+TEST(LRUCacheTest, TestRemovePinnedItem) {
+  std::atomic<int> live(0);
+  counted_lru_type lru;
+  lru.insert(1, new CountedItem(1, 10, &live));
+  lru.insert(2, new CountedItem(2, 20, &live));
+
+  auto handle = lru.pin(1);
+  auto copy = handle;
+  EXPECT_TRUE(lru.remove(1));
+  EXPECT_FALSE(lru.remove(1));
+  EXPECT_EQ(nullptr, lru.find(1));
+  // The removed item is still alive while being pinned.
+  EXPECT_EQ(2, live);
+  EXPECT_EQ(10, copy->v);
+
+  handle.reset();
+  EXPECT_EQ(2, live);
+  copy.reset();
+  EXPECT_EQ(1, live);
+
+  handle = lru.pin(2);
+  lru.clear();
+  EXPECT_EQ(1, live);
+  EXPECT_EQ(20, handle->v);
+  handle = counted_lru_type::handle_type();
+  EXPECT_EQ(0, live);
+}
+
+TEST(LRUCacheTest, TestUsePinnedItemsWithoutLock) {
+  std::atomic<int> live(0);
+  counted_lru_type lru(16);
+  std::mutex mutex;
+  for (int i = 0; i < 16; i++) {
+    lru.insert(i, new CountedItem(i, i, &live));
+  }
+
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&lru, &mutex] {
+        for (int i = 0; i < 10000; i++) {
+          counted_lru_type::handle_type handle;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            handle = lru.pin(i % 32);
+          }
+          if (handle) {
+            // Accessed outside of the lock.
+            EXPECT_EQ(handle->k, handle->v);
+          }
+        }
+      });
+  }
+  for (int i = 0; i < 10000; i++) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int key = (i * 7) % 32;
+    if (!lru.remove(key)) {
+      if (lru.full() && !lru.evict()) {
+        continue;
+      }
+      lru.insert(key, new CountedItem(key, key, &live));
+    }
+  }
+  for (auto& thd : readers) {
+    thd.join();
+  }
+  lru.clear();
+  EXPECT_EQ(0, live);
+}
+
+TEST(LRUCacheTest, TestInsertLeastRecentAndForEach) {
+  lru_type lru;
+  for (int i = 0; i < 4; i++) {
+    lru.insert_least_recent(i, new CacheItem(i, i));
+  }
+  lru.insert(10, new CacheItem(10, 10));
+  std::vector<int> keys;
+  lru.for_each([&keys](const CacheItem* item) {
+      keys.push_back(item->k);
+    });
+  EXPECT_EQ((std::vector<int>{10, 0, 1, 2, 3}), keys);
+  unique_ptr<CacheItem> item(lru.victim());
+  EXPECT_EQ(3, item->k);
+  lru.clear();
+}
+
+TEST(LRUCacheTest, TestWalkFromMostRecent) {
+  lru_type lru;
+  EXPECT_EQ(nullptr, lru.most_recent());
+  for (int i = 0; i < 4; i++) {
+    lru.insert(i, new CacheItem(i, i));
+  }
+  lru.use(1);
+  std::vector<int> keys;
+  for (CacheItem* item = lru.most_recent(); item;
+       item = lru.older(item->k)) {
+    keys.push_back(item->k);
+  }
+  EXPECT_EQ((std::vector<int>{1, 3, 2, 0}), keys);
+  EXPECT_EQ(nullptr, lru.older(100));
+  lru.clear();
+}
+
 }  // namespace vobla
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/miss_ratio_curve.cpp
+ * \brief Implementation of the SHARDS-based miss ratio curve.
+ */
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "vobla/miss_ratio_curve.h"
+
+using std::pair;
+using std::vector;
+
+namespace vobla {
+
+namespace {
+
+/// The modulus of the sampling hash values (P in the SHARDS paper).
+const uint64_t kModulus = 1 << 24;
+
+/// The number of histogram buckets per power of two.
+const int kSubBucketBits = 4;
+const uint64_t kSubBuckets = 1 << kSubBucketBits;
+
+const size_t kMinTreeSize = 1024;
+
+/// SplitMix64, to spread the bits of the keys. The additive constant keeps
+/// small keys such as 0 from hashing to 0, which is always sampled.
+inline uint64_t mix(uint64_t key) {
+  key += 0x9E3779B97F4A7C15ULL;
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return key;
+}
+
+}  // namespace
+
+MissRatioCurve::MissRatioCurve(double sampling_rate, size_t max_samples)
+    : max_samples_(max_samples), tree_(kMinTreeSize + 1, 0) {
+  sampling_rate = std::min(1.0, std::max(sampling_rate, 1.0 / kModulus));
+  threshold_ = static_cast<uint64_t>(sampling_rate * kModulus);
+}
+
+MissRatioCurve::~MissRatioCurve() {
+}
+
+// static
+uint64_t MissRatioCurve::hash_key(const char* key, size_t length) {
+  // FNV-1a.
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<unsigned char>(key[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+double MissRatioCurve::sampling_rate() const {
+  return static_cast<double>(threshold_) / kModulus;
+}
+
+void MissRatioCurve::access(uint64_t key) {
+  num_accesses_++;
+  uint64_t hash_value = mix(key) & (kModulus - 1);
+  if (hash_value >= threshold_) {
+    return;
+  }
+  num_sampled_++;
+  // Each sampled access stands for 1 / sampling_rate accesses.
+  double weight = static_cast<double>(kModulus) / threshold_;
+  total_weight_ += weight;
+
+  if (now_ + 1 >= tree_.size()) {
+    compact();
+  }
+  auto it = last_access_.find(key);
+  if (it == last_access_.end()) {
+    cold_weight_ += weight;
+    last_access_[key] = now_;
+    if (max_samples_) {
+      samples_.insert(std::make_pair(hash_value, key));
+    }
+  } else {
+    uint64_t distance = last_access_.size() - tree_prefix_sum(it->second);
+    record(bucket_of(static_cast<uint64_t>(distance * weight)), weight);
+    tree_add(it->second, -1);
+    it->second = now_;
+  }
+  tree_add(now_, 1);
+  now_++;
+
+  if (max_samples_ && last_access_.size() > max_samples_) {
+    shrink_samples();
+  }
+}
+
+double MissRatioCurve::miss_ratio(uint64_t cache_size) const {
+  if (num_accesses_ == 0) {
+    return 0;
+  }
+  double misses = cold_weight_;
+  for (size_t bucket = 0; bucket < histogram_.size(); ++bucket) {
+    uint64_t lower = bucket_lower_bound(bucket);
+    uint64_t upper = bucket_lower_bound(bucket + 1);
+    if (lower >= cache_size) {
+      misses += histogram_[bucket];
+    } else if (upper > cache_size) {
+      misses += histogram_[bucket] * (upper - cache_size) / (upper - lower);
+    }
+  }
+  // SHARDS_adj: the difference between the expected and the actual number
+  // of sampled accesses is accounted as hits, i.e., the denominator is the
+  // real number of accesses.
+  return std::min(1.0, misses / num_accesses_);
+}
+
+vector<pair<uint64_t, double>> MissRatioCurve::curve() const {
+  vector<pair<uint64_t, double>> points;
+  size_t last = histogram_.size();
+  while (last > 0 && histogram_[last - 1] == 0) {
+    --last;
+  }
+  for (size_t bucket = 0; bucket < last; ++bucket) {
+    if (bucket > 0 && histogram_[bucket - 1] == 0 && histogram_[bucket] == 0) {
+      continue;
+    }
+    uint64_t size = bucket_lower_bound(bucket);
+    points.push_back(std::make_pair(size, miss_ratio(size)));
+  }
+  uint64_t size = bucket_lower_bound(last);
+  points.push_back(std::make_pair(size, miss_ratio(size)));
+  return points;
+}
+
+// static
+size_t MissRatioCurve::bucket_of(uint64_t distance) {
+  if (distance < kSubBuckets) {
+    return distance;
+  }
+  int exponent = 63 - __builtin_clzll(distance);
+  uint64_t sub = (distance >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+  return (exponent - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+// static
+uint64_t MissRatioCurve::bucket_lower_bound(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  int exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+  uint64_t sub = bucket % kSubBuckets;
+  return (kSubBuckets + sub) << (exponent - kSubBucketBits);
+}
+
+void MissRatioCurve::record(size_t bucket, double weight) {
+  if (bucket >= histogram_.size()) {
+    histogram_.resize(bucket + 1, 0);
+  }
+  histogram_[bucket] += weight;
+}
+
+void MissRatioCurve::tree_add(uint64_t time, int delta) {
+  for (uint64_t i = time + 1; i < tree_.size(); i += i & (~i + 1)) {
+    tree_[i] += delta;
+  }
+}
+
+uint64_t MissRatioCurve::tree_prefix_sum(uint64_t time) const {
+  uint64_t sum = 0;
+  for (uint64_t i = time + 1; i > 0; i -= i & (~i + 1)) {
+    sum += tree_[i];
+  }
+  return sum;
+}
+
+void MissRatioCurve::compact() {
+  vector<pair<uint64_t, uint64_t>> times;
+  times.reserve(last_access_.size());
+  for (const auto& key_and_time : last_access_) {
+    times.push_back(std::make_pair(key_and_time.second, key_and_time.first));
+  }
+  std::sort(times.begin(), times.end());
+
+  size_t size = std::max(kMinTreeSize, 2 * times.size());
+  tree_.assign(size + 1, 0);
+  for (uint64_t i = 0; i < times.size(); ++i) {
+    last_access_[times[i].second] = i;
+    tree_[i + 1] = 1;
+  }
+  // Builds the Fenwick tree in linear time.
+  for (uint64_t i = 1; i <= size; ++i) {
+    uint64_t parent = i + (i & (~i + 1));
+    if (parent <= size) {
+      tree_[parent] += tree_[i];
+    }
+  }
+  now_ = times.size();
+}
+
+void MissRatioCurve::shrink_samples() {
+  while (last_access_.size() > max_samples_ && !samples_.empty()) {
+    threshold_ = samples_.rbegin()->first;
+    while (!samples_.empty() && samples_.rbegin()->first >= threshold_) {
+      uint64_t key = samples_.rbegin()->second;
+      auto it = last_access_.find(key);
+      tree_add(it->second, -1);
+      last_access_.erase(it);
+      samples_.erase(--samples_.end());
+    }
+  }
+  if (threshold_ == 0) {
+    threshold_ = 1;
+  }
+}
+
+}  // namespace vobla
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/miss_ratio_curve.h
+ * \brief Computes the miss ratio curve of LRU caches from access traces.
+ */
+
+#ifndef VOBLA_MISS_RATIO_CURVE_H_
+#define VOBLA_MISS_RATIO_CURVE_H_
+
+#include <boost/utility.hpp>
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace vobla {
+
+/**
+ * \class MissRatioCurve vobla/miss_ratio_curve.h
+ * \brief Estimates the miss ratio of LRU caches of all sizes in one pass
+ * over an access trace.
+ *
+ * It measures the stack (reuse) distance of each access, i.e., the number
+ * of distinct keys accessed since the previous access of the same key. An
+ * access hits a LRU cache of size `c` iff its stack distance is less than
+ * `c`.
+ *
+ * To bound the memory and the time on large traces, it uses spatial
+ * sampling (SHARDS, Waldspurger et al., FAST'15): only the keys whose hash
+ * falls below a threshold are tracked, and their distances are scaled by
+ * the sampling rate. If `max_samples` is set, the threshold is lowered
+ * whenever more than `max_samples` keys are tracked, which bounds the
+ * memory regardless of the length of the trace.
+ *
+ * The distances are kept in a log-linear histogram (16 buckets per power
+ * of two), so the curve is exact for caches smaller than 16 entries and
+ * has a relative precision of 1/16 beyond that.
+ *
+ * Usage:
+ * ~~~~~~~~~{cpp}
+ * MissRatioCurve mrc(0.01, 100000);
+ * for (auto key : trace) {
+ *   mrc.access(key);
+ * }
+ * double ratio = mrc.miss_ratio(1024);
+ * ~~~~~~~~~
+ */
+class MissRatioCurve : boost::noncopyable {
+ public:
+  /**
+   * \brief Constructs a MissRatioCurve.
+   * \param sampling_rate the initial fraction of the keys to track, in
+   * (0, 1]. 1 means the exact curve.
+   * \param max_samples the maximal number of tracked keys. 0 means no limit.
+   */
+  explicit MissRatioCurve(double sampling_rate = 1.0, size_t max_samples = 0);
+
+  ~MissRatioCurve();
+
+  /// Hashes a string key into a 64-bit key, for traces of string keys.
+  static uint64_t hash_key(const char* key, size_t length);
+
+  /// Records one access of the key.
+  void access(uint64_t key);
+
+  /// Returns the estimated miss ratio of a LRU cache with `cache_size`
+  /// entries.
+  double miss_ratio(uint64_t cache_size) const;
+
+  /**
+   * \brief Returns the whole curve as (cache size, miss ratio) pairs.
+   *
+   * There is one point at the lower bound of each non-empty histogram
+   * bucket, plus the cold-miss-only point at the largest distance seen.
+   */
+  std::vector<std::pair<uint64_t, double>> curve() const;
+
+  /// Returns the number of accesses.
+  uint64_t num_accesses() const {
+    return num_accesses_;
+  }
+
+  /// Returns the number of accesses of the tracked keys.
+  uint64_t num_sampled_accesses() const {
+    return num_sampled_;
+  }
+
+  /// Returns the number of the tracked keys.
+  size_t num_tracked_keys() const {
+    return last_access_.size();
+  }
+
+  /// Returns the current sampling rate.
+  double sampling_rate() const;
+
+ private:
+  /// Returns the bucket index of a distance.
+  static size_t bucket_of(uint64_t distance);
+
+  /// Returns the smallest distance of a bucket.
+  static uint64_t bucket_lower_bound(size_t bucket);
+
+  /// Adds `delta` at `time` to the Fenwick tree.
+  void tree_add(uint64_t time, int delta);
+
+  /// Returns the number of marked timestamps in [0, time].
+  uint64_t tree_prefix_sum(uint64_t time) const;
+
+  /// Renumbers the timestamps of the tracked keys to shrink the tree.
+  void compact();
+
+  /// Lowers the threshold until at most max_samples_ keys are tracked.
+  void shrink_samples();
+
+  /// Adds weight to the histogram.
+  void record(size_t bucket, double weight);
+
+  uint64_t threshold_;
+
+  size_t max_samples_;
+
+  uint64_t num_accesses_ = 0;
+
+  uint64_t num_sampled_ = 0;
+
+  /// The sum of the weights of all sampled accesses.
+  double total_weight_ = 0;
+
+  /// The weighted count of first accesses (cold misses).
+  double cold_weight_ = 0;
+
+  std::vector<double> histogram_;
+
+  /// Key -> the timestamp of its last access.
+  std::unordered_map<uint64_t, uint64_t> last_access_;
+
+  /// (hash value, key) of the tracked keys, to drop the largest ones.
+  std::set<std::pair<uint64_t, uint64_t>> samples_;
+
+  /// Fenwick tree marking the timestamps of the last accesses.
+  std::vector<uint32_t> tree_;
+
+  uint64_t now_ = 0;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_MISS_RATIO_CURVE_H_
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+#include "vobla/lru_cache.h"
+#include "vobla/miss_ratio_curve.h"
+
+using std::vector;
+
+namespace vobla {
+
+namespace {
+
+class TraceItem : public LRUCacheItem<uint64_t> {
+ public:
+  explicit TraceItem(uint64_t k) : key(k) {}
+
+  uint64_t cache_key() const { return key; }
+
+  uint64_t key;
+};
+
+/// Replays the trace on a LRUCache and returns the miss ratio.
+double simulate_lru(const vector<uint64_t>& trace, size_t cache_size) {
+  LRUCache<TraceItem> lru(cache_size);
+  size_t misses = 0;
+  for (auto key : trace) {
+    if (lru.find(key)) {
+      lru.use(key);
+      continue;
+    }
+    misses++;
+    if (lru.full()) {
+      lru.evict();
+    }
+    lru.insert(key, new TraceItem(key));
+  }
+  lru.clear();
+  return static_cast<double>(misses) / trace.size();
+}
+
+/// Generates a trace with a skewed (Pareto-like) key popularity.
+vector<uint64_t> skewed_trace(size_t length, uint64_t num_keys) {
+  std::mt19937_64 rng(1234);
+  std::exponential_distribution<double> dist(8.0);
+  vector<uint64_t> trace;
+  for (size_t i = 0; i < length; i++) {
+    trace.push_back(static_cast<uint64_t>(dist(rng) * num_keys) % num_keys);
+  }
+  return trace;
+}
+
+}  // namespace
+
+TEST(MissRatioCurveTest, TestCyclicAccesses) {
+  MissRatioCurve mrc;
+  for (int round = 0; round < 10; round++) {
+    for (uint64_t key = 0; key < 100; key++) {
+      mrc.access(key);
+    }
+  }
+  EXPECT_EQ(1000u, mrc.num_accesses());
+  EXPECT_EQ(1000u, mrc.num_sampled_accesses());
+  EXPECT_EQ(100u, mrc.num_tracked_keys());
+  // A loop larger than the cache always misses under LRU.
+  EXPECT_DOUBLE_EQ(1.0, mrc.miss_ratio(1));
+  EXPECT_DOUBLE_EQ(1.0, mrc.miss_ratio(96));
+  // Only the cold misses are left once the loop fits into the cache.
+  EXPECT_DOUBLE_EQ(0.1, mrc.miss_ratio(100));
+  EXPECT_DOUBLE_EQ(0.1, mrc.miss_ratio(1000));
+
+  auto curve = mrc.curve();
+  ASSERT_FALSE(curve.empty());
+  EXPECT_EQ(0u, curve.front().first);
+  EXPECT_DOUBLE_EQ(1.0, curve.front().second);
+  EXPECT_DOUBLE_EQ(0.1, curve.back().second);
+}
+
+TEST(MissRatioCurveTest, TestExactCurveMatchesLRUCache) {
+  auto trace = skewed_trace(50000, 2000);
+  MissRatioCurve mrc;
+  for (auto key : trace) {
+    mrc.access(key);
+  }
+  // The histogram is exact on the bucket boundaries.
+  for (size_t size : {1, 8, 15, 16, 64, 128, 256, 512, 1024}) {
+    EXPECT_NEAR(simulate_lru(trace, size), mrc.miss_ratio(size), 1e-9)
+        << "cache size: " << size;
+  }
+}
+
+TEST(MissRatioCurveTest, TestSampledCurve) {
+  auto trace = skewed_trace(200000, 20000);
+  MissRatioCurve mrc(0.1);
+  for (auto key : trace) {
+    mrc.access(key);
+  }
+  EXPECT_NEAR(0.1, mrc.sampling_rate(), 0.001);
+  EXPECT_LT(mrc.num_tracked_keys(), 3000u);
+  for (size_t size : {512, 2048, 8192}) {
+    EXPECT_NEAR(simulate_lru(trace, size), mrc.miss_ratio(size), 0.05)
+        << "cache size: " << size;
+  }
+}
+
+TEST(MissRatioCurveTest, TestKeyZeroIsNotAlwaysSampled) {
+  MissRatioCurve mrc(0);
+  for (int i = 0; i < 1000; i++) {
+    mrc.access(0);
+  }
+  EXPECT_EQ(1000u, mrc.num_accesses());
+  EXPECT_EQ(0u, mrc.num_sampled_accesses());
+  EXPECT_EQ(0u, mrc.num_tracked_keys());
+}
+
+TEST(MissRatioCurveTest, TestBoundedSamples) {
+  auto trace = skewed_trace(200000, 50000);
+  MissRatioCurve mrc(1.0, 2000);
+  for (auto key : trace) {
+    mrc.access(key);
+    ASSERT_LE(mrc.num_tracked_keys(), 2000u);
+  }
+  EXPECT_LT(mrc.sampling_rate(), 0.5);
+  for (size_t size : {1024, 4096, 16384}) {
+    EXPECT_NEAR(simulate_lru(trace, size), mrc.miss_ratio(size), 0.05)
+        << "cache size: " << size;
+  }
+}
+
+}  // namespace vobla
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/mpmc_queue.h
+ * \brief A lock-free bounded multi-producer multi-consumer queue.
+ */
+
+#ifndef VOBLA_MPMC_QUEUE_H_
+#define VOBLA_MPMC_QUEUE_H_
+
+#include <boost/utility.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace vobla {
+
+/**
+ * \class MPMCQueue vobla/mpmc_queue.h
+ * \brief A bounded FIFO ring buffer that any number of threads can push
+ * into and pop from without locks.
+ *
+ * Each cell carries a sequence number telling whether it is ready to be
+ * written or read in the current lap, so a push or a pop costs one CAS on
+ * the shared position plus one store on the cell in the uncontended case
+ * (D. Vyukov's bounded MPMC queue).
+ *
+ * try_push() and try_pop() never block. The callers decide how to wait,
+ * e.g., with an EventCount.
+ */
+template <typename T>
+class MPMCQueue : boost::noncopyable {
+ public:
+  /// Constructs a queue holding up to `capacity` items, rounded up to a
+  /// power of 2.
+  explicit MPMCQueue(size_t capacity) : enqueue_pos_(0), dequeue_pos_(0) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /// Destroys the remaining items.
+  ~MPMCQueue() {
+    T item;
+    while (try_pop(&item)) {
+    }
+  }
+
+  /// Returns the capacity.
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+
+  /// Returns the approximate number of items.
+  size_t size() const {
+    size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+    size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  /// Returns true if the queue seems empty.
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /**
+   * \brief Moves an item into the queue.
+   * \return false if the queue is full, in which case `item` is untouched.
+   */
+  bool try_push(T&& item) {
+    Cell* cell;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    new (&cell->storage) T(std::move(item));
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Copies an item into the queue. Returns false if the queue is full.
+  bool try_push(const T& item) {
+    T duplicate(item);
+    return try_push(std::move(duplicate));
+  }
+
+  /// Pops the oldest item. Returns false if the queue is empty.
+  bool try_pop(T* item) {
+    Cell* cell;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) -
+          static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    T* stored = reinterpret_cast<T*>(&cell->storage);
+    *item = std::move(*stored);
+    stored->~T();
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+
+  size_t mask_;
+
+  /// The producers and the consumers update different positions, which
+  /// are kept on separate cache lines.
+  char padding0_[64];
+
+  std::atomic<size_t> enqueue_pos_;
+
+  char padding1_[64];
+
+  std::atomic<size_t> dequeue_pos_;
+
+  char padding2_[64];
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_MPMC_QUEUE_H_
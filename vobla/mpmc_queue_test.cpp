@@ -0,0 +1,105 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "vobla/mpmc_queue.h"
+
+using std::unique_ptr;
+using std::vector;
+
+namespace vobla {
+
+TEST(MPMCQueueTest, TestPushAndPop) {
+  MPMCQueue<int> queue(3);
+  EXPECT_EQ(4u, queue.capacity());
+  EXPECT_TRUE(queue.empty());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.try_push(i));
+  }
+  EXPECT_FALSE(queue.try_push(4));
+  EXPECT_EQ(4u, queue.size());
+
+  int item = 0;
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.try_pop(&item));
+    EXPECT_EQ(i, item);
+  }
+  EXPECT_FALSE(queue.try_pop(&item));
+  // Wraps around.
+  EXPECT_TRUE(queue.try_push(5));
+  EXPECT_TRUE(queue.try_pop(&item));
+  EXPECT_EQ(5, item);
+}
+
+TEST(MPMCQueueTest, TestMoveOnlyItems) {
+  MPMCQueue<unique_ptr<int>> queue(2);
+  unique_ptr<int> item(new int(1));
+  EXPECT_TRUE(queue.try_push(std::move(item)));
+  EXPECT_FALSE(item);
+  EXPECT_TRUE(queue.try_push(unique_ptr<int>(new int(2))));
+
+  // A failed push leaves the item untouched.
+  item.reset(new int(3));
+  EXPECT_FALSE(queue.try_push(std::move(item)));
+  ASSERT_TRUE(item);
+  EXPECT_EQ(3, *item);
+
+  EXPECT_TRUE(queue.try_pop(&item));
+  EXPECT_EQ(1, *item);
+  // The destructor releases the remaining item.
+}
+
+TEST(MPMCQueueTest, TestConcurrentProducersAndConsumers) {
+  const int kNumThreads = 3;
+  const int kItemsPerProducer = 50000;
+  MPMCQueue<int> queue(64);
+  std::atomic<int64_t> sum(0);
+  std::atomic<int> consumed(0);
+
+  vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&queue] {
+        for (int i = 1; i <= kItemsPerProducer; i++) {
+          while (!queue.try_push(i)) {
+            std::this_thread::yield();
+          }
+        }
+      });
+    threads.emplace_back([&] {
+        int item;
+        while (consumed < kNumThreads * kItemsPerProducer) {
+          if (queue.try_pop(&item)) {
+            sum += item;
+            consumed++;
+          } else {
+            std::this_thread::yield();
+          }
+        }
+      });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(static_cast<int64_t>(kNumThreads) * kItemsPerProducer *
+            (kItemsPerProducer + 1) / 2, sum);
+  EXPECT_TRUE(queue.empty());
+}
+
+}  // namespace vobla
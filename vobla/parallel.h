@@ -0,0 +1,286 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/parallel.h
+ * \brief Parallel loops, reductions and sorting on a ThreadPool.
+ *
+ * The work is split into chunks that the calling thread and up to
+ * `num_threads()` helper tasks claim one at a time from an atomic counter.
+ * Since the caller claims chunks too, a loop always makes progress, even
+ * when it is called from a worker of a busy pool, and the helpers that
+ * only start after all chunks are claimed return immediately.
+ *
+ * With `grain == 0`, the chunk size is picked to make about
+ * kChunksPerThread chunks per thread, so that the faster threads take
+ * more chunks. Ranges of no more than one chunk run inline.
+ *
+ * If a callable throws, the remaining chunks are skipped and the first
+ * exception is rethrown in the calling thread.
+ */
+
+#ifndef VOBLA_PARALLEL_H_
+#define VOBLA_PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "vobla/thread_pool.h"
+
+namespace vobla {
+
+namespace internal {
+
+/// The number of chunks per thread when the grain is picked automatically.
+const size_t kChunksPerThread = 8;
+
+/// The ranges smaller than this are sorted inline.
+const size_t kMinParallelSortSize = 4096;
+
+/// Returns the chunk size to split `size` items on `pool`.
+inline size_t chunk_size(ThreadPool* pool, size_t size, size_t grain) {
+  if (grain > 0) {
+    return grain;
+  }
+  size_t num_chunks = kChunksPerThread * (pool->num_threads() + 1);
+  return std::max<size_t>(1, size / num_chunks);
+}
+
+/// The chunks shared by the caller and the helper tasks.
+class ChunkLoop {
+ public:
+  ChunkLoop(size_t num_chunks, const std::function<void(size_t)>* func)
+      : num_chunks_(num_chunks), func_(func), next_(0), done_(0),
+        failed_(false) {}
+
+  /// Runs the chunks until all are claimed.
+  void run() {
+    size_t chunk;
+    while ((chunk = next_.fetch_add(1)) < num_chunks_) {
+      if (!failed_.load(std::memory_order_relaxed)) {
+        try {
+          (*func_)(chunk);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (!error_) {
+            error_ = std::current_exception();
+          }
+          failed_ = true;
+        }
+      }
+      if (done_.fetch_add(1) + 1 == num_chunks_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        all_done_.notify_all();
+      }
+    }
+  }
+
+  /// Waits for the chunks run by the helpers, and rethrows the first
+  /// exception.
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (done_.load() < num_chunks_) {
+      all_done_.wait(lock);
+    }
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+ private:
+  const size_t num_chunks_;
+
+  /// Points to the caller's stack. The helpers only call it after claiming
+  /// a chunk, i.e., while the caller waits.
+  const std::function<void(size_t)>* func_;
+
+  std::atomic<size_t> next_;
+
+  std::atomic<size_t> done_;
+
+  std::atomic<bool> failed_;
+
+  std::mutex mutex_;
+
+  std::condition_variable all_done_;
+
+  std::exception_ptr error_;
+};
+
+/// Runs `func(0)`, ..., `func(num_chunks - 1)` on the pool and the calling
+/// thread.
+inline void run_chunks(ThreadPool* pool, size_t num_chunks,
+                       const std::function<void(size_t)>& func) {
+  if (num_chunks == 0) {
+    return;
+  }
+  if (num_chunks == 1) {
+    func(0);
+    return;
+  }
+  // The helpers hold the loop, since they might start after it ends.
+  std::shared_ptr<ChunkLoop> loop(new ChunkLoop(num_chunks, &func));
+  size_t num_helpers = std::min(num_chunks - 1, pool->num_threads());
+  for (size_t i = 0; i < num_helpers; ++i) {
+    pool->post([loop] { loop->run(); });
+  }
+  loop->run();
+  loop->wait();
+}
+
+}  // namespace internal
+
+/**
+ * \brief Calls `func(i)` for each `i` in [begin, end) on the pool.
+ * \param grain the number of indices per chunk, or 0 to pick one.
+ *
+ * ~~~~~~~~~{cpp}
+ * parallel_for(&pool, 0, n, 0, [&](int i) { out[i] = f(in[i]); });
+ * ~~~~~~~~~
+ */
+template <typename Index, typename Func>
+void parallel_for(ThreadPool* pool, Index begin, Index end, size_t grain,
+                  Func func) {
+  static_assert(std::is_integral<Index>::value,
+                "parallel_for() takes integral indices.");
+  if (end <= begin) {
+    return;
+  }
+  size_t size = end - begin;
+  size_t chunk = internal::chunk_size(pool, size, grain);
+  if (size <= chunk) {
+    for (Index i = begin; i < end; ++i) {
+      func(i);
+    }
+    return;
+  }
+  internal::run_chunks(pool, (size - 1) / chunk + 1, [&](size_t c) {
+      Index first = begin + c * chunk;
+      Index last = begin + std::min(size, (c + 1) * chunk);
+      for (Index i = first; i < last; ++i) {
+        func(i);
+      }
+    });
+}
+
+/**
+ * \brief Reduces [begin, end) on the pool.
+ * \param grain the number of indices per chunk, or 0 to pick one.
+ * \param identity the identity value of `reduce`.
+ * \param func `T func(Index first, Index last, T init)` folds [first, last)
+ * into `init`.
+ * \param reduce `T reduce(T a, T b)` combines two partial results. It must
+ * be associative; the partial results are combined in the index order.
+ *
+ * ~~~~~~~~~{cpp}
+ * int64_t sum = parallel_reduce(&pool, 0, n, 0, int64_t(0),
+ *     [&](int first, int last, int64_t sum) {
+ *       for (int i = first; i < last; i++) {
+ *         sum += values[i];
+ *       }
+ *       return sum;
+ *     },
+ *     std::plus<int64_t>());
+ * ~~~~~~~~~
+ */
+template <typename Index, typename T, typename Func, typename Reduce>
+T parallel_reduce(ThreadPool* pool, Index begin, Index end, size_t grain,
+                  T identity, Func func, Reduce reduce) {
+  static_assert(std::is_integral<Index>::value,
+                "parallel_reduce() takes integral indices.");
+  if (end <= begin) {
+    return identity;
+  }
+  size_t size = end - begin;
+  size_t chunk = internal::chunk_size(pool, size, grain);
+  if (size <= chunk) {
+    return func(begin, end, identity);
+  }
+  size_t num_chunks = (size - 1) / chunk + 1;
+  std::vector<T> partials(num_chunks, identity);
+  internal::run_chunks(pool, num_chunks, [&](size_t c) {
+      Index first = begin + c * chunk;
+      Index last = begin + std::min(size, (c + 1) * chunk);
+      partials[c] = func(first, last, identity);
+    });
+  T result = identity;
+  for (auto& partial : partials) {
+    result = reduce(result, partial);
+  }
+  return result;
+}
+
+/**
+ * \brief Sorts [first, last) on the pool.
+ *
+ * It sorts the chunks in parallel, then merges the sorted runs in pairs,
+ * with the merges of each round also in parallel. Like std::stable_sort(),
+ * the merges might allocate a buffer.
+ */
+template <typename RandomIt, typename Compare>
+void parallel_sort(ThreadPool* pool, RandomIt first, RandomIt last,
+                   Compare comp) {
+  size_t size = std::distance(first, last);
+  size_t num_runs = std::min(size / internal::kMinParallelSortSize,
+                             2 * (pool->num_threads() + 1));
+  if (num_runs < 2) {
+    std::sort(first, last, comp);
+    return;
+  }
+  // The boundaries of the sorted runs.
+  std::vector<size_t> bounds;
+  for (size_t i = 0; i <= num_runs; ++i) {
+    bounds.push_back(size * i / num_runs);
+  }
+  internal::run_chunks(pool, num_runs, [&](size_t c) {
+      std::sort(first + bounds[c], first + bounds[c + 1], comp);
+    });
+  while (bounds.size() > 2) {
+    size_t num_merges = (bounds.size() - 1) / 2;
+    internal::run_chunks(pool, num_merges, [&](size_t c) {
+        std::inplace_merge(first + bounds[2 * c], first + bounds[2 * c + 1],
+                           first + bounds[2 * c + 2], comp);
+      });
+    std::vector<size_t> merged;
+    for (size_t i = 0; i < bounds.size(); i += 2) {
+      merged.push_back(bounds[i]);
+    }
+    if (merged.back() != bounds.back()) {
+      merged.push_back(bounds.back());
+    }
+    bounds.swap(merged);
+  }
+}
+
+/// Sorts [first, last) on the pool in ascending order.
+template <typename RandomIt>
+void parallel_sort(ThreadPool* pool, RandomIt first, RandomIt last) {
+  typedef typename std::iterator_traits<RandomIt>::value_type Value;
+  parallel_sort(pool, first, last, std::less<Value>());
+}
+
+}  // namespace vobla
+
+#endif  // VOBLA_PARALLEL_H_
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vobla/parallel.h"
+#include "vobla/thread_pool.h"
+
+namespace vobla {
+
+TEST(ParallelTest, TestParallelFor) {
+  ThreadPool pool(4);
+  std::vector<int> values(10000, 0);
+  parallel_for(&pool, 0, 10000, 0, [&](int i) { values[i] += i; });
+  for (int i = 0; i < 10000; i++) {
+    EXPECT_EQ(i, values[i]);
+  }
+
+  // Uneven chunks.
+  std::atomic<int> count(0);
+  parallel_for(&pool, size_t(3), size_t(1000), 7,
+               [&](size_t /* i */) { count++; });
+  EXPECT_EQ(997, count);
+
+  parallel_for(&pool, 5, 5, 0, [&](int /* i */) { count++; });
+  EXPECT_EQ(997, count);
+}
+
+TEST(ParallelTest, TestSmallRangesRunInline) {
+  ThreadPool pool(4);
+  auto caller = std::this_thread::get_id();
+  bool inline_only = true;
+  parallel_for(&pool, 0, 10, 10, [&](int /* i */) {
+      inline_only &= std::this_thread::get_id() == caller;
+    });
+  EXPECT_TRUE(inline_only);
+}
+
+TEST(ParallelTest, TestNestedLoopsInWorkers) {
+  // The outer loop occupies all workers, so the inner loops only make
+  // progress because their callers take part in them.
+  ThreadPool pool(2);
+  std::atomic<int> count(0);
+  parallel_for(&pool, 0, 8, 1, [&](int /* i */) {
+      parallel_for(&pool, 0, 1000, 10, [&](int /* i */) { count++; });
+    });
+  EXPECT_EQ(8000, count);
+}
+
+TEST(ParallelTest, TestParallelReduce) {
+  ThreadPool pool(4);
+  std::vector<int64_t> values(100000);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = i;
+  }
+  int64_t sum = parallel_reduce(
+      &pool, size_t(0), values.size(), 0, int64_t(0),
+      [&](size_t first, size_t last, int64_t init) {
+        for (size_t i = first; i < last; i++) {
+          init += values[i];
+        }
+        return init;
+      },
+      std::plus<int64_t>());
+  EXPECT_EQ(int64_t(99999) * 100000 / 2, sum);
+
+  // The partial results are combined in order.
+  std::string letters = parallel_reduce(
+      &pool, 0, 26, 3, std::string(),
+      [](int first, int last, std::string init) {
+        for (int i = first; i < last; i++) {
+          init += static_cast<char>('a' + i);
+        }
+        return init;
+      },
+      std::plus<std::string>());
+  EXPECT_EQ("abcdefghijklmnopqrstuvwxyz", letters);
+}
+
+TEST(ParallelTest, TestExceptions) {
+  ThreadPool pool(4);
+  EXPECT_THROW(parallel_for(&pool, 0, 1000, 1, [](int i) {
+        if (i == 500) {
+          throw std::runtime_error("failed");
+        }
+      }), std::runtime_error);
+}
+
+TEST(ParallelTest, TestParallelSort) {
+  ThreadPool pool(3);
+  std::mt19937 rng(7);
+  for (size_t size : {0, 100, 50000, 123457}) {
+    std::vector<uint32_t> values(size);
+    for (auto& value : values) {
+      value = rng();
+    }
+    std::vector<uint32_t> expected(values);
+    std::sort(expected.begin(), expected.end());
+    parallel_sort(&pool, values.begin(), values.end());
+    EXPECT_EQ(expected, values);
+
+    parallel_sort(&pool, values.begin(), values.end(),
+                  std::greater<uint32_t>());
+    std::reverse(expected.begin(), expected.end());
+    EXPECT_EQ(expected, values);
+  }
+}
+
+}  // namespace vobla
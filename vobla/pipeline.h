@@ -0,0 +1,570 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/pipeline.h
+ * \brief Multi-stage pipelines connected by bounded lock-free queues.
+ */
+
+#ifndef VOBLA_PIPELINE_H_
+#define VOBLA_PIPELINE_H_
+
+#include <boost/utility.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "vobla/clock.h"
+#include "vobla/event_count.h"
+#include "vobla/mpmc_queue.h"
+
+namespace vobla {
+
+/**
+ * \class Pipeline vobla/pipeline.h
+ * \brief Passes items of type `T` through a chain of stages, each run by
+ * its own threads.
+ *
+ * The caller push()es the items, which are grouped into batches of
+ * Options::batch_size. The batches flow from stage to stage through
+ * bounded MPMCQueue's, so a queue op and a wake-up are paid per batch,
+ * and a slow stage holds back the earlier ones instead of letting the
+ * queues grow. Each stage has `parallelism` threads:
+ *
+ * ~~~~~~~~~{cpp}
+ * Pipeline<Chunk> pipeline;
+ * pipeline.add_stage("checksum", 4, [](Chunk& c) { c.crc = crc32(c.data); })
+ *     .add_stage("compress", 4, [](Chunk& c) { c.data = compress(c.data); })
+ *     .add_batch_stage("write", 1, [&](std::vector<Chunk>& chunks) {
+ *       file.append(chunks);
+ *     });
+ * pipeline.start();
+ * while (reader.read(&chunk)) {
+ *   pipeline.push(std::move(chunk));
+ * }
+ * pipeline.close();
+ * pipeline.wait();
+ * ~~~~~~~~~
+ *
+ * With Ordering::kOrdered, the stages with a parallelism of 1 see the
+ * batches in the order they were pushed: they hold back the batches that
+ * overtook an earlier one in a parallel stage. The parallel stages always
+ * run the batches in any order, so the batches leave a pipeline that ends
+ * with a parallel stage in any order. To bound the batches held back, at
+ * most `queue_capacity` times the number of stages batches are in flight
+ * before the last serial stage, and push() blocks beyond that.
+ *
+ * stats() reports, for each stage, the items and the batches processed,
+ * the time spent in the stage function, and the stalls: the time waiting
+ * for input (the stage is starved) and waiting for room in the next queue
+ * (the next stage is the bottleneck).
+ *
+ * If a stage function throws, the later batches are dropped, and wait()
+ * rethrows the first exception.
+ */
+template <typename T>
+class Pipeline : boost::noncopyable {
+ public:
+  typedef std::vector<T> Batch;
+
+  /// Whether the serial stages see the batches in order.
+  enum class Ordering {
+    kUnordered,
+    kOrdered,
+  };
+
+  /// The options to construct a Pipeline.
+  struct Options {
+    /// The number of items per batch.
+    size_t batch_size = 64;
+
+    /// The capacity, in batches, of the queue before each stage.
+    size_t queue_capacity = 8;
+
+    Ordering ordering = Ordering::kUnordered;
+
+    /// The clock of the stats. Defaults to the real clock.
+    Clock* clock = nullptr;
+  };
+
+  /// The counters of a stage.
+  struct StageStats {
+    std::string name;
+
+    size_t parallelism = 0;
+
+    uint64_t items = 0;
+
+    uint64_t batches = 0;
+
+    /// The total seconds that the threads spent in the stage function.
+    double busy_time = 0;
+
+    /// The total seconds that the threads waited for input.
+    double input_wait = 0;
+
+    /// The total seconds that the threads waited for the next queue.
+    double output_wait = 0;
+
+    /// The items per second since start(), until the stage ended.
+    double throughput = 0;
+  };
+
+  Pipeline() {
+    init();
+  }
+
+  explicit Pipeline(const Options& options) : options_(options) {
+    init();
+  }
+
+  /// Closes the input and waits for the items in flight.
+  ~Pipeline() {
+    if (started_) {
+      close();
+      for (auto& stage : stages_) {
+        for (auto& thread : stage->threads) {
+          if (thread.joinable()) {
+            thread.join();
+          }
+        }
+      }
+    }
+  }
+
+  /// Adds a stage calling `func(item)` on each item. Before start().
+  Pipeline& add_stage(const std::string& name, size_t parallelism,
+                      std::function<void(T&)> func) {
+    return add_batch_stage(name, parallelism, [func](Batch& batch) {
+        for (auto& item : batch) {
+          func(item);
+        }
+      });
+  }
+
+  /// Adds a stage calling `func(batch)` on each batch. Before start().
+  Pipeline& add_batch_stage(const std::string& name, size_t parallelism,
+                            std::function<void(Batch&)> func) {
+    std::unique_ptr<Stage> stage(new Stage);
+    stage->name = name;
+    stage->parallelism = std::max<size_t>(parallelism, 1);
+    stage->func = std::move(func);
+    stages_.push_back(std::move(stage));
+    return *this;
+  }
+
+  /// Starts the threads of the stages. There must be at least one stage.
+  void start() {
+    for (size_t i = 0; i < stages_.size(); ++i) {
+      channels_.emplace_back(new Channel(options_.queue_capacity));
+    }
+    channels_.emplace_back(nullptr);
+    channels_[0]->producers = 1;
+    if (options_.ordering == Ordering::kOrdered) {
+      for (auto& stage : stages_) {
+        if (stage->parallelism == 1) {
+          last_serial_ = stage.get();
+        }
+      }
+    }
+    start_time_ = clock_->now();
+    started_ = true;
+    for (size_t i = 0; i < stages_.size(); ++i) {
+      Stage* stage = stages_[i].get();
+      stage->input = channels_[i].get();
+      stage->output = channels_[i + 1].get();
+      if (stage->output) {
+        stage->output->producers = stage->parallelism;
+      }
+      stage->live_threads = stage->parallelism;
+      for (size_t j = 0; j < stage->parallelism; ++j) {
+        stage->workers.emplace_back(new WorkerStats);
+      }
+    }
+    for (auto& stage : stages_) {
+      for (size_t j = 0; j < stage->parallelism; ++j) {
+        Stage* s = stage.get();
+        WorkerStats* stats = s->workers[j].get();
+        s->threads.emplace_back([this, s, stats] { run(s, stats); });
+      }
+    }
+  }
+
+  /**
+   * \brief Adds an item, after start(). It blocks while the first queue
+   * is full, or while too many batches are in flight in an ordered
+   * pipeline.
+   *
+   * push(), flush() and close() must be called from one thread at a time.
+   */
+  void push(T item) {
+    pending_.push_back(std::move(item));
+    if (pending_.size() >= options_.batch_size) {
+      flush();
+    }
+  }
+
+  /// Sends the partial batch, e.g., to bound the latency of a slow input.
+  void flush() {
+    if (pending_.empty()) {
+      return;
+    }
+    if (last_serial_) {
+      wait_for_ordered_stage();
+    }
+    Packet packet;
+    packet.seq = next_seq_++;
+    packet.items.swap(pending_);
+    pending_.reserve(options_.batch_size);
+    double wait = 0;
+    send(channels_[0].get(), &packet, &wait);
+  }
+
+  /// Flushes the input and tells the stages that no item follows.
+  void close() {
+    if (closed_) {
+      return;
+    }
+    flush();
+    closed_ = true;
+    producer_done(channels_[0].get());
+  }
+
+  /// Waits for all items to go through the stages, and rethrows the first
+  /// exception of the stage functions. close() must have been called.
+  void wait() {
+    for (auto& stage : stages_) {
+      for (auto& thread : stage->threads) {
+        if (thread.joinable()) {
+          thread.join();
+        }
+      }
+    }
+    std::exception_ptr error;
+    {
+      std::lock_guard<std::mutex> lock(error_mutex_);
+      error = error_;
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  /// Returns the counters of each stage.
+  std::vector<StageStats> stats() const {
+    std::vector<StageStats> result;
+    double now = clock_->now();
+    for (const auto& stage : stages_) {
+      StageStats stats;
+      stats.name = stage->name;
+      stats.parallelism = stage->parallelism;
+      double end = 0;
+      for (const auto& worker : stage->workers) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        stats.items += worker->items;
+        stats.batches += worker->batches;
+        stats.busy_time += worker->busy_time;
+        stats.input_wait += worker->input_wait;
+        stats.output_wait += worker->output_wait;
+        end = std::max(end, worker->end_time);
+      }
+      if (stage->live_threads.load() > 0) {
+        end = now;
+      }
+      double elapsed = end - start_time_;
+      stats.throughput = started_ && elapsed > 0 ? stats.items / elapsed : 0;
+      result.push_back(stats);
+    }
+    return result;
+  }
+
+ private:
+  struct Packet {
+    uint64_t seq = 0;
+
+    Batch items;
+  };
+
+  /// The queue before a stage.
+  struct Channel {
+    explicit Channel(size_t capacity) : queue(capacity) {}
+
+    MPMCQueue<Packet> queue;
+
+    EventCount not_empty;
+
+    EventCount not_full;
+
+    /// The number of threads that may still push.
+    std::atomic<size_t> producers{0};
+
+    /// Set when the producers are done.
+    std::atomic<bool> closed{false};
+  };
+
+  /// The counters of one thread of a stage, read by stats().
+  struct WorkerStats {
+    std::mutex mutex;
+
+    uint64_t items = 0;
+
+    uint64_t batches = 0;
+
+    double busy_time = 0;
+
+    double input_wait = 0;
+
+    double output_wait = 0;
+
+    /// When the thread exited, or 0.
+    double end_time = 0;
+  };
+
+  struct Stage {
+    std::string name;
+
+    size_t parallelism;
+
+    std::function<void(Batch&)> func;
+
+    Channel* input = nullptr;
+
+    /// Null for the last stage.
+    Channel* output = nullptr;
+
+    std::vector<std::thread> threads;
+
+    std::vector<std::unique_ptr<WorkerStats>> workers;
+
+    std::atomic<size_t> live_threads{0};
+
+    /// The batches that overtook an earlier one, by sequence number. Only
+    /// used by the serial stages of the ordered pipelines.
+    std::map<uint64_t, Batch> held;
+
+    uint64_t next_seq = 0;
+  };
+
+  void init() {
+    clock_ = options_.clock ? options_.clock : Clock::real_clock();
+    options_.batch_size = std::max<size_t>(options_.batch_size, 1);
+    pending_.reserve(options_.batch_size);
+  }
+
+  /// Pushes a packet, waiting while the queue is full.
+  void send(Channel* channel, Packet* packet, double* wait) {
+    if (!channel->queue.try_push(std::move(*packet))) {
+      double start = clock_->now();
+      while (true) {
+        auto key = channel->not_full.prepare_wait();
+        if (channel->queue.try_push(std::move(*packet))) {
+          channel->not_full.cancel_wait();
+          break;
+        }
+        channel->not_full.wait(key);
+        if (channel->queue.try_push(std::move(*packet))) {
+          break;
+        }
+      }
+      *wait += clock_->now() - start;
+    }
+    channel->not_empty.notify_one();
+  }
+
+  /// Waits while the last serial stage is too far behind the input in an
+  /// ordered pipeline, or until a stage fails and drops the batches.
+  void wait_for_ordered_stage() {
+    uint64_t limit =
+        std::max<size_t>(options_.queue_capacity, 1) * stages_.size();
+    auto behind = [this, limit] {
+      return !failed_.load() &&
+          next_seq_ - ordered_seq_.load(std::memory_order_acquire) >= limit;
+    };
+    while (behind()) {
+      auto key = ordered_progress_.prepare_wait();
+      if (!behind()) {
+        ordered_progress_.cancel_wait();
+        break;
+      }
+      ordered_progress_.wait(key);
+    }
+  }
+
+  /// Called by a serial stage of an ordered pipeline after each batch.
+  void advance_ordered_stage(Stage* stage) {
+    stage->next_seq++;
+    if (stage == last_serial_) {
+      ordered_seq_.store(stage->next_seq, std::memory_order_release);
+      ordered_progress_.notify_all();
+    }
+  }
+
+  /// Pops a packet, waiting while the queue is empty. Returns false once
+  /// the queue is closed and drained.
+  bool receive(Channel* channel, Packet* packet, double* wait) {
+    double start = -1;
+    while (!channel->queue.try_pop(packet)) {
+      if (start < 0) {
+        start = clock_->now();
+      }
+      auto key = channel->not_empty.prepare_wait();
+      if (channel->queue.try_pop(packet)) {
+        channel->not_empty.cancel_wait();
+        break;
+      }
+      if (channel->closed.load()) {
+        channel->not_empty.cancel_wait();
+        // The last packets were pushed before the queue was closed.
+        if (channel->queue.try_pop(packet)) {
+          break;
+        }
+        *wait += clock_->now() - start;
+        return false;
+      }
+      channel->not_empty.wait(key);
+    }
+    if (start >= 0) {
+      *wait += clock_->now() - start;
+    }
+    channel->not_full.notify_one();
+    return true;
+  }
+
+  void producer_done(Channel* channel) {
+    if (channel->producers.fetch_sub(1) == 1) {
+      channel->closed.store(true);
+      channel->not_empty.notify_all();
+    }
+  }
+
+  void run(Stage* stage, WorkerStats* stats) {
+    bool in_order = options_.ordering == Ordering::kOrdered &&
+        stage->parallelism == 1;
+    Packet packet;
+    double input_wait = 0;
+    while (receive(stage->input, &packet, &input_wait)) {
+      if (!in_order) {
+        process(stage, stats, &packet, &input_wait);
+        continue;
+      }
+      if (packet.seq != stage->next_seq) {
+        stage->held[packet.seq].swap(packet.items);
+        continue;
+      }
+      process(stage, stats, &packet, &input_wait);
+      advance_ordered_stage(stage);
+      // Catches up with the batches held back.
+      auto it = stage->held.find(stage->next_seq);
+      while (it != stage->held.end()) {
+        packet.seq = it->first;
+        packet.items.swap(it->second);
+        stage->held.erase(it);
+        process(stage, stats, &packet, &input_wait);
+        advance_ordered_stage(stage);
+        it = stage->held.find(stage->next_seq);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(stats->mutex);
+      stats->input_wait += input_wait;
+      stats->end_time = clock_->now();
+    }
+    stage->live_threads--;
+    if (stage->output) {
+      producer_done(stage->output);
+    }
+  }
+
+  /// Runs the stage function on a packet and passes it on.
+  void process(Stage* stage, WorkerStats* stats, Packet* packet,
+               double* input_wait) {
+    size_t num_items = packet->items.size();
+    double start = clock_->now();
+    if (!failed_.load(std::memory_order_relaxed)) {
+      try {
+        stage->func(packet->items);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (!error_) {
+          error_ = std::current_exception();
+        }
+        failed_ = true;
+        ordered_progress_.notify_all();
+      }
+    }
+    double busy = clock_->now() - start;
+    double output_wait = 0;
+    if (stage->output && !failed_.load(std::memory_order_relaxed)) {
+      send(stage->output, packet, &output_wait);
+    }
+    packet->items.clear();
+    std::lock_guard<std::mutex> lock(stats->mutex);
+    stats->items += num_items;
+    stats->batches++;
+    stats->busy_time += busy;
+    stats->input_wait += *input_wait;
+    stats->output_wait += output_wait;
+    *input_wait = 0;
+  }
+
+  Options options_;
+
+  Clock* clock_ = nullptr;
+
+  std::vector<std::unique_ptr<Stage>> stages_;
+
+  /// channels_[i] is the input of stage i. The last one is null.
+  std::vector<std::unique_ptr<Channel>> channels_;
+
+  /// The items of the next batch.
+  Batch pending_;
+
+  uint64_t next_seq_ = 0;
+
+  /// The last serial stage of an ordered pipeline, or null.
+  Stage* last_serial_ = nullptr;
+
+  /// The next sequence number expected by `last_serial_`.
+  std::atomic<uint64_t> ordered_seq_{0};
+
+  /// Notified when `ordered_seq_` moves or a stage fails.
+  EventCount ordered_progress_;
+
+  bool started_ = false;
+
+  bool closed_ = false;
+
+  double start_time_ = 0;
+
+  std::atomic<bool> failed_{false};
+
+  std::mutex error_mutex_;
+
+  std::exception_ptr error_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_PIPELINE_H_
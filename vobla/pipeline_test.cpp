@@ -0,0 +1,178 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "vobla/pipeline.h"
+
+using std::vector;
+
+namespace vobla {
+
+TEST(PipelineTest, TestUnordered) {
+  vector<int> results;
+  Pipeline<int> pipeline;
+  pipeline.add_stage("add", 2, [](int& value) { value += 1; })
+      .add_stage("double", 3, [](int& value) { value *= 2; })
+      .add_batch_stage("collect", 1, [&results](vector<int>& batch) {
+          results.insert(results.end(), batch.begin(), batch.end());
+        });
+  pipeline.start();
+  for (int i = 0; i < 1000; i++) {
+    pipeline.push(i);
+  }
+  pipeline.close();
+  pipeline.wait();
+
+  std::sort(results.begin(), results.end());
+  ASSERT_EQ(1000u, results.size());
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_EQ(2 * (i + 1), results[i]);
+  }
+  auto stats = pipeline.stats();
+  ASSERT_EQ(3u, stats.size());
+  EXPECT_EQ("add", stats[0].name);
+  EXPECT_EQ(2u, stats[0].parallelism);
+  for (const auto& stage : stats) {
+    EXPECT_EQ(1000u, stage.items);
+    // 15 full batches of 64 and a partial one.
+    EXPECT_EQ(16u, stage.batches);
+    EXPECT_GT(stage.throughput, 0);
+  }
+}
+
+TEST(PipelineTest, TestOrdered) {
+  Pipeline<int>::Options options;
+  options.batch_size = 4;
+  options.ordering = Pipeline<int>::Ordering::kOrdered;
+  vector<int> results;
+  {
+    Pipeline<int> pipeline(options);
+    // The batches take different times, so they overtake each other.
+    pipeline.add_batch_stage("shuffle", 4, [](vector<int>& batch) {
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(100 * (batch[0] % 7)));
+      })
+        .add_stage("collect", 1, [&results](int& value) {
+            results.push_back(value);
+          });
+    pipeline.start();
+    for (int i = 0; i < 200; i++) {
+      pipeline.push(i);
+    }
+    // The destructor closes the input and waits.
+  }
+  ASSERT_EQ(200u, results.size());
+  for (int i = 0; i < 200; i++) {
+    EXPECT_EQ(i, results[i]);
+  }
+}
+
+TEST(PipelineTest, TestOrderedBoundsTheBatchesInFlight) {
+  Pipeline<int>::Options options;
+  options.batch_size = 1;
+  options.queue_capacity = 2;
+  options.ordering = Pipeline<int>::Ordering::kOrdered;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::atomic<int> pushed(0);
+  vector<int> results;
+  {
+    Pipeline<int> pipeline(options);
+    // The first batch is stuck, so the others overtake it.
+    pipeline.add_stage("slow_first", 4, [released](int& value) {
+        if (value == 0) {
+          released.wait();
+        }
+      })
+        .add_stage("collect", 1, [&results](int& value) {
+            results.push_back(value);
+          });
+    pipeline.start();
+    std::thread producer([&] {
+        for (int i = 0; i < 100; i++) {
+          pipeline.push(i);
+          pushed++;
+        }
+      });
+    // At most queue_capacity * 2 stages batches are in flight.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(4, pushed);
+    release.set_value();
+    producer.join();
+  }
+  ASSERT_EQ(100u, results.size());
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(i, results[i]);
+  }
+}
+
+TEST(PipelineTest, TestExceptions) {
+  for (auto ordering : {Pipeline<int>::Ordering::kUnordered,
+                        Pipeline<int>::Ordering::kOrdered}) {
+    Pipeline<int>::Options options;
+    options.ordering = ordering;
+    Pipeline<int> pipeline(options);
+    int num_collected = 0;
+    pipeline.add_stage("check", 2, [](int& value) {
+        if (value == 500) {
+          throw std::runtime_error("bad item");
+        }
+      })
+        .add_batch_stage("collect", 1, [&num_collected](vector<int>& batch) {
+            num_collected += batch.size();
+          });
+    pipeline.start();
+    // The ordered pipeline stops waiting for the dropped batches.
+    for (int i = 0; i < 100000; i++) {
+      pipeline.push(i);
+    }
+    pipeline.close();
+    EXPECT_THROW(pipeline.wait(), std::runtime_error);
+    EXPECT_LT(num_collected, 100000);
+  }
+}
+
+TEST(PipelineTest, TestStallMetrics) {
+  Pipeline<int>::Options options;
+  options.batch_size = 1;
+  options.queue_capacity = 1;
+  Pipeline<int> pipeline(options);
+  pipeline.add_stage("fast", 1, [](int& /* value */) {})
+      .add_stage("slow", 1, [](int& /* value */) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+  pipeline.start();
+  for (int i = 0; i < 20; i++) {
+    pipeline.push(i);
+  }
+  pipeline.close();
+  pipeline.wait();
+  auto stats = pipeline.stats();
+  // The fast stage waits for room before the slow one, which is busy.
+  EXPECT_GT(stats[0].output_wait, 0.005);
+  EXPECT_GT(stats[1].busy_time, 0.015);
+  EXPECT_EQ(0, stats[1].output_wait);
+  EXPECT_EQ(20u, stats[1].items);
+}
+
+}  // namespace vobla
@@ -0,0 +1,298 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/scheduled_executor.cpp
+ * \brief Implementation of ScheduledExecutor.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "vobla/clock.h"
+#include "vobla/scheduled_executor.h"
+
+namespace vobla {
+
+namespace {
+
+const size_t kNotInHeap = std::numeric_limits<size_t>::max();
+
+struct Timer {
+  ScheduledExecutor::TimerId id;
+
+  /// The due time.
+  double when;
+
+  /// 0 for one-shot timers.
+  double period;
+
+  bool fixed_rate;
+
+  /// The position in the heap, or kNotInHeap while a periodic task runs.
+  size_t index;
+
+  /// Shared with the running periodic task.
+  std::shared_ptr<Task> task;
+};
+
+}  // namespace
+
+class ScheduledExecutor::State
+    : public std::enable_shared_from_this<ScheduledExecutor::State> {
+ public:
+  State(Executor* executor, Clock* clock)
+      : executor_(executor), clock_(clock), stopped_(false), next_id_(1) {
+  }
+
+  TimerId add(Task task, double delay, double period, bool fixed_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Timer* timer = new Timer;
+    timer->id = next_id_++;
+    timer->when = clock_->now() + std::max(0.0, delay);
+    timer->period = period;
+    timer->fixed_rate = fixed_rate;
+    timer->task.reset(new Task(std::move(task)));
+    timers_[timer->id].reset(timer);
+    push_locked(timer);
+    return timer->id;
+  }
+
+  bool cancel(TimerId id) {
+    std::shared_ptr<Task> task;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = timers_.find(id);
+    if (it == timers_.end()) {
+      return false;
+    }
+    if (it->second->index != kNotInHeap) {
+      remove_locked(it->second->index);
+    }
+    // Destroys the callable out of the lock.
+    task = std::move(it->second->task);
+    timers_.erase(it);
+    return true;
+  }
+
+  /// Posts the due timers.
+  size_t fire() {
+    std::vector<Task> due;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      double now = clock_->now();
+      while (!heap_.empty() && heap_[0]->when <= now) {
+        Timer* timer = heap_[0];
+        remove_locked(0);
+        if (timer->period > 0) {
+          std::shared_ptr<State> self = shared_from_this();
+          std::shared_ptr<Task> task = timer->task;
+          TimerId id = timer->id;
+          double scheduled = timer->when;
+          due.push_back(Task([self, task, id, scheduled] {
+              (*task)();
+              self->rearm(id, scheduled);
+            }));
+        } else {
+          due.push_back(std::move(*timer->task));
+          timers_.erase(timer->id);
+        }
+      }
+    }
+    for (auto& task : due) {
+      executor_->execute(std::move(task));
+    }
+    return due.size();
+  }
+
+  /// The loop of the timer thread.
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_) {
+      if (heap_.empty()) {
+        cond_.wait(lock);
+        continue;
+      }
+      double wait = heap_[0]->when - clock_->now();
+      if (wait > 0) {
+        cond_.wait_for(lock, std::chrono::duration<double>(wait));
+        continue;
+      }
+      lock.unlock();
+      fire();
+      lock.lock();
+    }
+  }
+
+  /// Drops all timers and stops the timer thread.
+  void stop() {
+    std::unordered_map<TimerId, std::unique_ptr<Timer>> timers;
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+    heap_.clear();
+    timers.swap(timers_);
+    cond_.notify_all();
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return timers_.size();
+  }
+
+ private:
+  /// Puts a periodic timer back to the heap after a run.
+  void rearm(TimerId id, double scheduled) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = timers_.find(id);
+    if (stopped_ || it == timers_.end()) {
+      return;
+    }
+    Timer* timer = it->second.get();
+    double now = clock_->now();
+    if (timer->fixed_rate) {
+      timer->when = scheduled + timer->period;
+      if (timer->when < now) {
+        timer->when += std::ceil((now - timer->when) / timer->period) *
+            timer->period;
+      }
+    } else {
+      timer->when = now + timer->period;
+    }
+    push_locked(timer);
+  }
+
+  bool earlier(const Timer* lhs, const Timer* rhs) const {
+    return lhs->when < rhs->when ||
+        (lhs->when == rhs->when && lhs->id < rhs->id);
+  }
+
+  void place(size_t index, Timer* timer) {
+    heap_[index] = timer;
+    timer->index = index;
+  }
+
+  void sift_up(size_t index) {
+    Timer* timer = heap_[index];
+    while (index > 0) {
+      size_t parent = (index - 1) / 2;
+      if (!earlier(timer, heap_[parent])) {
+        break;
+      }
+      place(index, heap_[parent]);
+      index = parent;
+    }
+    place(index, timer);
+  }
+
+  void sift_down(size_t index) {
+    Timer* timer = heap_[index];
+    size_t size = heap_.size();
+    while (true) {
+      size_t child = 2 * index + 1;
+      if (child >= size) {
+        break;
+      }
+      if (child + 1 < size && earlier(heap_[child + 1], heap_[child])) {
+        child++;
+      }
+      if (!earlier(heap_[child], timer)) {
+        break;
+      }
+      place(index, heap_[child]);
+      index = child;
+    }
+    place(index, timer);
+  }
+
+  void push_locked(Timer* timer) {
+    heap_.push_back(timer);
+    sift_up(heap_.size() - 1);
+    if (heap_[0] == timer) {
+      // The timer thread sleeps until a later time.
+      cond_.notify_all();
+    }
+  }
+
+  void remove_locked(size_t index) {
+    heap_[index]->index = kNotInHeap;
+    Timer* last = heap_.back();
+    heap_.pop_back();
+    if (index == heap_.size()) {
+      return;
+    }
+    place(index, last);
+    sift_up(index);
+    sift_down(last->index);
+  }
+
+  Executor* executor_;
+
+  Clock* clock_;
+
+  std::mutex mutex_;
+
+  /// Wakes up the timer thread.
+  std::condition_variable cond_;
+
+  bool stopped_;
+
+  TimerId next_id_;
+
+  /// Owns the timers.
+  std::unordered_map<TimerId, std::unique_ptr<Timer>> timers_;
+
+  /// The pending timers, ordered by the due time and then by the id.
+  std::vector<Timer*> heap_;
+};
+
+ScheduledExecutor::ScheduledExecutor(Executor* executor, Clock* clock) {
+  Clock* real = Clock::real_clock();
+  state_.reset(new State(executor, clock ? clock : real));
+  if (!clock || clock == real) {
+    std::shared_ptr<State> state = state_;
+    thread_ = std::thread([state] { state->run(); });
+  }
+}
+
+ScheduledExecutor::~ScheduledExecutor() {
+  state_->stop();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+ScheduledExecutor::TimerId ScheduledExecutor::schedule(
+    Task task, double delay, double period, bool fixed_rate) {
+  return state_->add(std::move(task), delay, period, fixed_rate);
+}
+
+bool ScheduledExecutor::cancel(TimerId id) {
+  return state_->cancel(id);
+}
+
+size_t ScheduledExecutor::poll() {
+  return state_->fire();
+}
+
+size_t ScheduledExecutor::num_timers() const {
+  return state_->size();
+}
+
+}  // namespace vobla
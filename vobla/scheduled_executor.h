@@ -0,0 +1,132 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/scheduled_executor.h
+ * \brief Runs delayed and periodic tasks on an Executor.
+ */
+
+#ifndef VOBLA_SCHEDULED_EXECUTOR_H_
+#define VOBLA_SCHEDULED_EXECUTOR_H_
+
+#include <boost/utility.hpp>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include "vobla/executor.h"
+#include "vobla/task.h"
+
+namespace vobla {
+
+class Clock;
+
+/**
+ * \class ScheduledExecutor vobla/scheduled_executor.h
+ * \brief Posts tasks to an Executor (e.g., a ThreadPool) after a delay, or
+ * periodically.
+ *
+ * The timers are kept in a binary heap indexed by the timer ids, so that
+ * both scheduling and cancelling take O(log n). With the real clock, one
+ * timer thread sleeps until the earliest timer is due and posts it to the
+ * executor; the tasks themselves never run in the timer thread.
+ *
+ * With any other clock, e.g., a FakeClock, there is no timer thread: the
+ * caller fires the due timers with poll(), which makes the tests
+ * deterministic:
+ *
+ * ~~~~~~~~~{cpp}
+ * FakeClock clock;
+ * ScheduledExecutor timers(&pool, &clock);
+ * timers.run_after(10, [] { flush(); });
+ * clock.advance(10);
+ * timers.poll();  // Posts flush() to the pool.
+ * ~~~~~~~~~
+ *
+ * A periodic task is re-armed after each run completes, so that two runs
+ * of the same timer never overlap. The posted callables must not throw.
+ */
+class ScheduledExecutor : boost::noncopyable {
+ public:
+  /// Identifies a timer. 0 is never used.
+  typedef uint64_t TimerId;
+
+  /**
+   * \brief Constructs a ScheduledExecutor posting the tasks to `executor`.
+   * \param clock the clock of the timers. Defaults to the real clock, with
+   * a timer thread. Other clocks are driven by poll().
+   */
+  explicit ScheduledExecutor(Executor* executor, Clock* clock = nullptr);
+
+  /// Cancels all timers. The tasks already posted still run.
+  ~ScheduledExecutor();
+
+  /// Runs `func()` once, `delay` seconds from now.
+  template <typename F>
+  TimerId run_after(double delay, F&& func) {
+    return schedule(Task(std::forward<F>(func)), delay, 0, false);
+  }
+
+  /**
+   * \brief Runs `func()` every `period` seconds, starting `initial_delay`
+   * seconds from now.
+   *
+   * The runs are aligned on the initial schedule. The periods missed while
+   * a run was late are skipped rather than run back to back.
+   */
+  template <typename F>
+  TimerId run_at_fixed_rate(double initial_delay, double period, F&& func) {
+    return schedule(Task(std::forward<F>(func)), initial_delay, period,
+                    true);
+  }
+
+  /// Runs `func()` `initial_delay` seconds from now, then `delay` seconds
+  /// after each run completes.
+  template <typename F>
+  TimerId run_with_fixed_delay(double initial_delay, double delay,
+                               F&& func) {
+    return schedule(Task(std::forward<F>(func)), initial_delay, delay,
+                    false);
+  }
+
+  /**
+   * \brief Cancels a timer.
+   * \return true if the timer was pending. A periodic task that is running
+   * finishes its current run, but is not re-armed.
+   */
+  bool cancel(TimerId id);
+
+  /// Posts the due timers to the executor, and returns their number.
+  size_t poll();
+
+  /// Returns the number of timers, including the running periodic ones.
+  size_t num_timers() const;
+
+ private:
+  /// The state shared with the posted periodic tasks, which re-arm their
+  /// timers after running.
+  class State;
+
+  TimerId schedule(Task task, double delay, double period, bool fixed_rate);
+
+  std::shared_ptr<State> state_;
+
+  std::thread thread_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_SCHEDULED_EXECUTOR_H_
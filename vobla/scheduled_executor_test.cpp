@@ -0,0 +1,145 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <future>
+#include <vector>
+#include "vobla/clock.h"
+#include "vobla/scheduled_executor.h"
+#include "vobla/thread_pool.h"
+
+using std::vector;
+
+namespace vobla {
+
+namespace {
+
+/// Runs the tasks in the calling thread.
+class InlineExecutor : public Executor {
+ public:
+  virtual void execute(Task task) {
+    task();
+  }
+};
+
+}  // namespace
+
+TEST(ScheduledExecutorTest, TestRunAfter) {
+  FakeClock clock;
+  InlineExecutor executor;
+  ScheduledExecutor timers(&executor, &clock);
+  vector<int> fired;
+  timers.run_after(3, [&fired] { fired.push_back(3); });
+  timers.run_after(1, [&fired] { fired.push_back(1); });
+  timers.run_after(2, [&fired] { fired.push_back(2); });
+  timers.run_after(2, [&fired] { fired.push_back(22); });
+  EXPECT_EQ(4u, timers.num_timers());
+
+  EXPECT_EQ(0u, timers.poll());
+  clock.advance(1);
+  EXPECT_EQ(1u, timers.poll());
+  clock.advance(5);
+  EXPECT_EQ(3u, timers.poll());
+  EXPECT_EQ((vector<int>{1, 2, 22, 3}), fired);
+  EXPECT_EQ(0u, timers.num_timers());
+}
+
+TEST(ScheduledExecutorTest, TestCancel) {
+  FakeClock clock;
+  InlineExecutor executor;
+  ScheduledExecutor timers(&executor, &clock);
+  vector<int> fired;
+  vector<ScheduledExecutor::TimerId> ids;
+  for (int i = 0; i < 10; i++) {
+    ids.push_back(timers.run_after(i, [&fired, i] { fired.push_back(i); }));
+  }
+  for (int i = 0; i < 10; i += 3) {
+    EXPECT_TRUE(timers.cancel(ids[i]));
+  }
+  EXPECT_FALSE(timers.cancel(ids[0]));
+  EXPECT_FALSE(timers.cancel(12345));
+  clock.advance(10);
+  timers.poll();
+  EXPECT_EQ((vector<int>{1, 2, 4, 5, 7, 8}), fired);
+}
+
+TEST(ScheduledExecutorTest, TestFixedRate) {
+  FakeClock clock;
+  InlineExecutor executor;
+  ScheduledExecutor timers(&executor, &clock);
+  vector<double> runs;
+  auto id = timers.run_at_fixed_rate(1, 1, [&runs, &clock] {
+      runs.push_back(clock.now());
+      // Takes some time.
+      clock.advance(0.5);
+    });
+  while (clock.now() < 4) {
+    clock.advance(0.25);
+    timers.poll();
+  }
+  EXPECT_EQ((vector<double>{1, 2, 3, 4}), runs);
+
+  // The missed periods are skipped: the next run is at 16.
+  clock.advance(10.25);
+  EXPECT_EQ(1u, timers.poll());
+  EXPECT_EQ(0u, timers.poll());
+  clock.advance(0.75);
+  EXPECT_EQ(1u, timers.poll());
+  EXPECT_EQ(1u, timers.num_timers());
+  EXPECT_TRUE(timers.cancel(id));
+  clock.advance(10);
+  EXPECT_EQ(0u, timers.poll());
+}
+
+TEST(ScheduledExecutorTest, TestFixedDelay) {
+  FakeClock clock;
+  InlineExecutor executor;
+  ScheduledExecutor timers(&executor, &clock);
+  vector<double> runs;
+  timers.run_with_fixed_delay(1, 1, [&runs, &clock] {
+      runs.push_back(clock.now());
+      clock.advance(0.5);
+    });
+  while (clock.now() < 4) {
+    clock.advance(0.25);
+    timers.poll();
+  }
+  // Each run starts 1 second after the previous one ended.
+  EXPECT_EQ((vector<double>{1, 2.5, 4}), runs);
+}
+
+TEST(ScheduledExecutorTest, TestTimerThread) {
+  ThreadPool pool(2);
+  ScheduledExecutor timers(&pool);
+  std::promise<void> once;
+  timers.run_after(0.01, [&once] { once.set_value(); });
+  EXPECT_EQ(std::future_status::ready,
+            once.get_future().wait_for(std::chrono::seconds(10)));
+
+  std::atomic<int> count(0);
+  std::promise<void> three;
+  auto id = timers.run_at_fixed_rate(0, 0.001, [&count, &three] {
+      if (++count == 3) {
+        three.set_value();
+      }
+    });
+  EXPECT_EQ(std::future_status::ready,
+            three.get_future().wait_for(std::chrono::seconds(10)));
+  EXPECT_TRUE(timers.cancel(id));
+}
+
+}  // namespace vobla
@@ -0,0 +1,903 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/sharded_lru_cache.h
+ * \brief A thread-safe LRU cache with single-flight loading.
+ */
+
+#ifndef VOBLA_SHARDED_LRU_CACHE_H_
+#define VOBLA_SHARDED_LRU_CACHE_H_
+
+#include <boost/utility.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "vobla/cache_snapshot.h"
+#include "vobla/cache_stats.h"
+#include "vobla/clock.h"
+#include "vobla/lru_cache.h"
+#include "vobla/status.h"
+#include "vobla/task.h"
+#include "vobla/thread_pool.h"
+
+namespace vobla {
+
+/**
+ * \class ShardedLRUCache vobla/sharded_lru_cache.h
+ * \brief A thread-safe LRU cache that partitions the keys over a number of
+ * independently locked LRUCache shards.
+ *
+ * Values are handed out as `std::shared_ptr`, so a value that is evicted or
+ * refreshed stays valid for the callers that still hold it.
+ *
+ * get_or_load() coalesces the concurrent misses on the same key into one
+ * call of the loader. The loader runs on the given ThreadPool (or in the
+ * first missing thread if there is no pool, or if its queue is full), and
+ * all callers wait on the same shared future. A value written or erased
+ * while it is being loaded is not overwritten by the loaded value.
+ *
+ * With set_expiration(), entries expire `ttl` seconds after being loaded.
+ * Entries accessed within the last `refresh_ahead` seconds of their lifetime
+ * are reloaded in background on the ThreadPool, while the old value is
+ * still served. If the queue of the pool is full, the refresh is skipped
+ * and retried by a later access, so that a hit never waits for the loader.
+ *
+ * With set_negative_caching(), the keys whose loader returns -ENOENT are
+ * remembered as absent for a short TTL, so that repeated lookups of
+ * nonexistent keys do not reach the backing store. The absent keys are
+ * kept apart from the values and do not evict them.
+ *
+ * find_many() and insert_many() process a batch of keys, hashing each key
+ * once and taking each shard lock once per batch.
+ *
+ * Usage:
+ * ~~~~~~~~~{cpp}
+ * ShardedLRUCache<string, Inode> cache(10000, 16, &pool);
+ * ShardedLRUCache<string, Inode>::pointer_type inode;
+ * Status status = cache.get_or_load(path,
+ *     [](const string& path, std::shared_ptr<Inode>* inode) {
+ *       return read_inode(path, inode);
+ *     }, &inode);
+ * ~~~~~~~~~
+ *
+ * save_snapshot() and load_snapshot() persist the keys (and optionally the
+ * values) in recency order, so that a restarted process can warm up its
+ * cache with the hottest entries first.
+ *
+ * The `Stats` policy decides what statistics are recorded. With the default
+ * NullCacheStats nothing is recorded; with CacheStats each shard counts
+ * into its own slot while holding its lock, see stats_snapshot().
+ *
+ * \note get_or_load() blocks until the load finishes. Calling it from a task
+ * running on the same ThreadPool might dead-lock if all workers wait.
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename Stats = NullCacheStats>
+class ShardedLRUCache : boost::noncopyable {
+ public:
+  typedef Key key_type;
+
+  typedef Value value_type;
+
+  typedef std::shared_ptr<Value> pointer_type;
+
+  /// Loads the value of the given key. Returns non-OK status on failure.
+  typedef std::function<Status(const Key&, pointer_type*)> LoaderType;
+
+  typedef std::shared_future<Status> FutureType;
+
+  /// Serializes a value into bytes for save_snapshot().
+  typedef std::function<Status(const Value&, std::string*)> SerializerType;
+
+  /**
+   * \brief Rebuilds the value of a key for load_snapshot(), from the bytes
+   * written by SerializerType, or from an empty string if the snapshot does
+   * not store values.
+   */
+  typedef std::function<Status(const Key&, const std::string&,
+                               pointer_type*)> DeserializerType;
+
+  /// Returns the charge (e.g., the size in bytes) of a value for the stats.
+  typedef std::function<size_t(const Key&, const pointer_type&)> ChargerType;
+
+  /// The number of entries save_snapshot() copies per shard lock.
+  static const size_t kSnapshotBatch = 256;
+
+  /**
+   * \brief Constructs a cache holding up to `capacity` values.
+   * \param capacity the total capacity, split over the shards so that the
+   * cache never holds more than `capacity` values.
+   * \param num_shards the number of independently locked shards, at most
+   * `capacity`.
+   * \param pool the thread pool to run the loaders. If it is nullptr, the
+   * loader runs in the first thread that misses the key.
+   * \param clock the clock to measure expiration, defaults to the real clock.
+   */
+  explicit ShardedLRUCache(size_t capacity, size_t num_shards = 16,
+                           ThreadPool* pool = nullptr,
+                           Clock* clock = nullptr)
+      : capacity_(capacity), pool_(pool),
+        clock_(clock ? clock : Clock::real_clock()) {
+    num_shards = std::max<size_t>(1, std::min(num_shards, capacity));
+    // The first `capacity % num_shards` shards take one more value.
+    for (size_t i = 0; i < num_shards; ++i) {
+      size_t shard_capacity = capacity / num_shards +
+          (i < capacity % num_shards ? 1 : 0);
+      shards_.emplace_back(new Shard(i, std::max<size_t>(1, shard_capacity)));
+    }
+    stats_.resize(num_shards);
+  }
+
+  /// Waits for the in-flight loads and releases all entries.
+  ~ShardedLRUCache() {
+    for (auto& shard : shards_) {
+      std::vector<FutureType> futures;
+      {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (const auto& key_and_load : shard->loads) {
+          futures.push_back(key_and_load.second->future);
+        }
+      }
+      for (auto& future : futures) {
+        future.wait();
+      }
+    }
+    clear();
+  }
+
+  /**
+   * \brief Sets the expiration policy.
+   * \param ttl the seconds an entry lives after being loaded. 0 means the
+   * entries never expire.
+   * \param refresh_ahead the entries that are accessed within the last
+   * `refresh_ahead` seconds of their lifetime are reloaded in background.
+   * It requires a ThreadPool.
+   */
+  void set_expiration(double ttl, double refresh_ahead = 0) {
+    ttl_ = ttl;
+    refresh_ahead_ = refresh_ahead;
+  }
+
+  /**
+   * \brief Enables negative caching.
+   * \param ttl the seconds a key is known to be absent. 0 disables it.
+   * \param capacity the maximal number of absent keys, evenly split over the
+   * shards. The oldest absent keys are dropped first.
+   */
+  void set_negative_caching(double ttl, size_t capacity) {
+    negative_ttl_ = ttl;
+    negative_capacity_ = std::max<size_t>(
+        1, (capacity + shards_.size() - 1) / shards_.size());
+  }
+
+  /**
+   * \brief Sets the function that measures the charge of the values in the
+   * stats. By default each value is charged `sizeof(Key) + sizeof(Value)`.
+   */
+  void set_charger(const ChargerType& charger) {
+    charger_ = charger;
+  }
+
+  /// Returns the statistics policy, e.g., to configure it.
+  Stats* stats() {
+    return &stats_;
+  }
+
+  /// Returns the statistics summed up over all shards.
+  CacheStatsSnapshot stats_snapshot() {
+    return stats_.snapshot(clock_->now());
+  }
+
+  /// Returns the total capacity.
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  /// Returns the number of the shards.
+  size_t num_shards() const {
+    return shards_.size();
+  }
+
+  /// Returns the number of cached values.
+  size_t size() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      total += shard->lru.size();
+    }
+    return total;
+  }
+
+  /**
+   * \brief Finds the value of a key and marks it as recently used.
+   * \return false if the key is not cached or has expired.
+   */
+  bool find(const Key& key, pointer_type* value) {
+    Shard* shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    Entry* entry = shard->lru.find(key);
+    if (!entry || expired(*entry)) {
+      stats_.record_miss(shard->index);
+      return false;
+    }
+    stats_.record_hit(shard->index);
+    use_locked(shard, key);
+    *value = entry->value;
+    return true;
+  }
+
+  /// Inserts a value, replacing the existing value of the same key.
+  void insert(const Key& key, pointer_type value) {
+    Shard* shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    insert_locked(shard, key, std::move(value));
+  }
+
+  /**
+   * \brief Finds the values of a batch of keys.
+   * \param[in] keys the keys to look up.
+   * \param[out] values the values in the same order as the keys, nullptr for
+   * the keys that are not cached.
+   * \return the number of the keys found.
+   */
+  size_t find_many(const std::vector<Key>& keys,
+                   std::vector<pointer_type>* values) {
+    values->assign(keys.size(), pointer_type());
+    std::vector<size_t> order;
+    std::vector<size_t> offsets;
+    group_by_shard(keys.size(), [&keys](size_t i) -> const Key& {
+        return keys[i];
+      }, &order, &offsets);
+    double now = ttl_ > 0 ? clock_->now() : 0;
+    size_t found = 0;
+    for (size_t s = 0; s < shards_.size(); ++s) {
+      if (offsets[s] == offsets[s + 1]) {
+        continue;
+      }
+      Shard* shard = shards_[s].get();
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      for (size_t i = offsets[s]; i < offsets[s + 1]; ++i) {
+        const Key& key = keys[order[i]];
+        Entry* entry = shard->lru.find(key);
+        if (!entry || expired(*entry, now)) {
+          stats_.record_miss(shard->index);
+          continue;
+        }
+        stats_.record_hit(shard->index);
+        use_locked(shard, key);
+        (*values)[order[i]] = entry->value;
+        found++;
+      }
+    }
+    return found;
+  }
+
+  /// Inserts a batch of values, replacing the existing values.
+  void insert_many(const std::vector<std::pair<Key, pointer_type>>& items) {
+    std::vector<size_t> order;
+    std::vector<size_t> offsets;
+    group_by_shard(items.size(), [&items](size_t i) -> const Key& {
+        return items[i].first;
+      }, &order, &offsets);
+    for (size_t s = 0; s < shards_.size(); ++s) {
+      if (offsets[s] == offsets[s + 1]) {
+        continue;
+      }
+      Shard* shard = shards_[s].get();
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      for (size_t i = offsets[s]; i < offsets[s + 1]; ++i) {
+        const auto& item = items[order[i]];
+        insert_locked(shard, item.first, item.second);
+      }
+    }
+  }
+
+  /// Marks a key as absent. It requires set_negative_caching().
+  void insert_absent(const Key& key) {
+    if (negative_ttl_ <= 0) {
+      return;
+    }
+    Shard* shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    mark_absent_locked(shard, key, clock_->now());
+  }
+
+  /// Returns true if the key is known to be absent.
+  bool known_absent(const Key& key) {
+    if (negative_ttl_ <= 0) {
+      return false;
+    }
+    Shard* shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    return known_absent_locked(shard, key, clock_->now());
+  }
+
+  /// Removes a key. Returns false if the key does not exist.
+  bool erase(const Key& key) {
+    Shard* shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    supersede_load_locked(shard, key);
+    if (Stats::kEnabled) {
+      Entry* entry = shard->lru.find(key);
+      if (entry) {
+        stats_.record_remove(shard->index, *entry);
+      }
+    }
+    move_cursor_off_locked(shard, key);
+    return shard->lru.remove(key);
+  }
+
+  /// Removes all values.
+  void clear() {
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      if (Stats::kEnabled) {
+        Stats* stats = &stats_;
+        size_t index = shard->index;
+        shard->lru.for_each([stats, index](const Entry* entry) {
+            stats->record_remove(index, *entry);
+          });
+      }
+      shard->snapshot_cursor = nullptr;
+      shard->lru.clear();
+      shard->absent.clear();
+      shard->absent_order.clear();
+      for (auto& key_and_load : shard->loads) {
+        key_and_load.second->superseded = true;
+      }
+    }
+  }
+
+  /**
+   * \brief Returns the value of a key, loading it with `loader` on a miss.
+   *
+   * Concurrent calls that miss the same key share one load. The loaded
+   * value is inserted into the cache before the waiters are woken up.
+   *
+   * \param[in] key the key to look up.
+   * \param[in] loader loads the value if the key is not cached.
+   * \param[out] value the cached or the loaded value.
+   * \return the status returned by the loader, OK on a cache hit, or
+   * -ENOENT if the key is known to be absent. If the loader throws, the
+   * exception is rethrown to all callers sharing the load.
+   */
+  Status get_or_load(const Key& key, const LoaderType& loader,
+                     pointer_type* value) {
+    Shard* shard = shard_of(key);
+    std::shared_ptr<Load> load;
+    bool leader = false;
+    bool hit = false;
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      Entry* entry = shard->lru.find(key);
+      if (entry && !expired(*entry)) {
+        stats_.record_hit(shard->index);
+        use_locked(shard, key);
+        *value = entry->value;
+        if (!pool_ || !should_refresh(*entry)) {
+          return Status::OK;
+        }
+        hit = true;
+      } else if (negative_ttl_ > 0 &&
+                 known_absent_locked(shard, key, clock_->now())) {
+        stats_.record_hit(shard->index);
+        return Status(-ENOENT, "The key is known to be absent.");
+      } else {
+        stats_.record_miss(shard->index);
+      }
+      load = start_load_locked(shard, key, &leader);
+    }
+    if (leader) {
+      dispatch_load(shard, key, loader, load, hit);
+    }
+    if (hit) {
+      return Status::OK;
+    }
+    Status status = load->future.get();
+    if (status.ok()) {
+      *value = load->value;
+    }
+    return status;
+  }
+
+  /**
+   * \brief Writes the cached keys, from the hottest to the coldest, into a
+   * snapshot file.
+   *
+   * The shards are walked from their most recent entries, kSnapshotBatch
+   * entries at a time, and the shards take turns so that the file is
+   * roughly ordered by recency. Each batch is written before the next one
+   * is taken, and the shard lock is only held while a batch is copied, so
+   * lookups keep going and the memory stays bounded. The entries inserted
+   * or moved to the front while the snapshot is being written might be
+   * left out. The calls are serialized.
+   *
+   * \param path the path of the snapshot file.
+   * \param serializer serializes the values. If it is empty, only the keys
+   * are stored.
+   */
+  Status save_snapshot(const std::string& path,
+                       const SerializerType& serializer = nullptr) const {
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    CacheSnapshotWriter writer(path, static_cast<bool>(serializer));
+    auto status = writer.open();
+    if (!status.ok()) {
+      return status;
+    }
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->snapshot_cursor = shard->lru.most_recent();
+    }
+    status = write_snapshot(serializer, &writer);
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->snapshot_cursor = nullptr;
+    }
+    if (!status.ok()) {
+      return status;
+    }
+    return writer.close();
+  }
+
+  /**
+   * \brief Loads the entries of a snapshot, hottest first.
+   *
+   * The loaded entries are placed behind the existing entries in the LRU
+   * order. Keys that are already cached, or whose value can not be rebuilt
+   * by the deserializer, are skipped. Once a shard is full, the remaining
+   * (colder) entries of that shard are skipped.
+   *
+   * \param[in] path the path of the snapshot file.
+   * \param[in] deserializer rebuilds the values.
+   * \param[out] num_loaded optional, the number of loaded entries.
+   */
+  Status load_snapshot(const std::string& path,
+                       const DeserializerType& deserializer,
+                       size_t* num_loaded = nullptr) {
+    CacheSnapshotReader reader(path);
+    auto status = reader.open();
+    if (!status.ok()) {
+      return status;
+    }
+    size_t loaded = 0;
+    std::string key_buf;
+    std::string value_buf;
+    bool eof = false;
+    while (true) {
+      status = reader.next(&key_buf, &value_buf, &eof);
+      if (!status.ok() || eof) {
+        break;
+      }
+      Key key;
+      if (!SnapshotKeyCodec<Key>::decode(key_buf, &key)) {
+        status = Status(-EINVAL, "Failed to decode a key of the snapshot.");
+        break;
+      }
+      Shard* shard = shard_of(key);
+      {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        if (shard->lru.full() || shard->lru.find(key)) {
+          continue;
+        }
+      }
+      pointer_type value;
+      if (!deserializer(key, value_buf, &value).ok()) {
+        continue;
+      }
+      double now = ttl_ > 0 ? clock_->now() : 0;
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      if (shard->lru.full() || shard->lru.find(key)) {
+        continue;
+      }
+      Entry* entry = new Entry(key, std::move(value), now);
+      record_insert(shard, entry);
+      shard->lru.insert_least_recent(key, entry);
+      loaded++;
+    }
+    if (num_loaded) {
+      *num_loaded = loaded;
+    }
+    return status;
+  }
+
+ private:
+  /// A cached value, the time when it was loaded and its stats stamp.
+  class Entry : public LRUCacheItem<Key>, public Stats::Stamp {
+   public:
+    Entry(const Key& k, pointer_type v, double t)
+        : key(k), value(std::move(v)), loaded_at(t) {}
+
+    Key cache_key() const { return key; }
+
+    Key key;
+
+    pointer_type value;
+
+    double loaded_at;
+  };
+
+  /// An in-flight load shared by all callers missing the same key.
+  struct Load {
+    std::promise<Status> promise;
+
+    FutureType future;
+
+    pointer_type value;
+
+    /// Set, under the shard lock, when the key is written or erased during
+    /// the load, so that the loaded value is not cached over it.
+    bool superseded = false;
+  };
+
+  typedef std::list<Entry*> lru_list_type;
+
+  typedef LRUCache<Entry, Key, 1024, lru_list_type,
+          std::unordered_map<Key, typename lru_list_type::iterator, Hash>>
+          lru_type;
+
+  struct Shard {
+    Shard(size_t i, size_t cap) : index(i), lru(cap) {}
+
+    ~Shard() {
+      lru.clear();
+    }
+
+    /// The index of the shard, also its slot in the stats.
+    size_t index;
+
+    std::mutex mutex;
+
+    lru_type lru;
+
+    std::unordered_map<Key, std::shared_ptr<Load>, Hash> loads;
+
+    /// The next entry that save_snapshot() writes, if it is running. It is
+    /// moved off the entries that leave their place in the LRU list.
+    Entry* snapshot_cursor = nullptr;
+
+    /// The keys known to be absent and when they expire.
+    std::unordered_map<Key, double, Hash> absent;
+
+    /// The absent keys in the order of expiration, which is also the order
+    /// of insertion since they share one TTL.
+    std::deque<std::pair<Key, double>> absent_order;
+  };
+
+  size_t shard_index(const Key& key) const {
+    size_t hash = hasher_(key);
+    // Mixes the bits so that the shard index does not correlate with the
+    // bucket index used by the unordered_map inside of the shard.
+    hash ^= hash >> 17;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 29;
+    return hash % shards_.size();
+  }
+
+  Shard* shard_of(const Key& key) const {
+    return shards_[shard_index(key)].get();
+  }
+
+  /**
+   * \brief Sorts the indices [0, n) of a batch by their shards (counting
+   * sort), so that each shard is locked once.
+   *
+   * The indices of the keys in shard `s` are `order[offsets[s]]` to
+   * `order[offsets[s + 1] - 1]`.
+   */
+  template <typename GetKey>
+  void group_by_shard(size_t n, GetKey get_key, std::vector<size_t>* order,
+                      std::vector<size_t>* offsets) const {
+    std::vector<size_t> shard_of_item(n);
+    offsets->assign(shards_.size() + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+      shard_of_item[i] = shard_index(get_key(i));
+      (*offsets)[shard_of_item[i] + 1]++;
+    }
+    for (size_t s = 0; s < shards_.size(); ++s) {
+      (*offsets)[s + 1] += (*offsets)[s];
+    }
+    order->resize(n);
+    std::vector<size_t> next(offsets->begin(), offsets->end() - 1);
+    for (size_t i = 0; i < n; ++i) {
+      (*order)[next[shard_of_item[i]]++] = i;
+    }
+  }
+
+  bool expired(const Entry& entry) const {
+    return ttl_ > 0 && clock_->now() - entry.loaded_at >= ttl_;
+  }
+
+  bool expired(const Entry& entry, double now) const {
+    return ttl_ > 0 && now - entry.loaded_at >= ttl_;
+  }
+
+  /// Drops the absent keys that have expired.
+  void purge_absent_locked(Shard* shard, double now) {
+    auto& order = shard->absent_order;
+    while (!order.empty() && order.front().second <= now) {
+      auto it = shard->absent.find(order.front().first);
+      // The key might have been inserted and marked absent again since.
+      if (it != shard->absent.end() && it->second == order.front().second) {
+        shard->absent.erase(it);
+      }
+      order.pop_front();
+    }
+  }
+
+  bool known_absent_locked(Shard* shard, const Key& key, double now) {
+    if (shard->absent.empty()) {
+      return false;
+    }
+    purge_absent_locked(shard, now);
+    return shard->absent.count(key);
+  }
+
+  void mark_absent_locked(Shard* shard, const Key& key, double now) {
+    supersede_load_locked(shard, key);
+    purge_absent_locked(shard, now);
+    if (shard->absent.count(key)) {
+      return;
+    }
+    auto& order = shard->absent_order;
+    while (shard->absent.size() >= negative_capacity_ && !order.empty()) {
+      auto it = shard->absent.find(order.front().first);
+      if (it != shard->absent.end() && it->second == order.front().second) {
+        shard->absent.erase(it);
+      }
+      order.pop_front();
+    }
+    double expire_at = now + negative_ttl_;
+    shard->absent[key] = expire_at;
+    order.push_back(std::make_pair(key, expire_at));
+  }
+
+  bool should_refresh(const Entry& entry) const {
+    return ttl_ > 0 && refresh_ahead_ > 0 &&
+        clock_->now() - entry.loaded_at >= ttl_ - refresh_ahead_;
+  }
+
+  /// Keeps the in-flight load of a key, if any, from caching its value.
+  void supersede_load_locked(Shard* shard, const Key& key) {
+    if (shard->loads.empty()) {
+      return;
+    }
+    auto it = shard->loads.find(key);
+    if (it != shard->loads.end()) {
+      it->second->superseded = true;
+    }
+  }
+
+  /// Moves the snapshot cursor to the next entry if it is on `key`, which
+  /// is about to leave its place in the LRU list.
+  void move_cursor_off_locked(Shard* shard, const Key& key) {
+    Entry* cursor = shard->snapshot_cursor;
+    if (cursor && cursor->key == key) {
+      shard->snapshot_cursor = shard->lru.older(key);
+    }
+  }
+
+  /// Marks a cached key as the most recently used.
+  void use_locked(Shard* shard, const Key& key) {
+    move_cursor_off_locked(shard, key);
+    shard->lru.use(key);
+  }
+
+  void insert_locked(Shard* shard, const Key& key, pointer_type value) {
+    supersede_load_locked(shard, key);
+    if (!shard->absent.empty()) {
+      shard->absent.erase(key);
+    }
+    double now = ttl_ > 0 ? clock_->now() : 0;
+    Entry* entry = shard->lru.find(key);
+    if (entry) {
+      stats_.record_remove(shard->index, *entry);
+      entry->value = std::move(value);
+      entry->loaded_at = now;
+      record_insert(shard, entry);
+      use_locked(shard, key);
+      return;
+    }
+    if (shard->lru.full()) {
+      Entry* victim = shard->lru.victim();
+      if (victim == shard->snapshot_cursor) {
+        // The victim is the least recent entry, the last one to write.
+        shard->snapshot_cursor = nullptr;
+      }
+      if (victim) {
+        stats_.record_eviction(shard->index, *victim, clock_);
+        delete victim;
+      }
+    }
+    entry = new Entry(key, std::move(value), now);
+    record_insert(shard, entry);
+    shard->lru.insert(key, entry);
+  }
+
+  /// Writes the batches of entries from the snapshot cursors of the shards.
+  Status write_snapshot(const SerializerType& serializer,
+                        CacheSnapshotWriter* writer) const {
+    std::vector<std::pair<Key, pointer_type>> batch;
+    batch.reserve(kSnapshotBatch);
+    std::string key_buf;
+    std::string value_buf;
+    bool more = true;
+    while (more) {
+      more = false;
+      for (auto& shard : shards_) {
+        batch.clear();
+        {
+          std::lock_guard<std::mutex> lock(shard->mutex);
+          Entry* entry = shard->snapshot_cursor;
+          while (entry && batch.size() < kSnapshotBatch) {
+            batch.emplace_back(entry->key, entry->value);
+            entry = shard->lru.older(entry->key);
+          }
+          shard->snapshot_cursor = entry;
+          more = more || entry != nullptr;
+        }
+        for (const auto& item : batch) {
+          SnapshotKeyCodec<Key>::encode(item.first, &key_buf);
+          if (serializer) {
+            auto status = serializer(*item.second, &value_buf);
+            if (!status.ok()) {
+              return status;
+            }
+          }
+          auto status = writer->append(key_buf, value_buf);
+          if (!status.ok()) {
+            return status;
+          }
+        }
+      }
+    }
+    return Status::OK;
+  }
+
+  void record_insert(Shard* shard, Entry* entry) {
+    if (Stats::kEnabled) {
+      size_t charge = charger_ ? charger_(entry->key, entry->value)
+          : sizeof(Key) + sizeof(Value);
+      stats_.record_insert(shard->index, charge, clock_, entry);
+    }
+  }
+
+  /**
+   * \brief Returns the in-flight load of the key, or creates a new one.
+   *
+   * If a new load is created, `*leader` is set to true, and the caller must
+   * pass it to dispatch_load() after releasing the shard lock.
+   */
+  std::shared_ptr<Load> start_load_locked(Shard* shard, const Key& key,
+                                          bool* leader) {
+    auto it = shard->loads.find(key);
+    if (it != shard->loads.end()) {
+      return it->second;
+    }
+    std::shared_ptr<Load> load(new Load);
+    load->future = load->promise.get_future().share();
+    shard->loads[key] = load;
+    *leader = true;
+    return load;
+  }
+
+  /**
+   * \brief Runs a new load on the pool, or in the calling thread if there
+   * is no pool or its queue is full.
+   *
+   * A refresh-ahead (`refresh` is true) is abandoned instead of running in
+   * the calling thread, as long as the cached value is still fresh: the
+   * waiters that joined the load get that value.
+   */
+  void dispatch_load(Shard* shard, const Key& key, const LoaderType& loader,
+                     std::shared_ptr<Load> load, bool refresh) {
+    if (pool_ && pool_->try_execute(Task(std::bind(
+            &ShardedLRUCache::run_load, this, shard, key, loader, load)))
+        .ok()) {
+      return;
+    }
+    if (refresh) {
+      pointer_type value;
+      {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        Entry* entry = shard->lru.find(key);
+        if (entry && !expired(*entry)) {
+          shard->loads.erase(key);
+          value = entry->value;
+        }
+      }
+      if (value) {
+        load->value = std::move(value);
+        load->promise.set_value(Status::OK);
+        return;
+      }
+    }
+    run_load(shard, key, loader, std::move(load));
+  }
+
+  /// Calls the loader, publishes the value and wakes up the waiters.
+  void run_load(Shard* shard, const Key& key, const LoaderType& loader,
+                std::shared_ptr<Load> load) {
+    pointer_type value;
+    Status status;
+    std::exception_ptr error;
+    try {
+      status = loader(key, &value);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->loads.erase(key);
+      if (!error && !load->superseded) {
+        if (status.ok()) {
+          insert_locked(shard, key, value);
+        } else if (status.error() == -ENOENT && negative_ttl_ > 0) {
+          mark_absent_locked(shard, key, clock_->now());
+        }
+      }
+    }
+    if (error) {
+      load->promise.set_exception(error);
+      return;
+    }
+    load->value = std::move(value);
+    load->promise.set_value(status);
+  }
+
+  size_t capacity_;
+
+  ThreadPool* pool_;
+
+  Clock* clock_;
+
+  double ttl_ = 0;
+
+  double refresh_ahead_ = 0;
+
+  double negative_ttl_ = 0;
+
+  size_t negative_capacity_ = 0;
+
+  Hash hasher_;
+
+  ChargerType charger_;
+
+  Stats stats_;
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  /// Serializes save_snapshot(), which owns the cursors of the shards.
+  mutable std::mutex snapshot_mutex_;
+};
+
+template <typename Key, typename Value, typename Hash, typename Stats>
+const size_t ShardedLRUCache<Key, Value, Hash, Stats>::kSnapshotBatch;
+
+}  // namespace vobla
+
+#endif  // VOBLA_SHARDED_LRU_CACHE_H_
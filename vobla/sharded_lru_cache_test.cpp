@@ -0,0 +1,425 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "vobla/clock.h"
+#include "vobla/sharded_lru_cache.h"
+#include "vobla/status.h"
+#include "vobla/thread_pool.h"
+
+using std::string;
+using std::vector;
+
+namespace vobla {
+
+typedef ShardedLRUCache<int, string> cache_type;
+
+TEST(ShardedLRUCacheTest, TestInsertAndFind) {
+  cache_type cache(64, 4);
+  EXPECT_EQ(4u, cache.num_shards());
+  for (int i = 0; i < 32; i++) {
+    cache.insert(i, std::make_shared<string>(std::to_string(i)));
+  }
+  EXPECT_EQ(32u, cache.size());
+
+  cache_type::pointer_type value;
+  EXPECT_TRUE(cache.find(5, &value));
+  EXPECT_EQ("5", *value);
+  EXPECT_FALSE(cache.find(100, &value));
+
+  cache.insert(5, std::make_shared<string>("five"));
+  EXPECT_TRUE(cache.find(5, &value));
+  EXPECT_EQ("five", *value);
+  EXPECT_EQ(32u, cache.size());
+
+  EXPECT_TRUE(cache.erase(5));
+  EXPECT_FALSE(cache.erase(5));
+  EXPECT_FALSE(cache.find(5, &value));
+  // The value is still valid after being removed from the cache.
+  EXPECT_EQ("five", *value);
+}
+
+TEST(ShardedLRUCacheTest, TestEviction) {
+  cache_type cache(1, 1);
+  cache.insert(1, std::make_shared<string>("1"));
+  cache.insert(2, std::make_shared<string>("2"));
+  EXPECT_EQ(1u, cache.size());
+  cache_type::pointer_type value;
+  EXPECT_FALSE(cache.find(1, &value));
+  EXPECT_TRUE(cache.find(2, &value));
+}
+
+TEST(ShardedLRUCacheTest, TestSizeNeverExceedsCapacity) {
+  for (size_t capacity : {3, 10, 100, 1000}) {
+    cache_type cache(capacity, 16);
+    EXPECT_EQ(std::min<size_t>(capacity, 16), cache.num_shards());
+    for (int i = 0; i < 20000; i++) {
+      cache.insert(i, std::make_shared<string>("value"));
+      ASSERT_LE(cache.size(), capacity) << "capacity: " << capacity;
+    }
+    // Every shard is full by now.
+    EXPECT_EQ(capacity, cache.size());
+  }
+}
+
+TEST(ShardedLRUCacheTest, TestCoalesceConcurrentMisses) {
+  ThreadPool pool(2);
+  cache_type cache(128, 8, &pool);
+  std::atomic<int> num_loads(0);
+  auto loader = [&num_loads](const int& key, cache_type::pointer_type* value)
+      -> Status {
+    num_loads++;
+    usleep(50000);
+    value->reset(new string(std::to_string(key)));
+    return Status::OK;
+  };
+
+  vector<std::thread> threads;
+  vector<cache_type::pointer_type> results(16);
+  for (size_t i = 0; i < results.size(); i++) {
+    threads.emplace_back([&cache, &loader, &results, i] {
+        EXPECT_TRUE(cache.get_or_load(42, loader, &results[i]).ok());
+      });
+  }
+  for (auto& thd : threads) {
+    thd.join();
+  }
+  EXPECT_EQ(1, num_loads);
+  for (const auto& value : results) {
+    ASSERT_TRUE(value != nullptr);
+    EXPECT_EQ(results[0].get(), value.get());
+  }
+  cache_type::pointer_type value;
+  EXPECT_TRUE(cache.find(42, &value));
+  EXPECT_EQ("42", *value);
+}
+
+TEST(ShardedLRUCacheTest, TestLoadInCallerThread) {
+  cache_type cache(16);
+  int num_loads = 0;
+  auto loader = [&num_loads](const int& key, cache_type::pointer_type* value)
+      -> Status {
+    num_loads++;
+    value->reset(new string("value"));
+    return Status::OK;
+  };
+  cache_type::pointer_type value;
+  EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+  EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+  EXPECT_EQ(1, num_loads);
+  EXPECT_EQ("value", *value);
+}
+
+TEST(ShardedLRUCacheTest, TestLoadFailure) {
+  ThreadPool pool(2);
+  cache_type cache(16, 4, &pool);
+  int num_loads = 0;
+  auto loader = [&num_loads](const int& key, cache_type::pointer_type* value)
+      -> Status {
+    num_loads++;
+    return Status(-ENOENT, "Not found");
+  };
+  cache_type::pointer_type value;
+  EXPECT_EQ(-ENOENT, cache.get_or_load(1, loader, &value).error());
+  // Failures are not cached.
+  EXPECT_EQ(-ENOENT, cache.get_or_load(1, loader, &value).error());
+  EXPECT_EQ(2, num_loads);
+  EXPECT_EQ(0u, cache.size());
+}
+
+TEST(ShardedLRUCacheTest, TestLoaderThrows) {
+  ThreadPool pool(2);
+  for (ThreadPool* loader_pool : { static_cast<ThreadPool*>(nullptr),
+                                   &pool }) {
+    cache_type cache(16, 4, loader_pool);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    auto loader = [released](const int&, cache_type::pointer_type*)
+        -> Status {
+      released.wait();
+      throw std::runtime_error("failed");
+    };
+    // The callers sharing the load all get the exception.
+    vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+      threads.emplace_back([&cache, &loader] {
+          cache_type::pointer_type value;
+          EXPECT_THROW(cache.get_or_load(1, loader, &value),
+                       std::runtime_error);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release.set_value();
+    for (auto& thd : threads) {
+      thd.join();
+    }
+    // The failed load is gone, so the key can be loaded again.
+    cache_type::pointer_type value;
+    EXPECT_TRUE(cache.get_or_load(1, [](const int&,
+                                        cache_type::pointer_type* value) {
+          value->reset(new string("one"));
+          return Status::OK;
+        }, &value).ok());
+    EXPECT_EQ("one", *value);
+  }
+}
+
+TEST(ShardedLRUCacheTest, TestLoadInCallerThreadIfPoolIsFull) {
+  ThreadPool::Options options;
+  options.num_threads = 1;
+  options.queue_capacity = 1;
+  options.overflow = ThreadPool::Overflow::kReject;
+  ThreadPool pool(options);
+  std::promise<void> open;
+  std::shared_future<void> opened = open.get_future().share();
+  pool.post([opened] { opened.wait(); });
+  pool.post([] {});
+  while (pool.queue_depth() != 1) {
+    usleep(1000);
+  }
+
+  cache_type cache(16, 4, &pool);
+  auto caller = std::this_thread::get_id();
+  std::thread::id loaded_in;
+  cache_type::pointer_type value;
+  EXPECT_TRUE(cache.get_or_load(1, [&loaded_in](
+      const int&, cache_type::pointer_type* value) {
+        loaded_in = std::this_thread::get_id();
+        value->reset(new string("one"));
+        return Status::OK;
+      }, &value).ok());
+  EXPECT_EQ("one", *value);
+  EXPECT_EQ(caller, loaded_in);
+  open.set_value();
+}
+
+TEST(ShardedLRUCacheTest, TestLoadDoesNotOverwriteNewerWrites) {
+  ThreadPool pool(2);
+  cache_type cache(16, 4, &pool);
+  for (bool erase : { false, true }) {
+    std::promise<void> entered;
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    auto loader = [&entered, released](const int&,
+                                       cache_type::pointer_type* value)
+        -> Status {
+      entered.set_value();
+      released.wait();
+      value->reset(new string("loaded"));
+      return Status::OK;
+    };
+    cache_type::pointer_type loaded;
+    std::thread reader([&] {
+        EXPECT_TRUE(cache.get_or_load(1, loader, &loaded).ok());
+      });
+    entered.get_future().wait();
+    if (erase) {
+      cache.erase(1);
+    } else {
+      cache.insert(1, std::make_shared<string>("inserted"));
+    }
+    release.set_value();
+    reader.join();
+    // The waiters get the loaded value, while the cache keeps the write.
+    EXPECT_EQ("loaded", *loaded);
+    cache_type::pointer_type value;
+    if (erase) {
+      EXPECT_FALSE(cache.find(1, &value));
+    } else {
+      EXPECT_TRUE(cache.find(1, &value));
+      EXPECT_EQ("inserted", *value);
+      cache.erase(1);
+    }
+  }
+}
+
+TEST(ShardedLRUCacheTest, TestRefreshAhead) {
+  ThreadPool pool(2);
+  FakeClock clock(100);
+  cache_type cache(16, 4, &pool, &clock);
+  cache.set_expiration(10, 2);
+  std::atomic<int> version(0);
+  auto loader = [&version](const int& key, cache_type::pointer_type* value)
+      -> Status {
+    value->reset(new string(std::to_string(++version)));
+    return Status::OK;
+  };
+
+  cache_type::pointer_type value;
+  EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+  EXPECT_EQ("1", *value);
+
+  clock.advance(5);
+  EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+  EXPECT_EQ("1", *value);
+  EXPECT_EQ(1, version);
+
+  // Within the refresh-ahead window: serves the old value and reloads it in
+  // background.
+  clock.advance(4);
+  EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+  EXPECT_EQ("1", *value);
+  for (int i = 0; i < 500 && !(cache.find(1, &value) && *value == "2"); i++) {
+    usleep(10000);
+  }
+  EXPECT_EQ("2", *value);
+
+  // Expired: loads it again in the foreground.
+  clock.advance(20);
+  EXPECT_FALSE(cache.find(1, &value));
+  EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+  EXPECT_EQ("3", *value);
+}
+
+TEST(ShardedLRUCacheTest, TestSkipRefreshAheadIfPoolIsFull) {
+  ThreadPool::Options options;
+  options.num_threads = 1;
+  options.queue_capacity = 1;
+  options.overflow = ThreadPool::Overflow::kReject;
+  ThreadPool pool(options);
+  std::promise<void> open;
+  std::shared_future<void> opened = open.get_future().share();
+  pool.post([opened] { opened.wait(); });
+  pool.post([] {});
+  while (pool.queue_depth() != 1) {
+    usleep(1000);
+  }
+
+  FakeClock clock(100);
+  cache_type cache(16, 4, &pool, &clock);
+  cache.set_expiration(10, 2);
+  std::atomic<int> version(0);
+  auto loader = [&version](const int& key, cache_type::pointer_type* value)
+      -> Status {
+    value->reset(new string(std::to_string(++version)));
+    return Status::OK;
+  };
+  cache_type::pointer_type value;
+  EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+  EXPECT_EQ("1", *value);
+
+  // Within the refresh-ahead window, the hits do not run the loader.
+  clock.advance(9);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+    EXPECT_EQ("1", *value);
+  }
+  EXPECT_EQ(1, version);
+
+  // The next hit refreshes it once the pool has room.
+  open.set_value();
+  while (pool.queue_depth() > 0) {
+    usleep(1000);
+  }
+  EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+  for (int i = 0; i < 500 && !(cache.find(1, &value) && *value == "2"); i++) {
+    usleep(10000);
+  }
+  EXPECT_EQ("2", *value);
+}
+
+TEST(ShardedLRUCacheTest, TestFindManyAndInsertMany) {
+  cache_type cache(256, 8);
+  vector<std::pair<int, cache_type::pointer_type>> items;
+  for (int i = 0; i < 100; i += 2) {
+    items.push_back(std::make_pair(i, std::make_shared<string>(
+        std::to_string(i))));
+  }
+  cache.insert_many(items);
+  EXPECT_EQ(50u, cache.size());
+
+  vector<int> keys;
+  for (int i = 99; i >= 0; i--) {
+    keys.push_back(i);
+  }
+  vector<cache_type::pointer_type> values;
+  EXPECT_EQ(50u, cache.find_many(keys, &values));
+  ASSERT_EQ(keys.size(), values.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (keys[i] % 2) {
+      EXPECT_FALSE(values[i]);
+    } else {
+      ASSERT_TRUE(values[i]);
+      EXPECT_EQ(std::to_string(keys[i]), *values[i]);
+    }
+  }
+  EXPECT_EQ(0u, cache.find_many(vector<int>(), &values));
+  EXPECT_TRUE(values.empty());
+}
+
+TEST(ShardedLRUCacheTest, TestNegativeCaching) {
+  FakeClock clock(100);
+  cache_type cache(16, 2, nullptr, &clock);
+  cache.set_negative_caching(5, 2);
+  int num_loads = 0;
+  bool exists = false;
+  auto loader = [&num_loads, &exists](const int& key,
+                                      cache_type::pointer_type* value)
+      -> Status {
+    num_loads++;
+    if (!exists) {
+      return Status(-ENOENT, "Not found");
+    }
+    value->reset(new string(std::to_string(key)));
+    return Status::OK;
+  };
+  cache_type::pointer_type value;
+  EXPECT_EQ(-ENOENT, cache.get_or_load(1, loader, &value).error());
+  EXPECT_TRUE(cache.known_absent(1));
+  EXPECT_EQ(-ENOENT, cache.get_or_load(1, loader, &value).error());
+  EXPECT_EQ(1, num_loads);
+  EXPECT_EQ(0u, cache.size());
+
+  // The absent mark expires.
+  exists = true;
+  clock.advance(5);
+  EXPECT_FALSE(cache.known_absent(1));
+  EXPECT_TRUE(cache.get_or_load(1, loader, &value).ok());
+  EXPECT_EQ(2, num_loads);
+
+  // Inserting a value clears the absent mark.
+  cache.insert_absent(2);
+  EXPECT_TRUE(cache.known_absent(2));
+  cache.insert(2, std::make_shared<string>("2"));
+  EXPECT_FALSE(cache.known_absent(2));
+  EXPECT_TRUE(cache.get_or_load(2, loader, &value).ok());
+  EXPECT_EQ("2", *value);
+  EXPECT_EQ(2, num_loads);
+
+  // The oldest absent keys are dropped once the capacity is reached.
+  for (int i = 10; i < 20; i++) {
+    cache.insert_absent(i);
+  }
+  int num_absent = 0;
+  for (int i = 10; i < 20; i++) {
+    num_absent += cache.known_absent(i);
+  }
+  EXPECT_LE(num_absent, 2);
+  EXPECT_TRUE(cache.known_absent(19));
+}
+
+}  // namespace vobla
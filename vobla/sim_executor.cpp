@@ -0,0 +1,115 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/sim_executor.cpp
+ * \brief Implementation of SimExecutor.
+ */
+
+#include <algorithm>
+#include <utility>
+#include "vobla/sim_executor.h"
+
+namespace vobla {
+
+SimExecutor::SimExecutor(uint64_t seed, FakeClock* clock)
+    : seed_(seed), clock_(clock), next_seq_(0), steps_(0) {
+  // Mixes the seed (splitmix64), so that close seeds give unrelated
+  // sequences and seed 0 is valid for xorshift.
+  uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  state_ = (z ^ (z >> 31)) | 1;
+  if (!clock_) {
+    own_clock_.reset(new FakeClock);
+    clock_ = own_clock_.get();
+  }
+}
+
+SimExecutor::~SimExecutor() {
+}
+
+void SimExecutor::execute(Task task) {
+  ready_.push_back(std::move(task));
+}
+
+void SimExecutor::execute_after(double delay, Task task) {
+  double when = clock_->now() + std::max(0.0, delay);
+  delayed_.emplace(std::make_pair(when, next_seq_++), std::move(task));
+}
+
+bool SimExecutor::run_one() {
+  release_due();
+  if (ready_.empty()) {
+    if (delayed_.empty()) {
+      return false;
+    }
+    double when = delayed_.begin()->first.first;
+    clock_->advance(when - clock_->now());
+    release_due();
+  }
+  // Swaps the picked task with the last one, so picking takes O(1).
+  size_t index = next_random() % ready_.size();
+  std::swap(ready_[index], ready_.back());
+  Task task = std::move(ready_.back());
+  ready_.pop_back();
+  steps_++;
+  task();
+  return true;
+}
+
+size_t SimExecutor::run(size_t max_steps) {
+  size_t count = 0;
+  while (count < max_steps && run_one()) {
+    count++;
+  }
+  return count;
+}
+
+size_t SimExecutor::run_for(double seconds) {
+  double end = clock_->now() + seconds;
+  size_t count = 0;
+  while (true) {
+    release_due();
+    if (ready_.empty() &&
+        (delayed_.empty() || delayed_.begin()->first.first > end)) {
+      break;
+    }
+    run_one();
+    count++;
+  }
+  if (clock_->now() < end) {
+    clock_->advance(end - clock_->now());
+  }
+  return count;
+}
+
+void SimExecutor::release_due() {
+  double now = clock_->now();
+  while (!delayed_.empty() && delayed_.begin()->first.first <= now) {
+    ready_.push_back(std::move(delayed_.begin()->second));
+    delayed_.erase(delayed_.begin());
+  }
+}
+
+uint64_t SimExecutor::next_random() {
+  state_ ^= state_ >> 12;
+  state_ ^= state_ << 25;
+  state_ ^= state_ >> 27;
+  return state_ * 0x2545F4914F6CDD1DULL;
+}
+
+}  // namespace vobla
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/sim_executor.h
+ * \brief A deterministic single-threaded executor for concurrency tests.
+ */
+
+#ifndef VOBLA_SIM_EXECUTOR_H_
+#define VOBLA_SIM_EXECUTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "vobla/clock.h"
+#include "vobla/executor.h"
+#include "vobla/task.h"
+
+namespace vobla {
+
+/**
+ * \class SimExecutor vobla/sim_executor.h
+ * \brief Runs the tasks one at a time, in a pseudo-random order picked by
+ * a seed, on a FakeClock.
+ *
+ * The code under test takes an Executor (and a Clock), so the tests swap
+ * the ThreadPool for a SimExecutor. Each step runs one of the ready tasks
+ * picked at random, which stands for one interleaving of the tasks that a
+ * pool would run concurrently. The same seed always replays the same
+ * interleaving, so a test can try thousands of seeds in a second, and a
+ * failing seed reproduces the failure:
+ *
+ * ~~~~~~~~~{cpp}
+ * for (uint64_t seed = 0; seed < 1000; seed++) {
+ *   SimExecutor sim(seed);
+ *   Service service(&sim, sim.clock());
+ *   service.start();
+ *   sim.run();
+ *   ASSERT_TRUE(service.consistent()) << "seed " << seed;
+ * }
+ * ~~~~~~~~~
+ *
+ * The delayed tasks become ready when the clock reaches their due time.
+ * When no task is ready, run_one() advances the clock to the earliest due
+ * time, so the simulated time passes instantly.
+ *
+ * It is not thread-safe: all tasks and all calls run in the calling
+ * thread. The tasks must not block, e.g., on a std::future of another
+ * task.
+ */
+class SimExecutor : public Executor {
+ public:
+  /**
+   * \brief Constructs a SimExecutor.
+   * \param clock the simulated clock. Defaults to an owned FakeClock
+   * starting at 0.
+   */
+  explicit SimExecutor(uint64_t seed, FakeClock* clock = nullptr);
+
+  virtual ~SimExecutor();
+
+  /// Makes a task ready.
+  virtual void execute(Task task);
+
+  /// Makes a task ready after `delay` simulated seconds.
+  void execute_after(double delay, Task task);
+
+  /// Runs a callable after `delay` simulated seconds.
+  template <typename F>
+  void post_after(double delay, F&& func) {
+    execute_after(delay, Task(std::forward<F>(func)));
+  }
+
+  /**
+   * \brief Runs one ready task, advancing the clock to the next delayed
+   * task if none is ready.
+   * \return false if there is no task left.
+   */
+  bool run_one();
+
+  /**
+   * \brief Runs the tasks until none is left, or `max_steps` have run.
+   * \return the number of tasks run.
+   *
+   * A bound on the steps stops the livelocks, e.g., periodic tasks.
+   */
+  size_t run(size_t max_steps = SIZE_MAX);
+
+  /// Runs the tasks due within `seconds` from now, then moves the clock to
+  /// that time. Returns the number of tasks run.
+  size_t run_for(double seconds);
+
+  /// Returns the number of ready tasks.
+  size_t num_ready() const {
+    return ready_.size();
+  }
+
+  /// Returns the number of delayed tasks.
+  size_t num_delayed() const {
+    return delayed_.size();
+  }
+
+  /// Returns the number of tasks run so far.
+  uint64_t num_steps() const {
+    return steps_;
+  }
+
+  uint64_t seed() const {
+    return seed_;
+  }
+
+  FakeClock* clock() const {
+    return clock_;
+  }
+
+ private:
+  /// Makes the delayed tasks due by now ready.
+  void release_due();
+
+  /// Returns the next pseudo-random number (xorshift64*).
+  uint64_t next_random();
+
+  const uint64_t seed_;
+
+  uint64_t state_;
+
+  std::unique_ptr<FakeClock> own_clock_;
+
+  FakeClock* clock_;
+
+  std::vector<Task> ready_;
+
+  /// The delayed tasks, keyed by (due time, sequence number), so the ones
+  /// due at the same time are released in the order they were added.
+  std::map<std::pair<double, uint64_t>, Task> delayed_;
+
+  uint64_t next_seq_;
+
+  uint64_t steps_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_SIM_EXECUTOR_H_
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <functional>
+#include <future>
+#include <set>
+#include <vector>
+#include "vobla/clock.h"
+#include "vobla/sim_executor.h"
+#include "vobla/strand.h"
+
+using std::vector;
+
+namespace vobla {
+
+namespace {
+
+vector<int> run_order(uint64_t seed) {
+  SimExecutor sim(seed);
+  vector<int> order;
+  for (int i = 0; i < 10; i++) {
+    sim.post([&order, i] { order.push_back(i); });
+  }
+  EXPECT_EQ(10u, sim.run());
+  return order;
+}
+
+/// Two unsynchronized increments, each split into a read and a write
+/// task. Returns the final value.
+int racy_increments(uint64_t seed) {
+  SimExecutor sim(seed);
+  int counter = 0;
+  for (int i = 0; i < 2; i++) {
+    sim.post([&sim, &counter] {
+        int value = counter;
+        sim.post([&counter, value] { counter = value + 1; });
+      });
+  }
+  sim.run();
+  return counter;
+}
+
+}  // namespace
+
+TEST(SimExecutorTest, TestSeedsReplayTheOrder) {
+  EXPECT_EQ(run_order(7), run_order(7));
+  std::set<vector<int>> orders;
+  for (uint64_t seed = 0; seed < 20; seed++) {
+    vector<int> order = run_order(seed);
+    EXPECT_EQ(10u, std::set<int>(order.begin(), order.end()).size());
+    orders.insert(order);
+  }
+  EXPECT_GT(orders.size(), 10u);
+}
+
+TEST(SimExecutorTest, TestFindsRaces) {
+  uint64_t failing_seed = 0;
+  int num_failures = 0;
+  for (uint64_t seed = 0; seed < 1000; seed++) {
+    if (racy_increments(seed) != 2) {
+      failing_seed = seed;
+      num_failures++;
+    }
+  }
+  // Some interleavings lose an update, and the seed replays them.
+  EXPECT_GT(num_failures, 0);
+  EXPECT_LT(num_failures, 1000);
+  EXPECT_EQ(1, racy_increments(failing_seed));
+}
+
+TEST(SimExecutorTest, TestDelayedTasks) {
+  FakeClock clock(100);
+  SimExecutor sim(1, &clock);
+  EXPECT_EQ(&clock, sim.clock());
+  vector<double> times;
+  auto record = [&times, &clock] { times.push_back(clock.now()); };
+  sim.post_after(5, record);
+  sim.post_after(1, record);
+  sim.post_after(1, [&sim, record] { sim.post_after(2, record); });
+  sim.post(record);
+  EXPECT_EQ(1u, sim.num_ready());
+  EXPECT_EQ(3u, sim.num_delayed());
+
+  EXPECT_EQ(3u, sim.run_for(2));
+  EXPECT_DOUBLE_EQ(102, clock.now());
+  EXPECT_EQ(2u, sim.num_delayed());
+
+  EXPECT_EQ(2u, sim.run());
+  EXPECT_EQ((vector<double>{100, 101, 103, 105}), times);
+  EXPECT_DOUBLE_EQ(105, clock.now());
+  EXPECT_FALSE(sim.run_one());
+  EXPECT_EQ(5u, sim.num_steps());
+}
+
+TEST(SimExecutorTest, TestRunStopsAfterMaxSteps) {
+  SimExecutor sim(1);
+  std::function<void()> tick = [&sim, &tick] { sim.post_after(1, tick); };
+  sim.post(tick);
+  EXPECT_EQ(100u, sim.run(100));
+  EXPECT_DOUBLE_EQ(99, sim.clock()->now());
+}
+
+TEST(SimExecutorTest, TestExecutorInterface) {
+  SimExecutor sim(3);
+  std::future<int> answer = sim.submit([] { return 42; });
+  // A strand on the simulation keeps its FIFO order.
+  Strand strand(&sim);
+  vector<int> order;
+  for (int i = 0; i < 10; i++) {
+    strand.post([&order, i] { order.push_back(i); });
+  }
+  sim.run();
+  EXPECT_EQ(42, answer.get());
+  EXPECT_EQ((vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}), order);
+}
+
+}  // namespace vobla
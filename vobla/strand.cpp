@@ -0,0 +1,129 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/strand.cpp
+ * \brief Implementation of Strand.
+ *
+ * The queue is D. Vyukov's intrusive MPSC queue: the producers swap
+ * themselves into `tail_`, then link the previous tail to their node. The
+ * consumer might see a node whose successor is not linked yet, in which
+ * case `pending_` tells it that one is coming, and it yields.
+ *
+ * The last task drops `pending_` to 0 under `mutex_`, so that the
+ * destructor, which waits under the same mutex, can not free the strand
+ * while the drain task still uses it.
+ */
+
+#include <glog/logging.h>
+#include <thread>
+#include <utility>
+#include "vobla/strand.h"
+
+namespace vobla {
+
+struct Strand::Node {
+  Node() : next(nullptr) {}
+
+  explicit Node(Task&& t) : next(nullptr), task(std::move(t)) {}
+
+  std::atomic<Node*> next;
+
+  Task task;
+};
+
+namespace {
+
+/// The strand whose task runs in this thread.
+thread_local const Strand* current_strand = nullptr;
+
+}  // namespace
+
+const size_t Strand::kMaxBatch;
+
+Strand::Strand(Executor* executor)
+    : executor_(executor), tail_(new Node), pending_(0) {
+  head_ = tail_.load(std::memory_order_relaxed);
+}
+
+Strand::~Strand() {
+  DCHECK(!running_in_this_thread())
+      << "A strand must not be destroyed by its own task.";
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] {
+      return pending_.load(std::memory_order_acquire) == 0;
+    });
+  delete head_;
+}
+
+void Strand::execute(Task task) {
+  Node* node = new Node(std::move(task));
+  Node* prev = tail_.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+  if (pending_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+    executor_->execute(Task([this] { drain(); }));
+  }
+}
+
+bool Strand::running_in_this_thread() const {
+  return current_strand == this;
+}
+
+void Strand::drain() {
+  const Strand* previous = current_strand;
+  current_strand = this;
+  for (size_t ran = 1; ; ++ran) {
+    Node* next;
+    while (!(next = head_->next.load(std::memory_order_acquire))) {
+      std::this_thread::yield();
+    }
+    delete head_;
+    head_ = next;
+    {
+      Task task = std::move(next->task);
+      task();
+    }
+    // Once it drops to 0, another drain task might start, and the strand
+    // might be destroyed.
+    if (finish_one()) {
+      break;
+    }
+    if (ran == kMaxBatch) {
+      executor_->execute(Task([this] { drain(); }));
+      break;
+    }
+  }
+  current_strand = previous;
+}
+
+bool Strand::finish_one() {
+  // Only the drain task decrements, so a count above 1 can not reach 0.
+  size_t pending = pending_.load(std::memory_order_acquire);
+  while (pending > 1) {
+    if (pending_.compare_exchange_weak(pending, pending - 1,
+                                       std::memory_order_acq_rel)) {
+      return false;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_.fetch_sub(1, std::memory_order_acq_rel) > 1) {
+    return false;
+  }
+  idle_.notify_all();
+  return true;
+}
+
+}  // namespace vobla
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/strand.h
+ * \brief Serial executors on top of a shared executor.
+ */
+
+#ifndef VOBLA_STRAND_H_
+#define VOBLA_STRAND_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include "vobla/executor.h"
+#include "vobla/task.h"
+
+namespace vobla {
+
+/**
+ * \class Strand vobla/strand.h
+ * \brief Runs its tasks one at a time, in FIFO order, on another executor.
+ *
+ * A strand serializes the operations on an object without a dedicated
+ * thread, and without a mutex that would block the pool workers:
+ *
+ * ~~~~~~~~~{cpp}
+ * class Session {
+ *   Strand strand_{&pool};
+ *   void on_message(Message msg) {
+ *     strand_.post([this, msg] { handle(msg); });  // No lock in handle().
+ *   }
+ * };
+ * ~~~~~~~~~
+ *
+ * The tasks are linked into a lock-free multi-producer single-consumer
+ * queue, so execute() takes one atomic exchange and one atomic increment.
+ * The first task posted to an idle strand also posts a drain task to the
+ * executor, which then runs the strand's tasks on whichever worker picks
+ * it up. After kMaxBatch tasks, the drain task re-posts itself so that a
+ * busy strand does not hold a worker forever.
+ *
+ * A strand takes about a hundred bytes, so an application can have one
+ * per object. The strand must outlive its tasks: the destructor sleeps
+ * until the pending ones have run, and must not be called from one of
+ * them.
+ */
+class Strand : public Executor {
+ public:
+  /// The number of tasks that a drain task runs before yielding.
+  static const size_t kMaxBatch = 64;
+
+  /// Constructs a strand running its tasks on `executor`.
+  explicit Strand(Executor* executor);
+
+  /// Waits for the pending tasks.
+  virtual ~Strand();
+
+  /// Queues a task. It must not throw.
+  virtual void execute(Task task);
+
+  /// Returns true if called from a task of this strand.
+  bool running_in_this_thread() const;
+
+  /// Returns the number of tasks that have not finished.
+  size_t num_pending() const {
+    return pending_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Node;
+
+  /// Runs the queued tasks. Only one drain task runs at a time.
+  void drain();
+
+  /// Counts a task as done. Returns true if no task is left, after which
+  /// the strand might be destroyed.
+  bool finish_one();
+
+  Executor* executor_;
+
+  /// The last queued node, updated by the producers.
+  std::atomic<Node*> tail_;
+
+  /// The node before the first queued one, only used by the drain task.
+  Node* head_;
+
+  /// The number of queued and running tasks. The producer that increments
+  /// it from 0 posts the drain task.
+  std::atomic<size_t> pending_;
+
+  /// Guards the decrement of pending_ to 0, which notifies `idle_`.
+  std::mutex mutex_;
+
+  /// Notified when pending_ drops to 0, for the destructor.
+  std::condition_variable idle_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_STRAND_H_
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/strand_bench.cpp
+ * \brief Measures the cost of serializing tasks with strands.
+ *
+ * Usage: strand_bench [NUM_OBJECTS] [TASKS_PER_OBJECT]
+ *
+ * Each object has a counter, which NUM_OBJECTS (100k by default) tasks per
+ * round increment, round-robin over the objects. The tasks are serialized
+ * per object:
+ *
+ * - pool: no serialization, each object is only touched once per round,
+ *   as the baseline.
+ * - mutex: posted to the pool, each task locks the object's mutex.
+ * - strand: posted to the object's Strand.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "vobla/strand.h"
+#include "vobla/sysinfo.h"
+#include "vobla/thread_pool.h"
+#include "vobla/timer.h"
+
+using std::vector;
+using vobla::Strand;
+using vobla::SysInfo;
+using vobla::ThreadPool;
+using vobla::Timer;
+
+namespace {
+
+struct Object {
+  explicit Object(ThreadPool* pool) : strand(pool), counter(0) {}
+
+  Strand strand;
+
+  std::mutex mutex;
+
+  int64_t counter;
+};
+
+void wait_for(const std::atomic<int64_t>& counter, int64_t expected) {
+  while (counter.load() < expected) {
+    std::this_thread::yield();
+  }
+}
+
+enum class Mode { kPool, kMutex, kStrand };
+
+/// Returns million tasks per second.
+double run(ThreadPool* pool, vector<std::unique_ptr<Object>>* objects,
+           int rounds, Mode mode) {
+  int64_t total = static_cast<int64_t>(objects->size()) * rounds;
+  std::atomic<int64_t> done(0);
+  Timer timer;
+  timer.start();
+  for (int r = 0; r < rounds; r++) {
+    for (auto& ptr : *objects) {
+      Object* object = ptr.get();
+      switch (mode) {
+        case Mode::kPool:
+          pool->post([object, &done] {
+              object->counter++;
+              done++;
+            });
+          break;
+        case Mode::kMutex:
+          pool->post([object, &done] {
+              std::lock_guard<std::mutex> lock(object->mutex);
+              object->counter++;
+              done++;
+            });
+          break;
+        case Mode::kStrand:
+          object->strand.post([object, &done] {
+              object->counter++;
+              done++;
+            });
+          break;
+      }
+    }
+    if (mode == Mode::kPool) {
+      // Without serialization, a round must finish before the next one.
+      wait_for(done, static_cast<int64_t>(objects->size()) * (r + 1));
+    }
+  }
+  wait_for(done, total);
+  timer.stop();
+  return total / timer.get_in_second() / 1e6;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t num_objects = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+  int rounds = argc > 2 ? atoi(argv[2]) : 10;
+  size_t num_threads = SysInfo::get_num_cpus();
+
+  ThreadPool pool(num_threads);
+  vector<std::unique_ptr<Object>> objects;
+  for (size_t i = 0; i < num_objects; i++) {
+    objects.emplace_back(new Object(&pool));
+  }
+  printf("%lu objects, %d tasks each, %lu threads, %lu bytes per strand\n",
+         static_cast<unsigned long>(num_objects), rounds,  // NOLINT
+         static_cast<unsigned long>(num_threads),  // NOLINT
+         static_cast<unsigned long>(sizeof(Strand)));  // NOLINT
+  printf("%-8s %10s\n", "mode", "Mtasks/s");
+  printf("%-8s %10.2f\n", "pool", run(&pool, &objects, rounds, Mode::kPool));
+  printf("%-8s %10.2f\n", "mutex",
+         run(&pool, &objects, rounds, Mode::kMutex));
+  printf("%-8s %10.2f\n", "strand",
+         run(&pool, &objects, rounds, Mode::kStrand));
+  return 0;
+}
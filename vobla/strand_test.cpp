@@ -0,0 +1,145 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "vobla/strand.h"
+#include "vobla/thread_pool.h"
+
+using std::vector;
+
+namespace vobla {
+
+TEST(StrandTest, TestFifoAndNeverConcurrent) {
+  const int kNumProducers = 4;
+  const int kNumTasks = 5000;
+  ThreadPool pool(4);
+  vector<vector<int>> seen(kNumProducers);
+  std::atomic<int> running(0);
+  std::atomic<bool> overlapped(false);
+  {
+    Strand strand(&pool);
+    vector<std::thread> producers;
+    for (int p = 0; p < kNumProducers; p++) {
+      producers.emplace_back([&, p] {
+          for (int i = 0; i < kNumTasks; i++) {
+            strand.post([&, p, i] {
+                if (running++ > 0) {
+                  overlapped = true;
+                }
+                // Not synchronized: the strand orders the tasks.
+                seen[p].push_back(i);
+                running--;
+              });
+          }
+        });
+    }
+    for (auto& producer : producers) {
+      producer.join();
+    }
+  }
+  EXPECT_FALSE(overlapped);
+  for (int p = 0; p < kNumProducers; p++) {
+    ASSERT_EQ(static_cast<size_t>(kNumTasks), seen[p].size());
+    for (int i = 0; i < kNumTasks; i++) {
+      EXPECT_EQ(i, seen[p][i]);
+    }
+  }
+}
+
+TEST(StrandTest, TestRunningInThisThread) {
+  ThreadPool pool(2);
+  Strand strand(&pool);
+  Strand other(&pool);
+  EXPECT_FALSE(strand.running_in_this_thread());
+  auto inside = strand.submit([&strand, &other] {
+      return strand.running_in_this_thread() &&
+          !other.running_in_this_thread();
+    });
+  EXPECT_TRUE(inside.get());
+}
+
+TEST(StrandTest, TestManyStrands) {
+  const int kNumStrands = 1000;
+  const int kNumTasks = 20;
+  ThreadPool pool(4);
+  vector<int> counters(kNumStrands, 0);
+  vector<std::unique_ptr<Strand>> strands;
+  for (int s = 0; s < kNumStrands; s++) {
+    strands.emplace_back(new Strand(&pool));
+  }
+  for (int i = 0; i < kNumTasks; i++) {
+    for (int s = 0; s < kNumStrands; s++) {
+      int* counter = &counters[s];
+      strands[s]->post([counter] { (*counter)++; });
+    }
+  }
+  // The destructors wait for the tasks.
+  strands.clear();
+  for (int s = 0; s < kNumStrands; s++) {
+    EXPECT_EQ(kNumTasks, counters[s]);
+  }
+}
+
+TEST(StrandTest, TestDestructorWaitsForRunningTask) {
+  ThreadPool pool(1);
+  std::unique_ptr<Strand> strand(new Strand(&pool));
+  std::promise<void> started;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::atomic<bool> finished(false);
+  strand->post([&] {
+      started.set_value();
+      released.wait();
+      finished = true;
+    });
+  started.get_future().wait();
+  auto destroyed = std::async(std::launch::async, [&] { strand.reset(); });
+  EXPECT_EQ(std::future_status::timeout,
+            destroyed.wait_for(std::chrono::milliseconds(50)));
+  release.set_value();
+  destroyed.get();
+  EXPECT_TRUE(finished);
+}
+
+TEST(StrandTest, TestBatchesYieldToOtherTasks) {
+  ThreadPool pool(1);
+  Strand strand(&pool);
+  std::atomic<bool> other_ran(false);
+  std::atomic<int> ran_before_other(-1);
+  std::atomic<int> count(0);
+  for (size_t i = 0; i < 3 * Strand::kMaxBatch; i++) {
+    strand.post([&] {
+        if (count++ == 0) {
+          pool.post([&] {
+              ran_before_other = count.load();
+              other_ran = true;
+            });
+        }
+      });
+  }
+  while (strand.num_pending() > 0 || !other_ran) {
+    std::this_thread::yield();
+  }
+  EXPECT_LT(ran_before_other, static_cast<int>(3 * Strand::kMaxBatch));
+}
+
+}  // namespace vobla
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/task.h
+ * \brief A move-only callable wrapper with a small buffer.
+ */
+
+#ifndef VOBLA_TASK_H_
+#define VOBLA_TASK_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace vobla {
+
+/**
+ * \class Task vobla/task.h
+ * \brief A type-erased `void()` callable, like a move-only std::function.
+ *
+ * The callables of up to kInlineSize bytes, which do not throw on moves,
+ * are stored inside the Task, so wrapping a small lambda does not allocate.
+ * The larger ones are moved to the heap.
+ *
+ * Unlike std::function, Task accepts move-only callables (e.g., a lambda
+ * owning a std::promise or a std::unique_ptr).
+ */
+class Task {
+ public:
+  /// The size of the inline buffer. A Task takes one cache line.
+  static const size_t kInlineSize = 56;
+
+  /// Constructs an empty task.
+  Task() : ops_(nullptr) {}
+
+  /// Wraps a callable.
+  template <typename F,
+            typename = typename std::enable_if<!std::is_same<
+                typename std::decay<F>::type, Task>::value>::type>
+  Task(F&& func) : ops_(nullptr) {  // NOLINT
+    typedef typename std::decay<F>::type Func;
+    construct(std::forward<F>(func),
+              std::integral_constant<bool, fits_inline<Func>()>());
+  }
+
+  Task(Task&& other) : ops_(other.ops_) {
+    if (ops_) {
+      ops_->move(&other.storage_, &storage_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  Task& operator=(Task&& other) {
+    if (this != &other) {
+      reset();
+      if (other.ops_) {
+        other.ops_->move(&other.storage_, &storage_);
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  ~Task() {
+    reset();
+  }
+
+  /// Returns true if it holds a callable.
+  explicit operator bool() const {
+    return ops_ != nullptr;
+  }
+
+  /// Returns true if the callable is stored in the inline buffer.
+  bool is_inline() const {
+    return ops_ && ops_->is_inline;
+  }
+
+  /// Runs the callable. The task must not be empty.
+  void operator()() {
+    ops_->invoke(&storage_);
+  }
+
+  /// Destroys the callable.
+  void reset() {
+    if (ops_) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  /// Returns true if a callable of type `F` is stored inline.
+  template <typename F>
+  static constexpr bool fits_inline() {
+    return sizeof(F) <= kInlineSize && alignof(F) <= alignof(Storage) &&
+        std::is_nothrow_move_constructible<F>::value;
+  }
+
+ private:
+  Task(const Task&) = delete;
+
+  Task& operator=(const Task&) = delete;
+
+  typedef std::aligned_storage<kInlineSize, alignof(void*)>::type Storage;
+
+  template <typename F>
+  void construct(F&& func, std::true_type /* inline */) {
+    typedef typename std::decay<F>::type Func;
+    new (&storage_) Func(std::forward<F>(func));
+    ops_ = &InlineOps<Func>::kOps;
+  }
+
+  template <typename F>
+  void construct(F&& func, std::false_type /* inline */) {
+    typedef typename std::decay<F>::type Func;
+    new (&storage_) Func*(new Func(std::forward<F>(func)));
+    ops_ = &HeapOps<Func>::kOps;
+  }
+
+  /// The operations on the stored callable, one static table per type.
+  struct Ops {
+    void (*invoke)(void* storage);
+
+    /// Moves the callable from one storage to another, and destroys the
+    /// source.
+    void (*move)(void* from, void* to);
+
+    void (*destroy)(void* storage);
+
+    bool is_inline;
+  };
+
+  template <typename F>
+  struct InlineOps {
+    static void invoke(void* storage) {
+      (*static_cast<F*>(storage))();
+    }
+
+    static void move(void* from, void* to) {
+      F* func = static_cast<F*>(from);
+      new (to) F(std::move(*func));
+      func->~F();
+    }
+
+    static void destroy(void* storage) {
+      static_cast<F*>(storage)->~F();
+    }
+
+    static const Ops kOps;
+  };
+
+  /// The storage holds a pointer to the callable.
+  template <typename F>
+  struct HeapOps {
+    static void invoke(void* storage) {
+      (**static_cast<F**>(storage))();
+    }
+
+    static void move(void* from, void* to) {
+      *static_cast<F**>(to) = *static_cast<F**>(from);
+    }
+
+    static void destroy(void* storage) {
+      delete *static_cast<F**>(storage);
+    }
+
+    static const Ops kOps;
+  };
+
+  Storage storage_;
+
+  const Ops* ops_;
+};
+
+template <typename F>
+const Task::Ops Task::InlineOps<F>::kOps = {
+  &Task::InlineOps<F>::invoke, &Task::InlineOps<F>::move,
+  &Task::InlineOps<F>::destroy, true
+};
+
+template <typename F>
+const Task::Ops Task::HeapOps<F>::kOps = {
+  &Task::HeapOps<F>::invoke, &Task::HeapOps<F>::move,
+  &Task::HeapOps<F>::destroy, false
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_TASK_H_
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/task_group.cpp
+ * \brief Implementation of TaskGroup.
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include "vobla/task_group.h"
+
+namespace vobla {
+
+StopToken::StopToken() {
+}
+
+StopToken::StopToken(std::shared_ptr<std::atomic<bool>> flag)
+    : flag_(flag) {
+}
+
+/**
+ * The tasks are queued in the group, and each posts a runner to the
+ * executor that runs one queued task, if any is left. Hence wait() can run
+ * the queued tasks itself, and cancel() can drop them.
+ */
+class TaskGroup::State {
+ public:
+  State() : stopped_(new std::atomic<bool>(false)) {}
+
+  /// Queues a task. Returns false if the group is cancelled.
+  bool push(Task task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_->load(std::memory_order_relaxed)) {
+      return false;
+    }
+    queue_.push_back(std::move(task));
+    return true;
+  }
+
+  /// Runs one queued task. Returns false if there is none.
+  bool run_one() {
+    Task task;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (queue_.empty()) {
+        return false;
+      }
+      task = std::move(queue_.front());
+      queue_.pop_front();
+      running_++;
+    }
+    std::deque<Task> dropped;
+    try {
+      task();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) {
+        error_ = std::current_exception();
+      }
+      cancel_locked(&dropped);
+    }
+    task.reset();
+    dropped.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_--;
+    if (running_ == 0 && queue_.empty()) {
+      done_.notify_all();
+    }
+    return true;
+  }
+
+  /// Runs the queued tasks, then waits for the running ones.
+  void wait() {
+    while (run_one()) {
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_ > 0 || !queue_.empty()) {
+      // The tasks might spawn more tasks while we wait.
+      if (!queue_.empty()) {
+        lock.unlock();
+        run_one();
+        lock.lock();
+        continue;
+      }
+      done_.wait(lock);
+    }
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  void cancel() {
+    std::deque<Task> dropped;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cancel_locked(&dropped);
+    }
+    // Destroys the dropped tasks out of the lock.
+  }
+
+  bool cancelled() const {
+    return stopped_->load(std::memory_order_acquire);
+  }
+
+  StopToken token() const {
+    return StopToken(stopped_);
+  }
+
+  size_t num_pending() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size() + running_;
+  }
+
+ private:
+  /// Stops the group and moves the queued tasks to `dropped`, for the
+  /// caller to destroy after unlocking: their destructors might call back
+  /// into the group.
+  void cancel_locked(std::deque<Task>* dropped) {
+    stopped_->store(true, std::memory_order_release);
+    dropped->swap(queue_);
+    if (running_ == 0) {
+      done_.notify_all();
+    }
+  }
+
+  std::shared_ptr<std::atomic<bool>> stopped_;
+
+  std::mutex mutex_;
+
+  std::condition_variable done_;
+
+  std::deque<Task> queue_;
+
+  size_t running_ = 0;
+
+  std::exception_ptr error_;
+};
+
+TaskGroup::TaskGroup(Executor* executor)
+    : executor_(executor), state_(new State) {
+}
+
+TaskGroup::~TaskGroup() {
+  try {
+    state_->wait();
+  } catch (...) {  // NOLINT
+  }
+}
+
+void TaskGroup::add(Task task) {
+  if (!state_->push(std::move(task))) {
+    return;
+  }
+  std::shared_ptr<State> state = state_;
+  executor_->post([state] { state->run_one(); });
+}
+
+void TaskGroup::wait() {
+  state_->wait();
+}
+
+void TaskGroup::cancel() {
+  state_->cancel();
+}
+
+bool TaskGroup::cancelled() const {
+  return state_->cancelled();
+}
+
+StopToken TaskGroup::stop_token() const {
+  return state_->token();
+}
+
+size_t TaskGroup::num_pending() const {
+  return state_->num_pending();
+}
+
+}  // namespace vobla
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/task_group.h
+ * \brief Groups of tasks that can be waited for and cancelled together.
+ */
+
+#ifndef VOBLA_TASK_GROUP_H_
+#define VOBLA_TASK_GROUP_H_
+
+#include <boost/utility.hpp>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include "vobla/executor.h"
+#include "vobla/task.h"
+
+namespace vobla {
+
+/**
+ * \class StopToken vobla/task_group.h
+ * \brief Tells the running tasks that their work is no longer needed.
+ *
+ * The tasks poll stop_requested() at convenient points and return early.
+ * The copies share the same state.
+ */
+class StopToken {
+ public:
+  /// Constructs a token that is never stopped.
+  StopToken();
+
+  /// Returns true if the stop was requested.
+  bool stop_requested() const {
+    return flag_ && flag_->load(std::memory_order_acquire);
+  }
+
+ private:
+  friend class TaskGroup;
+
+  explicit StopToken(std::shared_ptr<std::atomic<bool>> flag);
+
+  std::shared_ptr<std::atomic<bool>> flag_;
+};
+
+/**
+ * \class TaskGroup vobla/task_group.h
+ * \brief Tracks the tasks spawned into it, on an Executor.
+ *
+ * wait() blocks until all tasks of the group have run. Instead of only
+ * blocking, the calling thread runs the tasks that have not started yet,
+ * so waiting from a worker of a busy pool does not deadlock.
+ *
+ * cancel() drops the tasks that have not started, and requests the running
+ * ones to stop through the StopToken. If a task throws, the group is
+ * cancelled and wait() rethrows the first exception.
+ *
+ * ~~~~~~~~~{cpp}
+ * TaskGroup group(&pool);
+ * StopToken token = group.stop_token();
+ * for (auto& shard : shards) {
+ *   group.run([&shard, token] {
+ *       while (!token.stop_requested() && shard.scan_next()) {}
+ *     });
+ * }
+ * ...
+ * group.cancel();  // The request was abandoned.
+ * group.wait();
+ * ~~~~~~~~~
+ *
+ * The destructor waits for the tasks, but ignores their exceptions.
+ */
+class TaskGroup : boost::noncopyable {
+ public:
+  /// Constructs a group running its tasks on `executor`.
+  explicit TaskGroup(Executor* executor);
+
+  ~TaskGroup();
+
+  /// Spawns a `void()` callable into the group.
+  template <typename F>
+  void run(F&& func) {
+    add(Task(std::forward<F>(func)));
+  }
+
+  /// Waits for all tasks of the group, and helps running them.
+  void wait();
+
+  /// Drops the tasks that have not started, and tells the running ones to
+  /// stop. The tasks spawned afterwards are dropped too.
+  void cancel();
+
+  /// Returns true if the group was cancelled.
+  bool cancelled() const;
+
+  /// Returns the token of the group.
+  StopToken stop_token() const;
+
+  /// Returns the number of tasks that have not finished (or been dropped).
+  size_t num_pending() const;
+
+ private:
+  /// The state shared with the tasks posted to the executor, which might
+  /// run after the group is destroyed.
+  class State;
+
+  void add(Task task);
+
+  Executor* executor_;
+
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_TASK_GROUP_H_
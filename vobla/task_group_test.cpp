@@ -0,0 +1,150 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include "vobla/task_group.h"
+#include "vobla/thread_pool.h"
+
+namespace vobla {
+
+TEST(TaskGroupTest, TestWait) {
+  ThreadPool pool(4);
+  std::atomic<int> count(0);
+  TaskGroup group(&pool);
+  for (int i = 0; i < 100; i++) {
+    group.run([&count] { count++; });
+  }
+  group.wait();
+  EXPECT_EQ(100, count);
+  EXPECT_EQ(0u, group.num_pending());
+
+  // The group can be reused.
+  group.run([&count] { count++; });
+  group.wait();
+  EXPECT_EQ(101, count);
+}
+
+TEST(TaskGroupTest, TestWaitHelpsWhenThePoolIsBusy) {
+  ThreadPool pool(1);
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  pool.post([opened] { opened.wait(); });
+
+  // The only worker is blocked, so the caller runs the tasks.
+  TaskGroup group(&pool);
+  auto caller = std::this_thread::get_id();
+  std::atomic<int> inline_count(0);
+  for (int i = 0; i < 10; i++) {
+    group.run([&inline_count, caller] {
+        if (std::this_thread::get_id() == caller) {
+          inline_count++;
+        }
+      });
+  }
+  group.wait();
+  EXPECT_EQ(10, inline_count);
+  gate.set_value();
+}
+
+TEST(TaskGroupTest, TestNestedGroups) {
+  ThreadPool pool(2);
+  std::atomic<int> count(0);
+  TaskGroup outer(&pool);
+  for (int i = 0; i < 8; i++) {
+    outer.run([&pool, &count] {
+        TaskGroup inner(&pool);
+        for (int j = 0; j < 10; j++) {
+          inner.run([&count] { count++; });
+        }
+        inner.wait();
+      });
+  }
+  outer.wait();
+  EXPECT_EQ(80, count);
+}
+
+TEST(TaskGroupTest, TestCancel) {
+  ThreadPool pool(1);
+  std::promise<void> started;
+  std::atomic<bool> stopped(false);
+  std::atomic<int> count(0);
+  TaskGroup group(&pool);
+  StopToken token = group.stop_token();
+  EXPECT_FALSE(token.stop_requested());
+  group.run([&started, &stopped, token] {
+      started.set_value();
+      while (!token.stop_requested()) {
+        std::this_thread::yield();
+      }
+      stopped = true;
+    });
+  started.get_future().wait();
+  // Queued behind the running task on the only worker.
+  for (int i = 0; i < 10; i++) {
+    group.run([&count] { count++; });
+  }
+  group.cancel();
+  EXPECT_TRUE(group.cancelled());
+  EXPECT_TRUE(token.stop_requested());
+  group.run([&count] { count++; });
+  group.wait();
+  EXPECT_TRUE(stopped);
+  EXPECT_EQ(0, count);
+}
+
+TEST(TaskGroupTest, TestExceptionCancelsTheGroup) {
+  ThreadPool pool(2);
+  TaskGroup group(&pool);
+  group.run([] { throw std::runtime_error("failed"); });
+  EXPECT_THROW(group.wait(), std::runtime_error);
+  EXPECT_TRUE(group.cancelled());
+  group.wait();
+}
+
+TEST(TaskGroupTest, TestDroppedTasksAreDestroyedOutOfTheLock) {
+  ThreadPool pool(1);
+  TaskGroup group(&pool);
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  group.run([released] {
+      released.wait();
+      throw std::runtime_error("failed");
+    });
+  // The deleter calls back into the group, which would deadlock if the
+  // group destroyed the task under its mutex.
+  std::promise<size_t> destroyed;
+  std::shared_ptr<int> guard(new int(0), [&group, &destroyed](int* p) {
+      delete p;
+      destroyed.set_value(group.num_pending());
+    });
+  group.run([guard] {});
+  guard.reset();
+  release.set_value();
+  EXPECT_EQ(1u, destroyed.get_future().get());
+  EXPECT_THROW(group.wait(), std::runtime_error);
+}
+
+TEST(TaskGroupTest, TestDefaultStopToken) {
+  StopToken token;
+  EXPECT_FALSE(token.stop_requested());
+}
+
+}  // namespace vobla
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <array>
+#include <memory>
+#include <utility>
+#include "vobla/task.h"
+
+namespace vobla {
+
+namespace {
+
+/// Counts the live instances.
+struct Counted {
+  explicit Counted(int* live) : live(live) {
+    (*live)++;
+  }
+
+  Counted(const Counted& other) : live(other.live) {
+    (*live)++;
+  }
+
+  ~Counted() {
+    (*live)--;
+  }
+
+  int* live;
+};
+
+}  // namespace
+
+TEST(TaskTest, TestEmpty) {
+  Task task;
+  EXPECT_FALSE(task);
+  EXPECT_FALSE(task.is_inline());
+}
+
+TEST(TaskTest, TestSmallCallablesAreInline) {
+  int value = 0;
+  Task task([&value] { value++; });
+  EXPECT_TRUE(task);
+  EXPECT_TRUE(task.is_inline());
+  task();
+  task();
+  EXPECT_EQ(2, value);
+}
+
+TEST(TaskTest, TestLargeCallablesAreOnHeap) {
+  std::array<char, 128> buffer;
+  buffer.fill(1);
+  int sum = 0;
+  Task task([buffer, &sum] {
+      for (char c : buffer) {
+        sum += c;
+      }
+    });
+  EXPECT_FALSE(task.is_inline());
+  task();
+  EXPECT_EQ(128, sum);
+}
+
+TEST(TaskTest, TestMoveOnlyCallables) {
+  std::unique_ptr<int> ptr(new int(5));
+  int result = 0;
+  struct Callable {
+    void operator()() {
+      *result = *ptr;
+    }
+    std::unique_ptr<int> ptr;
+    int* result;
+  };
+  Task task(Callable{std::move(ptr), &result});
+  Task moved(std::move(task));
+  EXPECT_FALSE(task);
+  moved();
+  EXPECT_EQ(5, result);
+}
+
+TEST(TaskTest, TestDestroysCallables) {
+  int live = 0;
+  {
+    Counted counted(&live);
+    Task small([counted] {});
+    std::array<char, 128> buffer;
+    buffer.fill(0);
+    Task large([counted, buffer] {});
+    EXPECT_EQ(3, live);
+
+    Task other;
+    other = std::move(small);
+    EXPECT_EQ(3, live);
+    other = std::move(large);
+    EXPECT_EQ(2, live);
+    other.reset();
+    EXPECT_EQ(1, live);
+  }
+  EXPECT_EQ(0, live);
+}
+
+}  // namespace vobla
@@ -19,91 +19,1470 @@
  * \brief Thread pool implemetations.
  */
 
+#include <glog/logging.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
 #include <thread>
+#include <vector>
+#include "vobla/cpu_topology.h"
+#include "vobla/event_count.h"
+#include "vobla/mpmc_queue.h"
 #include "vobla/sysinfo.h"
 #include "vobla/thread_pool.h"
+#include "vobla/work_stealing_deque.h"
 
 namespace vobla {
 
 using std::thread;
 const size_t kDefaultThreadsPerCpu = 2;
 
-ThreadPool::ThreadPool()
-  : num_threads_(kDefaultThreadsPerCpu * SysInfo::get_num_cpus()),
-    closed_(false) {
-  for (size_t i = 0; i < num_threads_; ++i) {
-    threads_.emplace_back(thread(&ThreadPool::worker, this));
+namespace {
+
+/// The worker that runs in the current thread, if any.
+struct WorkerContext {
+  const ThreadPool* pool;
+
+  size_t index;
+
+  /// The current spin budget of the worker, see spin_until().
+  size_t spin_limit;
+
+  /// The pool whose task runs inline in this thread, with
+  /// Overflow::kCallerRuns.
+  const ThreadPool* caller_runs;
+};
+
+thread_local WorkerContext current_worker = { nullptr, 0, 0, nullptr };
+
+/// The spin budget never drops below this.
+const size_t kMinIdleSpins = 16;
+
+/// The number of sched_yield() calls between spinning and parking.
+const size_t kIdleYields = 4;
+
+/// Tells the CPU that this is a spin-wait loop.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * \brief Spins with pause, then yields, until `ready()` returns true.
+ * \return false if it gave up, after which the caller parks.
+ *
+ * The budget adapts to the load of the worker: it doubles (up to
+ * `max_spins`) when a task shows up while spinning, and halves when the
+ * worker has to park anyway.
+ */
+template <typename Ready>
+bool spin_until(Ready ready, size_t max_spins) {
+  if (max_spins == 0) {
+    return false;
+  }
+  size_t& limit = current_worker.spin_limit;
+  if (limit == 0 || limit > max_spins) {
+    limit = max_spins;
   }
+  for (size_t i = 0; i < limit + kIdleYields; ++i) {
+    if (ready()) {
+      limit = std::min(max_spins, 2 * limit);
+      return true;
+    }
+    if (i < limit) {
+      cpu_relax();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  limit = std::max(kMinIdleSpins, limit / 2);
+  return false;
 }
 
-ThreadPool::ThreadPool(size_t num_threads)
-  : num_threads_(num_threads), closed_(false) {
-  if (num_threads_ == 0) {
-    num_threads_ = kDefaultThreadsPerCpu * SysInfo::get_num_cpus();
+/// The maximal number of tasks a worker moves from the injector queue to
+/// its own deque at once.
+const size_t kInjectorBatchSize = 32;
+
+}  // namespace
+
+/// A task and the time it was queued at.
+struct QueuedTask {
+  Task task;
+
+  /// Negative if the scheduler does not stamp the tasks.
+  double enqueued_at = -1;
+
+  /// Whether Overflow::kDropOldest can drop it.
+  bool droppable = false;
+};
+
+namespace {
+
+bool is_droppable(const QueuedTask& item) {
+  return item.droppable;
+}
+
+}  // namespace
+
+/**
+ * \class ThreadPool::Scheduler
+ * \brief The interface between the task queues and the workers.
+ */
+class ThreadPool::Scheduler : boost::noncopyable {
+ public:
+  virtual ~Scheduler() {}
+
+  /// Adds a task. Can be called by any thread.
+  virtual void push(Task task, const TaskOptions& options,
+                    bool droppable) = 0;
+
+  /**
+   * \brief Blocks until a task is available for the worker.
+   * \return false if the pool is closed and all tasks have run.
+   */
+  virtual bool pop(size_t worker, QueuedTask* item) = 0;
+
+  /**
+   * \brief Like pop(), but gives up after `timeout` seconds without a task.
+   * \param[out] timed_out set to true if it gave up.
+   *
+   * Only the schedulers of the elastic pools need to support the timeout.
+   */
+  virtual bool pop_for(size_t worker, QueuedTask* item, double timeout,
+                       bool* timed_out) {
+    *timed_out = false;
+    return pop(worker, item);
+  }
+
+  /// Returns how long the oldest task has been queued, if known.
+  virtual double oldest_wait(double now) {
+    return 0;
+  }
+
+  /// Removes the oldest droppable task. Returns false if there is none.
+  virtual bool drop_oldest(Task* task) = 0;
+
+  /// Returns the number of queued tasks.
+  virtual size_t size() = 0;
+
+  /// Wakes up all workers to drain the tasks and exit.
+  virtual void close() = 0;
+
+  /// Returns the queueing delays of each priority class, if recorded.
+  virtual std::vector<Histogram> wait_times() {
+    return std::vector<Histogram>();
+  }
+};
+
+/**
+ * \class ThreadPool::FifoScheduler
+ * \brief One FIFO queue guarded by a mutex.
+ *
+ * With a clock, it stamps the tasks with their enqueue time, so that an
+ * elastic pool can tell how long the oldest task has waited, and the
+ * metrics can record the queueing delays.
+ *
+ * An idle worker first spins on the queue size (see spin_until()) before
+ * parking on the condition variable. The submitters only notify when no
+ * worker is spinning and some worker is parked, and a worker that takes a
+ * task while more are queued wakes up the next parked worker.
+ */
+class ThreadPool::FifoScheduler : public ThreadPool::Scheduler {
+ public:
+  FifoScheduler(Clock* clock, size_t idle_spins)
+      : clock_(clock), idle_spins_(idle_spins), size_(0), num_spinning_(0),
+        num_parked_(0), closed_(false) {}
+
+  virtual void push(Task task, const TaskOptions& /* options */,
+                    bool droppable) {
+    double now = clock_ ? clock_->now() : -1;
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_queue_.emplace_back();
+    task_queue_.back().task = std::move(task);
+    task_queue_.back().enqueued_at = now;
+    task_queue_.back().droppable = droppable;
+    size_.store(task_queue_.size(), std::memory_order_relaxed);
+    // A spinning worker re-checks the queue under the lock before parking.
+    if (num_parked_ > 0 && num_spinning_.load() == 0) {
+      condition_.notify_one();
+    }
+  }
+
+  virtual bool pop(size_t worker, QueuedTask* item) {
+    bool timed_out;
+    return pop_for(worker, item, -1, &timed_out);
+  }
+
+  virtual bool pop_for(size_t, QueuedTask* item, double timeout,
+                       bool* timed_out) {
+    *timed_out = false;
+    if (size_.load(std::memory_order_relaxed) == 0 && idle_spins_ > 0) {
+      num_spinning_++;
+      spin_until([this] {
+          return size_.load(std::memory_order_relaxed) > 0;
+        }, idle_spins_);
+      num_spinning_--;
+    }
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(std::max(timeout, 0.0)));
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!closed_ && task_queue_.empty()) {
+      num_parked_++;
+      if (timeout < 0) {
+        condition_.wait(lock);
+      } else if (condition_.wait_until(lock, deadline) ==
+                     std::cv_status::timeout && task_queue_.empty()) {
+        num_parked_--;
+        *timed_out = !closed_;
+        return false;
+      }
+      num_parked_--;
+    }
+    if (closed_ && task_queue_.empty()) {
+      return false;
+    }
+    *item = std::move(task_queue_.front());
+    task_queue_.pop_front();
+    size_.store(task_queue_.size(), std::memory_order_relaxed);
+    // Hands the remaining tasks over to a parked worker.
+    if (!task_queue_.empty() && num_parked_ > 0) {
+      condition_.notify_one();
+    }
+    return true;
+  }
+
+  virtual double oldest_wait(double now) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return task_queue_.empty() ? 0 : now - task_queue_.front().enqueued_at;
+  }
+
+  virtual bool drop_oldest(Task* task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = std::find_if(task_queue_.begin(), task_queue_.end(),
+                           is_droppable);
+    if (it == task_queue_.end()) {
+      return false;
+    }
+    *task = std::move(it->task);
+    task_queue_.erase(it);
+    size_.store(task_queue_.size(), std::memory_order_relaxed);
+    return true;
+  }
+
+  virtual size_t size() {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+  virtual void close() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closed_ = true;
+    condition_.notify_all();
+  }
+
+ private:
+  Clock* clock_;
+
+  const size_t idle_spins_;
+
+  std::deque<QueuedTask> task_queue_;
+
+  /// The size of task_queue_, polled by the spinning workers.
+  std::atomic<size_t> size_;
+
+  std::atomic<int> num_spinning_;
+
+  /// Guarded by mutex_.
+  int num_parked_;
+
+  std::mutex mutex_;
+
+  std::condition_variable condition_;
+
+  bool closed_;
+};
+
+/**
+ * \class ThreadPool::LockFreeFifoScheduler
+ * \brief A lock-free bounded FIFO queue.
+ *
+ * The workers only park on the EventCount when the queue stays empty after
+ * spinning (see spin_until()), and the submitters only make a syscall when
+ * some worker is parked.
+ *
+ * When the ring is full, the workers of the pool put their new tasks into
+ * a locked overflow list instead of waiting, since waiting workers could
+ * not drain the ring. The workers take the overflowed tasks first; the
+ * list is empty, and costs one load per pop, unless the ring fills up.
+ */
+class ThreadPool::LockFreeFifoScheduler : public ThreadPool::Scheduler {
+ public:
+  /// Stamps the tasks with `clock`, if not null.
+  LockFreeFifoScheduler(const ThreadPool* pool, size_t capacity,
+                        size_t idle_spins, Clock* clock)
+      : pool_(pool), queue_(capacity), idle_spins_(idle_spins),
+        clock_(clock), overflow_size_(0), closed_(false) {}
+
+  virtual void push(Task task, const TaskOptions& /* options */,
+                    bool droppable) {
+    QueuedTask item;
+    item.task = std::move(task);
+    item.enqueued_at = clock_ ? clock_->now() : -1;
+    item.droppable = droppable;
+    while (!queue_.try_push(std::move(item))) {
+      if (current_worker.pool == pool_) {
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        overflow_.push_back(std::move(item));
+        overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+        break;
+      }
+      auto key = not_full_.prepare_wait();
+      if (queue_.try_push(std::move(item))) {
+        not_full_.cancel_wait();
+        break;
+      }
+      not_full_.wait(key);
+    }
+    not_empty_.notify_one();
+  }
+
+  virtual bool pop(size_t, QueuedTask* item) {
+    bool spun = false;
+    while (true) {
+      if (take(item)) {
+        return true;
+      }
+      if (!spun) {
+        spun = true;
+        if (spin_until([this] { return size() > 0; }, idle_spins_)) {
+          continue;
+        }
+      }
+      auto key = not_empty_.prepare_wait();
+      if (take(item)) {
+        not_empty_.cancel_wait();
+        return true;
+      }
+      if (closed_.load()) {
+        not_empty_.cancel_wait();
+        return false;
+      }
+      not_empty_.wait(key);
+    }
+  }
+
+  /// Looks into the overflow list first, then moves the tasks of the ring
+  /// that can not be dropped, in order, to the overflow list until it
+  /// finds one that can.
+  virtual bool drop_oldest(Task* task) {
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    auto it = std::find_if(overflow_.begin(), overflow_.end(),
+                           is_droppable);
+    if (it != overflow_.end()) {
+      *task = std::move(it->task);
+      overflow_.erase(it);
+      overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+      return true;
+    }
+    QueuedTask item;
+    bool dropped = false;
+    while (!dropped && queue_.try_pop(&item)) {
+      not_full_.notify_one();
+      if (item.droppable) {
+        *task = std::move(item.task);
+        dropped = true;
+      } else {
+        overflow_.push_back(std::move(item));
+      }
+    }
+    overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+    return dropped;
+  }
+
+  virtual size_t size() {
+    return queue_.size() + overflow_size_.load(std::memory_order_relaxed);
   }
-  for (size_t i = 0; i < num_threads_; ++i) {
-    threads_.emplace_back(std::move(thread(&ThreadPool::worker, this)));
+
+  virtual void close() {
+    closed_ = true;
+    not_empty_.notify_all();
   }
+
+ private:
+  /// Takes the first overflowed task, or else the head of the ring.
+  bool take(QueuedTask* item) {
+    if (overflow_size_.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(overflow_mutex_);
+      if (!overflow_.empty()) {
+        *item = std::move(overflow_.front());
+        overflow_.pop_front();
+        overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+        return true;
+      }
+    }
+    if (queue_.try_pop(item)) {
+      not_full_.notify_one();
+      return true;
+    }
+    return false;
+  }
+
+  const ThreadPool* pool_;
+
+  MPMCQueue<QueuedTask> queue_;
+
+  const size_t idle_spins_;
+
+  Clock* clock_;
+
+  std::mutex overflow_mutex_;
+
+  /// The tasks added by the workers while the ring was full.
+  std::deque<QueuedTask> overflow_;
+
+  std::atomic<size_t> overflow_size_;
+
+  /// Signaled when a task is added.
+  EventCount not_empty_;
+
+  /// Signaled when a task is taken.
+  EventCount not_full_;
+
+  std::atomic<bool> closed_;
+};
+
+/**
+ * \class ThreadPool::PriorityScheduler
+ * \brief One earliest-deadline-first heap per priority class.
+ *
+ * A worker picks the class `c` that minimizes
+ * `c - floor(wait / aging_interval)`, where `wait` is how long the first
+ * task of the class has been queued. The ties go to the more urgent class.
+ */
+class ThreadPool::PriorityScheduler : public ThreadPool::Scheduler {
+ public:
+  PriorityScheduler(size_t num_priorities, double aging_interval,
+                    Clock* clock)
+      : classes_(std::max<size_t>(num_priorities, 1)),
+        wait_times_(classes_.size()), aging_interval_(aging_interval),
+        clock_(clock), closed_(false) {}
+
+  virtual void push(Task task, const TaskOptions& options,
+                    bool droppable) {
+    double now = clock_->now();
+    size_t priority = std::min(options.priority, classes_.size() - 1);
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto& heap = classes_[priority];
+    heap.emplace_back();
+    Entry& entry = heap.back();
+    entry.key = options.deadline > 0 ? options.deadline : now;
+    entry.seq = next_seq_++;
+    entry.enqueued_at = now;
+    entry.droppable = droppable;
+    entry.task = std::move(task);
+    std::push_heap(heap.begin(), heap.end(), Later());
+    size_++;
+    condition_.notify_one();
+  }
+
+  virtual bool pop(size_t worker, QueuedTask* item) {
+    bool timed_out;
+    return pop_for(worker, item, -1, &timed_out);
+  }
+
+  virtual bool pop_for(size_t, QueuedTask* item, double timeout,
+                       bool* timed_out) {
+    *timed_out = false;
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(std::max(timeout, 0.0)));
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!closed_ && size_ == 0) {
+      if (timeout < 0) {
+        condition_.wait(lock);
+      } else if (condition_.wait_until(lock, deadline) ==
+                     std::cv_status::timeout && size_ == 0) {
+        *timed_out = !closed_;
+        return false;
+      }
+    }
+    if (size_ == 0) {
+      return false;
+    }
+    double now = clock_->now();
+    size_t best = 0;
+    double best_score = 0;
+    for (size_t c = 0; c < classes_.size(); ++c) {
+      if (classes_[c].empty()) {
+        continue;
+      }
+      double score = c;
+      if (aging_interval_ > 0) {
+        double wait = now - classes_[c].front().enqueued_at;
+        score -= std::floor(wait / aging_interval_);
+      }
+      if (classes_[best].empty() || score < best_score) {
+        best = c;
+        best_score = score;
+      }
+    }
+    auto& heap = classes_[best];
+    std::pop_heap(heap.begin(), heap.end(), Later());
+    wait_times_[best].add(now - heap.back().enqueued_at);
+    item->task = std::move(heap.back().task);
+    item->enqueued_at = heap.back().enqueued_at;
+    heap.pop_back();
+    size_--;
+    return true;
+  }
+
+  virtual void close() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closed_ = true;
+    condition_.notify_all();
+  }
+
+  virtual std::vector<Histogram> wait_times() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return wait_times_;
+  }
+
+  virtual double oldest_wait(double now) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    double oldest = now;
+    for (const auto& heap : classes_) {
+      if (!heap.empty()) {
+        oldest = std::min(oldest, heap.front().enqueued_at);
+      }
+    }
+    return now - oldest;
+  }
+
+  /// Drops the first droppable task of the least urgent class that has
+  /// one.
+  virtual bool drop_oldest(Task* task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t c = classes_.size(); c-- > 0;) {
+      auto& heap = classes_[c];
+      auto first = heap.end();
+      for (auto it = heap.begin(); it != heap.end(); ++it) {
+        if (it->droppable && (first == heap.end() || Later()(*first, *it))) {
+          first = it;
+        }
+      }
+      if (first == heap.end()) {
+        continue;
+      }
+      *task = std::move(first->task);
+      heap.erase(first);
+      std::make_heap(heap.begin(), heap.end(), Later());
+      size_--;
+      return true;
+    }
+    return false;
+  }
+
+  virtual size_t size() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return size_;
+  }
+
+ private:
+  struct Entry {
+    /// The deadline, or the enqueue time if there is no deadline.
+    double key;
+
+    /// Keeps the FIFO order of the equal keys.
+    uint64_t seq;
+
+    double enqueued_at;
+
+    bool droppable;
+
+    Task task;
+  };
+
+  /// Orders a min-heap by (key, seq).
+  struct Later {
+    bool operator()(const Entry& lhs, const Entry& rhs) const {
+      return lhs.key > rhs.key || (lhs.key == rhs.key && lhs.seq > rhs.seq);
+    }
+  };
+
+  std::vector<std::vector<Entry>> classes_;
+
+  std::vector<Histogram> wait_times_;
+
+  double aging_interval_;
+
+  Clock* clock_;
+
+  std::mutex mutex_;
+
+  std::condition_variable condition_;
+
+  size_t size_ = 0;
+
+  uint64_t next_seq_ = 0;
+
+  bool closed_;
+};
+
+/**
+ * \class ThreadPool::WorkStealingScheduler
+ * \brief Per-worker Chase-Lev deques plus shared injector queues.
+ *
+ * The workers are split into groups, one per NUMA node with
+ * Options::numa_aware and a single group otherwise. Each group has an
+ * injector queue for the tasks added from outside the group.
+ *
+ * A worker looks for a task in its own deque first, then in the injector
+ * queue of its group (taking a batch of tasks into its deque), then steals
+ * from random victims of its group, and at last looks into the other
+ * groups. Workers that find nothing park on a condition variable; the
+ * submitters only take the park lock when some worker is parked.
+ *
+ * The deques only hold trivial types, so each task is moved to the heap.
+ */
+class ThreadPool::WorkStealingScheduler : public ThreadPool::Scheduler {
+ public:
+  /// `worker_nodes[i]` is the group of the i-th worker. Stamps the tasks
+  /// with `clock`, if not null.
+  WorkStealingScheduler(const ThreadPool* pool,
+                        const std::vector<size_t>& worker_nodes,
+                        Clock* clock)
+      : pool_(pool), clock_(clock), next_node_(0), num_parked_(0),
+        closed_(false) {
+    for (size_t i = 0; i < worker_nodes.size(); ++i) {
+      size_t node = worker_nodes[i];
+      while (nodes_.size() <= node) {
+        nodes_.emplace_back(new Node);
+      }
+      nodes_[node]->workers.push_back(i);
+      workers_.emplace_back(new Worker);
+      workers_.back()->node = node;
+      workers_.back()->seed = i * 0x9E3779B97F4A7C15ULL + 1;
+    }
+  }
+
+  virtual ~WorkStealingScheduler() {
+    QueuedTask* task;
+    for (auto& worker : workers_) {
+      while (worker->deque.take(&task)) {
+        delete task;
+      }
+    }
+    for (auto& node : nodes_) {
+      for (auto task : node->injector) {
+        delete task;
+      }
+    }
+  }
+
+  virtual void push(Task task, const TaskOptions& options,
+                    bool droppable) {
+    QueuedTask* ptr = new QueuedTask;
+    ptr->task = std::move(task);
+    ptr->enqueued_at = clock_ ? clock_->now() : -1;
+    ptr->droppable = droppable;
+    Worker* self = current_worker.pool == pool_ ?
+        workers_[current_worker.index].get() : nullptr;
+    size_t node;
+    if (options.node >= 0 &&
+        static_cast<size_t>(options.node) < nodes_.size()) {
+      node = options.node;
+    } else if (self) {
+      node = self->node;
+    } else {
+      node = next_node_.fetch_add(1, std::memory_order_relaxed) %
+          nodes_.size();
+    }
+    if (self && self->node == node) {
+      self->deque.push(ptr);
+    } else {
+      Node* target = nodes_[node].get();
+      std::lock_guard<std::mutex> lock(target->mutex);
+      target->injector.push_back(ptr);
+      target->injector_size.store(target->injector.size(),
+                                  std::memory_order_relaxed);
+    }
+    // Pairs with the fence in pop(): either the parking worker sees the
+    // task, or this thread sees the parked worker.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_parked_.load(std::memory_order_relaxed) > 0) {
+      wake_one();
+    }
+  }
+
+  virtual bool pop(size_t index, QueuedTask* item) {
+    while (true) {
+      QueuedTask* ptr = nullptr;
+      if (find_task(index, &ptr)) {
+        *item = std::move(*ptr);
+        delete ptr;
+        // Hands the remaining work over to a parked worker.
+        if (num_parked_.load(std::memory_order_relaxed) > 0 && has_task()) {
+          wake_one();
+        }
+        return true;
+      }
+      std::unique_lock<std::mutex> lock(park_mutex_);
+      num_parked_.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (has_task()) {
+        num_parked_.fetch_sub(1, std::memory_order_relaxed);
+        continue;
+      }
+      if (closed_) {
+        num_parked_.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+      }
+      park_cond_.wait(lock);
+      num_parked_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  /// Drops the first droppable task of an injector queue, or else steals
+  /// the oldest task of a deque. A stolen task that can not be dropped
+  /// goes to the front of the injector queue of its worker's group.
+  virtual bool drop_oldest(Task* task) {
+    QueuedTask* ptr = nullptr;
+    for (auto& node : nodes_) {
+      std::lock_guard<std::mutex> lock(node->mutex);
+      auto it = std::find_if(node->injector.begin(), node->injector.end(),
+                             [](const QueuedTask* queued) {
+                               return queued->droppable;
+                             });
+      if (it != node->injector.end()) {
+        ptr = *it;
+        node->injector.erase(it);
+        node->injector_size.store(node->injector.size(),
+                                  std::memory_order_relaxed);
+        break;
+      }
+    }
+    for (size_t i = 0; !ptr && i < workers_.size(); ++i) {
+      if (workers_[i]->deque.steal(&ptr) && !ptr->droppable) {
+        Node* node = nodes_[workers_[i]->node].get();
+        std::lock_guard<std::mutex> lock(node->mutex);
+        node->injector.push_front(ptr);
+        node->injector_size.store(node->injector.size(),
+                                  std::memory_order_relaxed);
+        ptr = nullptr;
+      }
+    }
+    if (!ptr) {
+      return false;
+    }
+    *task = std::move(ptr->task);
+    delete ptr;
+    return true;
+  }
+
+  virtual size_t size() {
+    size_t total = 0;
+    for (const auto& node : nodes_) {
+      total += node->injector_size.load(std::memory_order_relaxed);
+    }
+    for (const auto& worker : workers_) {
+      total += worker->deque.size();
+    }
+    return total;
+  }
+
+  virtual void close() {
+    std::lock_guard<std::mutex> lock(park_mutex_);
+    closed_ = true;
+    park_cond_.notify_all();
+  }
+
+ private:
+  struct Worker {
+    WorkStealingDeque<QueuedTask*> deque;
+
+    size_t node;
+
+    /// The state of the xorshift generator to pick the victims.
+    uint64_t seed;
+  };
+
+  /// A group of workers.
+  struct Node {
+    Node() : injector_size(0) {}
+
+    std::vector<size_t> workers;
+
+    std::mutex mutex;
+
+    std::deque<QueuedTask*> injector;
+
+    std::atomic<size_t> injector_size;
+
+    /// Keeps the injectors of the nodes on separate cache lines.
+    char padding[64];
+  };
+
+  bool find_task(size_t index, QueuedTask** task) {
+    Worker* self = workers_[index].get();
+    if (self->deque.take(task)) {
+      return true;
+    }
+    Node* home = nodes_[self->node].get();
+    if (take_from_injector(self, home, task) ||
+        steal_from(self, index, home, task)) {
+      return true;
+    }
+    for (size_t i = 1; i < nodes_.size(); ++i) {
+      Node* node = nodes_[(self->node + i) % nodes_.size()].get();
+      if (take_from_injector(self, node, task) ||
+          steal_from(self, index, node, task)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Steals from the workers of a node.
+  bool steal_from(Worker* self, size_t index, Node* node,
+                  QueuedTask** task) {
+    const auto& victims = node->workers;
+    size_t num_victims = victims.size();
+    for (size_t i = 0; i < 2 * num_victims; ++i) {
+      size_t victim = victims[next_random(self) % num_victims];
+      if (victim != index && workers_[victim]->deque.steal(task)) {
+        return true;
+      }
+    }
+    // Makes sure that no victim is skipped by bad luck.
+    for (size_t victim : victims) {
+      if (victim != index && workers_[victim]->deque.steal(task)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Takes one task and moves a batch of others into the worker's deque,
+  /// where the other workers can steal them.
+  bool take_from_injector(Worker* self, Node* node, QueuedTask** task) {
+    if (node->injector_size.load(std::memory_order_relaxed) == 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(node->mutex);
+    if (node->injector.empty()) {
+      return false;
+    }
+    *task = node->injector.front();
+    node->injector.pop_front();
+    size_t batch = std::min(kInjectorBatchSize,
+                            node->injector.size() / node->workers.size());
+    for (size_t i = 0; i < batch; ++i) {
+      self->deque.push(node->injector.front());
+      node->injector.pop_front();
+    }
+    node->injector_size.store(node->injector.size(),
+                              std::memory_order_relaxed);
+    return true;
+  }
+
+  bool has_task() const {
+    for (const auto& node : nodes_) {
+      if (node->injector_size.load(std::memory_order_relaxed) > 0) {
+        return true;
+      }
+    }
+    for (const auto& worker : workers_) {
+      if (!worker->deque.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void wake_one() {
+    std::lock_guard<std::mutex> lock(park_mutex_);
+    park_cond_.notify_one();
+  }
+
+  static uint64_t next_random(Worker* worker) {
+    uint64_t x = worker->seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    worker->seed = x;
+    return x;
+  }
+
+  const ThreadPool* pool_;
+
+  Clock* clock_;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::vector<std::unique_ptr<Node>> nodes_;
+
+  /// Spreads the tasks without a node hint over the nodes.
+  std::atomic<size_t> next_node_;
+
+  std::mutex park_mutex_;
+
+  std::condition_variable park_cond_;
+
+  std::atomic<int> num_parked_;
+
+  bool closed_;
+};
+
+/**
+ * \brief The metrics of one worker.
+ *
+ * Only its worker writes it, so the lock is uncontended except while
+ * metrics() reads it. The padding keeps the slots of the workers on
+ * separate cache lines.
+ */
+struct ThreadPool::WorkerSlot {
+  explicit WorkerSlot(double now) : since(now) {}
+
+  /// Called when the worker takes a task stamped at `enqueued_at`.
+  void start(double now, double enqueued_at) {
+    std::lock_guard<std::mutex> lock(mutex);
+    idle_time += now - since;
+    if (enqueued_at >= 0) {
+      queue_wait.add(now - enqueued_at);
+    }
+    busy = true;
+    since = now;
+  }
+
+  /// Called when a new worker takes over the slot of a retired one, whose
+  /// time since it went idle is not counted.
+  void restart(double now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    busy = false;
+    since = now;
+  }
+
+  /// Called when the task returns.
+  void finish(double now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    run_time.add(now - since);
+    busy_time += now - since;
+    completed++;
+    busy = false;
+    since = now;
+  }
+
+  char padding[64];
+
+  std::mutex mutex;
+
+  Histogram queue_wait;
+
+  Histogram run_time;
+
+  uint64_t completed = 0;
+
+  double busy_time = 0;
+
+  double idle_time = 0;
+
+  /// Whether the worker has been running a task since `since`, or
+  /// waiting for one.
+  bool busy = false;
+
+  double since;
+
+  char padding_end[64];
+};
+
+ThreadPool::ThreadPool() : closed_(false) {
+  start();
+}
+
+ThreadPool::ThreadPool(size_t num_threads) : closed_(false) {
+  options_.num_threads = num_threads;
+  start();
+}
+
+ThreadPool::ThreadPool(const Options& options)
+    : options_(options), closed_(false) {
+  start();
 }
 
 ThreadPool::~ThreadPool() {
-  if (!closed_) {
-    close();
-    join();
+  close();
+  join();
+}
+
+void ThreadPool::start() {
+  if (options_.num_threads == 0) {
+    options_.num_threads = kDefaultThreadsPerCpu * SysInfo::get_num_cpus();
+  }
+  elastic_ = options_.max_threads > options_.num_threads &&
+      (options_.scheduling == Scheduling::kPriority ||
+       (options_.scheduling == Scheduling::kFifo &&
+        !options_.lock_free_queue));
+  min_threads_ = options_.num_threads;
+  max_threads_ = elastic_ ? options_.max_threads : options_.num_threads;
+  place_workers();
+  // Spinning only delays the submitter on a single CPU.
+  size_t idle_spins =
+      SysInfo::get_num_cpus() > 1 ? options_.idle_spins : 0;
+  // Stamps the tasks to record their queueing delays.
+  Clock* stamp_clock = options_.collect_metrics ? clock() : nullptr;
+  switch (options_.scheduling) {
+    case Scheduling::kWorkStealing:
+      scheduler_.reset(
+          new WorkStealingScheduler(this, worker_nodes_, stamp_clock));
+      break;
+    case Scheduling::kPriority:
+      scheduler_.reset(new PriorityScheduler(
+          options_.num_priorities, options_.aging_interval,
+          clock()));
+      break;
+    default:
+      if (options_.lock_free_queue) {
+        scheduler_.reset(new LockFreeFifoScheduler(
+            this, options_.lock_free_queue_capacity, idle_spins,
+            stamp_clock));
+      } else {
+        scheduler_.reset(new FifoScheduler(
+            elastic_ ? clock() : stamp_clock, idle_spins));
+      }
+  }
+  std::lock_guard<std::mutex> lock(threads_mutex_);
+  for (size_t i = 0; i < options_.num_threads; ++i) {
+    spawn_locked();
   }
 }
 
-void ThreadPool::close() {
-  if (closed_) {
+Clock* ThreadPool::clock() const {
+  return options_.clock ? options_.clock : Clock::real_clock();
+}
+
+void ThreadPool::spawn_locked() {
+  // Reuses the slot of a retired worker.
+  size_t index = 0;
+  while (index < threads_.size() && !retired_[index]) {
+    ++index;
+  }
+  WorkerSlot* slot = nullptr;
+  if (options_.collect_metrics) {
+    if (index == slots_.size()) {
+      slots_.emplace_back(new WorkerSlot(clock()->now()));
+    } else {
+      slots_[index]->restart(clock()->now());
+    }
+    slot = slots_[index].get();
+  }
+  if (index < threads_.size()) {
+    threads_[index].join();
+    retired_[index] = false;
+    threads_[index] = thread(&ThreadPool::worker, this, index, slot);
+  } else {
+    threads_.emplace_back(thread(&ThreadPool::worker, this, index, slot));
+    retired_.push_back(false);
+  }
+  live_++;
+}
+
+void ThreadPool::maybe_grow() {
+  if (!elastic_ || closed_ || busy_.load() < live_.load() ||
+      live_.load() >= max_threads_.load()) {
+    return;
+  }
+  if (scheduler_->oldest_wait(clock()->now()) < options_.spawn_wait) {
     return;
   }
+  std::lock_guard<std::mutex> lock(threads_mutex_);
+  if (!closed_ && !joining_ && live_ < max_threads_) {
+    spawn_locked();
+  }
+}
 
-  std::unique_lock<std::mutex> lock(mutex_);
-  closed_ = true;
-  condition_.notify_all();
+bool ThreadPool::retire(size_t index, bool idle) {
+  std::lock_guard<std::mutex> lock(threads_mutex_);
+  size_t floor = idle ? min_threads_ : max_threads_.load();
+  if (joining_ || live_ <= floor) {
+    return false;
+  }
+  live_--;
+  retired_[index] = true;
+  return true;
 }
 
-void ThreadPool::join() {
-  for (auto& thd : threads_) {
-    thd.join();
+Status ThreadPool::set_thread_bounds(size_t min_threads,
+                                     size_t max_threads) {
+  if (!elastic_) {
+    return Status(-EINVAL, "The thread pool is not elastic.");
   }
+  if (min_threads == 0 || min_threads > max_threads) {
+    return Status(-EINVAL, "Invalid thread bounds.");
+  }
+  std::lock_guard<std::mutex> lock(threads_mutex_);
+  if (closed_ || joining_) {
+    return Status(-EINVAL, "The thread pool is closed.");
+  }
+  min_threads_ = min_threads;
+  max_threads_ = max_threads;
+  while (live_ < min_threads_) {
+    spawn_locked();
+  }
+  return Status::OK;
 }
 
-ThreadPool::FutureType ThreadPool::add_task(TaskType func) {
-  FutureType future;
-  PackagedTask task(func);
+void ThreadPool::place_workers() {
+  size_t num_workers = options_.num_threads;
+  // The elastic pools reuse the slots of the retired workers, so there are
+  // at most max_threads_ slots, unless the bounds are raised later.
+  num_workers = std::max<size_t>(num_workers, max_threads_);
+  worker_nodes_.assign(num_workers, 0);
+  worker_cpus_.assign(num_workers, std::vector<int>());
+  if (!options_.pin_threads && !options_.numa_aware) {
+    return;
+  }
+  const CpuTopology& topology =
+      options_.topology ? *options_.topology : CpuTopology::machine();
+  size_t num_nodes = topology.num_nodes();
+  if (num_nodes == 0) {
+    return;
+  }
+  // Interleaves the CPUs of the nodes, so that consecutive workers go to
+  // different nodes.
+  std::vector<int> cpu_order;
+  for (size_t k = 0; cpu_order.size() < topology.num_cpus(); ++k) {
+    for (size_t node = 0; node < num_nodes; ++node) {
+      const auto& cpus = topology.cpus_of_node(node);
+      if (k < cpus.size()) {
+        cpu_order.push_back(cpus[k]);
+      }
+    }
+  }
+  for (size_t i = 0; i < num_workers; ++i) {
+    size_t node = i % num_nodes;
+    if (options_.numa_aware) {
+      if (options_.scheduling == Scheduling::kWorkStealing) {
+        worker_nodes_[i] = node;
+      }
+      const auto& cpus = topology.cpus_of_node(node);
+      if (options_.pin_threads) {
+        worker_cpus_[i].push_back(cpus[(i / num_nodes) % cpus.size()]);
+      } else {
+        worker_cpus_[i] = cpus;
+      }
+    } else {
+      worker_cpus_[i].push_back(cpu_order[i % cpu_order.size()]);
+    }
+  }
+}
+
+void ThreadPool::close() {
+  if (closed_.exchange(true)) {
+    return;
+  }
+  scheduler_->close();
+}
+
+void ThreadPool::join() {
+  std::vector<thread> threads;
   {
-    std::unique_lock<std::mutex> lock(mutex_);
-    future = task.get_future();
-    task_queue_.push(std::move(task));
-    condition_.notify_one();
+    // Stops spawning and retiring the workers.
+    std::lock_guard<std::mutex> lock(threads_mutex_);
+    joining_ = true;
+    threads.swap(threads_);
+  }
+  for (auto& thd : threads) {
+    if (thd.joinable()) {
+      thd.join();
+    }
   }
-  return future;
 }
 
-size_t ThreadPool::num_threads() const {
-  return threads_.size();
+bool ThreadPool::in_task() const {
+  return current_worker.pool == this || current_worker.caller_runs == this;
+}
+
+ThreadPool::Admission ThreadPool::admit(Submission submission) {
+  int64_t capacity = options_.queue_capacity;
+  int64_t queued = queued_.load();
+  while (queued < capacity) {
+    if (queued_.compare_exchange_weak(queued, queued + 1)) {
+      return Admission::kQueue;
+    }
+  }
+  Overflow overflow = options_.overflow;
+  if (submission == Submission::kTry) {
+    overflow = Overflow::kReject;
+  } else if (submission == Submission::kExecute &&
+             overflow != Overflow::kCallerRuns) {
+    overflow = Overflow::kBlock;
+  }
+  switch (overflow) {
+    case Overflow::kBlock:
+      return wait_for_room();
+    case Overflow::kCallerRuns:
+      if (in_task()) {
+        return wait_for_room();
+      }
+      caller_runs_++;
+      return Admission::kRunInline;
+    case Overflow::kDropOldest: {
+      // The new task takes over the slot of the dropped one.
+      Task oldest;
+      if (scheduler_->drop_oldest(&oldest)) {
+        dropped_++;
+        return Admission::kQueue;
+      }
+      return wait_for_room();
+    }
+    default:
+      rejected_++;
+      return Admission::kReject;
+  }
 }
 
-void ThreadPool::worker() {
+ThreadPool::Admission ThreadPool::wait_for_room() {
+  if (in_task()) {
+    // Waiting could dead-lock, and running inline could recurse without
+    // bound, e.g., a Strand that re-posts its drain task.
+    queued_++;
+    return Admission::kQueue;
+  }
+  int64_t capacity = options_.queue_capacity;
+  std::unique_lock<std::mutex> lock(blocked_mutex_);
+  num_blocked_++;
   while (true) {
-    PackagedTask task;
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
+    int64_t queued = queued_.load();
+    if (queued >= capacity) {
+      not_full_.wait(lock);
+    } else if (queued_.compare_exchange_weak(queued, queued + 1)) {
+      break;
+    }
+  }
+  num_blocked_--;
+  return Admission::kQueue;
+}
 
-      while (!closed_ && task_queue_.empty()) {
-        condition_.wait(lock);
-      }
+void ThreadPool::enqueue(Task task, const TaskOptions& options,
+                         bool droppable) {
+  scheduler_->push(std::move(task), options, droppable);
+  maybe_grow();
+}
 
-      if (closed_ && task_queue_.empty()) {
-        break;
+void ThreadPool::run_inline(Task* task) {
+  const ThreadPool* outer = current_worker.caller_runs;
+  current_worker.caller_runs = this;
+  (*task)();
+  current_worker.caller_runs = outer;
+}
+
+void ThreadPool::release_slot() {
+  queued_--;
+  if (num_blocked_.load() > 0) {
+    std::lock_guard<std::mutex> lock(blocked_mutex_);
+    not_full_.notify_one();
+  }
+}
+
+void ThreadPool::execute(Task task) {
+  execute(std::move(task), TaskOptions());
+}
+
+void ThreadPool::execute(Task task, const TaskOptions& options) {
+  if (options_.queue_capacity > 0 &&
+      admit(Submission::kExecute) == Admission::kRunInline) {
+    run_inline(&task);
+    return;
+  }
+  enqueue(std::move(task), options, false);
+}
+
+ThreadPool::FutureType ThreadPool::add_task(TaskType task) {
+  return add_task(std::move(task), TaskOptions());
+}
+
+ThreadPool::FutureType ThreadPool::add_task(TaskType task,
+                                            const TaskOptions& options) {
+  std::promise<ReturnType> promise;
+  FutureType future = promise.get_future();
+  Admission admission = options_.queue_capacity > 0 ?
+      admit(Submission::kTask) : Admission::kQueue;
+  if (admission == Admission::kReject) {
+    promise.set_value(Status(-EAGAIN, "The task queue is full."));
+    return future;
+  }
+  Task wrapped(internal::PromiseTask<ReturnType, TaskType>(
+      std::move(promise), std::move(task)));
+  if (admission == Admission::kQueue) {
+    enqueue(std::move(wrapped), options, true);
+  } else {
+    run_inline(&wrapped);
+  }
+  return future;
+}
+
+Status ThreadPool::try_add_task(TaskType task, FutureType* future) {
+  if (options_.queue_capacity > 0 &&
+      admit(Submission::kTry) == Admission::kReject) {
+    return Status(-EAGAIN, "The task queue is full.");
+  }
+  std::promise<ReturnType> promise;
+  if (future) {
+    *future = promise.get_future();
+  }
+  enqueue(Task(internal::PromiseTask<ReturnType, TaskType>(
+      std::move(promise), std::move(task))), TaskOptions(), false);
+  return Status::OK;
+}
+
+Status ThreadPool::try_execute(Task task) {
+  return try_execute(std::move(task), TaskOptions());
+}
+
+Status ThreadPool::try_execute(Task task, const TaskOptions& options) {
+  if (options_.queue_capacity > 0 &&
+      admit(Submission::kTry) == Admission::kReject) {
+    return Status(-EAGAIN, "The task queue is full.");
+  }
+  enqueue(std::move(task), options, false);
+  return Status::OK;
+}
+
+size_t ThreadPool::queue_depth() const {
+  if (options_.queue_capacity == 0) {
+    return scheduler_->size();
+  }
+  return std::max<int64_t>(queued_.load(), 0);
+}
+
+std::vector<Histogram> ThreadPool::queue_wait_times() const {
+  return scheduler_->wait_times();
+}
+
+ThreadPool::Metrics ThreadPool::metrics() const {
+  Metrics metrics;
+  std::lock_guard<std::mutex> lock(threads_mutex_);
+  metrics.queue_depth = queue_depth();
+  metrics.num_threads = live_;
+  double now = clock()->now();
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    WorkerSlot* slot = slots_[i].get();
+    WorkerMetrics worker;
+    {
+      std::lock_guard<std::mutex> slot_lock(slot->mutex);
+      metrics.queue_wait.merge(slot->queue_wait);
+      metrics.run_time.merge(slot->run_time);
+      worker.completed = slot->completed;
+      worker.busy_time = slot->busy_time;
+      worker.idle_time = slot->idle_time;
+      // Counts the current span, unless the worker has exited.
+      if (!joining_ && !retired_[i]) {
+        double span = std::max(now - slot->since, 0.0);
+        (slot->busy ? worker.busy_time : worker.idle_time) += span;
       }
+    }
+    metrics.completed += worker.completed;
+    metrics.busy_time += worker.busy_time;
+    metrics.idle_time += worker.idle_time;
+    metrics.workers.push_back(worker);
+  }
+  return metrics;
+}
+
+double ThreadPool::Metrics::utilization() const {
+  double total = busy_time + idle_time;
+  return total > 0 ? busy_time / total : 0;
+}
 
-      task = std::move(task_queue_.front());
-      task_queue_.pop();
+double ThreadPool::Metrics::utilization_since(const Metrics& earlier) const {
+  double busy = busy_time - earlier.busy_time;
+  double total = busy + idle_time - earlier.idle_time;
+  return total > 0 ? busy / total : 0;
+}
+
+size_t ThreadPool::num_threads() const {
+  return live_;
+}
+
+size_t ThreadPool::num_busy_threads() const {
+  return busy_;
+}
+
+double ThreadPool::utilization() const {
+  size_t live = live_;
+  return live ? static_cast<double>(busy_) / live : 0;
+}
+
+size_t ThreadPool::num_nodes() const {
+  return *std::max_element(worker_nodes_.begin(), worker_nodes_.end()) + 1;
+}
+
+size_t ThreadPool::node_of_worker(size_t index) const {
+  return worker_nodes_[index];
+}
+
+const std::vector<int>& ThreadPool::cpus_of_worker(size_t index) const {
+  static const std::vector<int> kNoCpus;
+  return index < worker_cpus_.size() ? worker_cpus_[index] : kNoCpus;
+}
+
+void ThreadPool::worker(size_t index, WorkerSlot* slot) {
+  current_worker.pool = this;
+  current_worker.index = index;
+  const std::vector<int>& cpus = cpus_of_worker(index);
+  if (!cpus.empty()) {
+    Status status = CpuTopology::set_thread_affinity(cpus);
+    if (!status.ok()) {
+      LOG(WARNING) << "Failed to set the CPU affinity of worker " << index
+                   << ": " << status.message();
+    }
+  }
+  QueuedTask item;
+  Task& task = item.task;
+  while (true) {
+    bool timed_out = false;
+    bool popped = elastic_ ?
+        scheduler_->pop_for(index, &item, options_.idle_timeout, &timed_out) :
+        scheduler_->pop(index, &item);
+    if (!popped) {
+      if (timed_out && !retire(index, true)) {
+        continue;
+      }
+      break;
+    }
+    if (options_.queue_capacity > 0) {
+      release_slot();
+    }
+    if (elastic_) {
+      busy_++;
+      maybe_grow();
+    }
+    if (slot) {
+      slot->start(clock()->now(), item.enqueued_at);
     }
     task();
+    // Releases the captured states before waiting for the next task.
+    task.reset();
+    if (slot) {
+      slot->finish(clock()->now());
+    }
+    if (elastic_) {
+      busy_--;
+      if (live_ > max_threads_ && retire(index, false)) {
+        break;
+      }
+    }
   }
+  current_worker.pool = nullptr;
 }
 
 }  // namespace vobla
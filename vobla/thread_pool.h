@@ -17,23 +17,78 @@
 #ifndef VOBLA_THREAD_POOL_H_
 #define VOBLA_THREAD_POOL_H_
 
-#include <boost/utility.hpp>
+#include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <utility>
 #include <vector>
+#include "vobla/clock.h"
+#include "vobla/cpu_topology.h"
+#include "vobla/executor.h"
+#include "vobla/histogram.h"
 #include "vobla/status.h"
+#include "vobla/task.h"
 
 namespace vobla {
 
 /**
  * \class ThreadPool
- * \brief A simple FIFO-queue based thread pool.
+ * \brief A thread pool with a choice of scheduling policies.
+ *
+ * By default, all workers share one FIFO queue. With
+ * Scheduling::kWorkStealing, each worker owns a deque: the tasks added from
+ * a worker go to its own deque, the tasks added from other threads go to a
+ * shared injector queue, and idle workers steal from random victims. It
+ * suits many fine-grained (or recursively spawned) tasks, at the cost of
+ * not keeping the global FIFO order.
+ *
+ * With Scheduling::kPriority, each task has a priority class (0 is the most
+ * urgent) and an optional deadline, given by TaskOptions. A worker takes
+ * the task of the most urgent class, in the earliest-deadline-first order
+ * within the class. The tasks without a deadline are ordered by their
+ * enqueue time, as if it was their deadline. To avoid starvation, a task
+ * is promoted by one class for each Options::aging_interval it waits.
+ * queue_wait_times() reports the queueing delays of each class.
+ *
+ * Options::pin_threads and Options::numa_aware place the workers on the
+ * CPUs and the NUMA nodes found in CpuTopology. With work stealing, a
+ * NUMA-aware pool has one sub-pool per node, and TaskOptions::node sends a
+ * task to the sub-pool of a node.
+ *
+ * With Options::lock_free_queue, the FIFO queue is a lock-free MPMCQueue
+ * and idle workers park on an EventCount, so adding a task takes a couple
+ * of atomic operations and no lock.
+ *
+ * Options::queue_capacity bounds the number of queued tasks, under any
+ * scheduling policy. When the queue is full, Options::overflow decides
+ * whether add_task() blocks, fails, runs the task in the calling thread, or
+ * drops the oldest queued task. The Executor interface never loses a task:
+ * execute() only blocks or runs the task in the calling thread, and the
+ * tasks of the pool queue their new tasks over the capacity instead of
+ * waiting for themselves or running the new tasks on their own stacks.
+ * try_add_task() and try_execute() never block, and report a full queue.
+ *
+ * With Options::collect_metrics, each worker records the queueing delays
+ * and the run times of its tasks, and its busy and idle times, in its own
+ * slot. metrics() aggregates the slots into a snapshot on demand.
+ *
+ * Besides add_task(), the tasks can be added with the Executor interface:
+ * post() runs a callable with no future (and, for the FIFO queues, no
+ * allocation for small callables), and submit() returns a future of the
+ * callable's own result type.
+ *
+ * ~~~~~~~~~{cpp}
+ * ThreadPool pool;
+ * pool.post([&] { counter++; });
+ * std::future<int> answer = pool.submit([] { return 42; });
+ * ~~~~~~~~~
  */
-class ThreadPool : boost::noncopyable {
+class ThreadPool : public Executor {
  public:
   typedef Status ReturnType;
 
@@ -41,12 +96,203 @@ class ThreadPool : boost::noncopyable {
 
   typedef std::future<ReturnType> FutureType;
 
+  /**
+   * \brief What adding a task does when the queue is full.
+   *
+   * Whatever the policy, a task added from a task of this pool goes over
+   * the capacity rather than waiting or running inline, since the pool
+   * could not drain the queue while its tasks wait for it.
+   */
+  enum class Overflow {
+    /// Waits for room.
+    kBlock,
+    /// Fails: add_task() returns a future of -EAGAIN. execute() waits for
+    /// room as with kBlock.
+    kReject,
+    /// Runs the task in the calling thread.
+    kCallerRuns,
+    /// Drops the oldest task queued by add_task() (with
+    /// Scheduling::kPriority, from the least urgent class) to make room.
+    /// The future of the dropped task throws std::future_error
+    /// (broken_promise). The other tasks are never dropped: if none can
+    /// be dropped, or for execute(), it waits for room as with kBlock.
+    kDropOldest,
+  };
+
+  /// How the tasks are dispatched to the workers.
+  enum class Scheduling {
+    /// One FIFO queue shared by all workers.
+    kFifo,
+    /// Per-worker deques with work stealing.
+    kWorkStealing,
+    /// Priority classes with earliest-deadline-first ordering.
+    kPriority,
+  };
+
+  /// The options to construct a ThreadPool.
+  struct Options {
+    /// The number of threads. 0 means `2 * num_cpus`. It is the minimal
+    /// number of threads of an elastic pool.
+    size_t num_threads = 0;
+
+    /**
+     * \brief The maximal number of threads of an elastic pool.
+     *
+     * If larger than num_threads, the pool spawns a thread when a task is
+     * added or taken while all threads are busy and the oldest task has
+     * waited more than spawn_wait, and the extra threads exit after being
+     * idle for idle_timeout. It only applies to Scheduling::kFifo (without
+     * lock_free_queue) and Scheduling::kPriority.
+     */
+    size_t max_threads = 0;
+
+    /// The queueing delay in seconds that makes an elastic pool grow.
+    double spawn_wait = 0.01;
+
+    /// The idle time in seconds after which the extra threads exit.
+    double idle_timeout = 60;
+
+    Scheduling scheduling = Scheduling::kFifo;
+
+    /**
+     * \brief Uses a lock-free bounded ring buffer as the FIFO queue.
+     *
+     * add_task() waits while the ring is full, except in the workers of
+     * this pool, which queue the task into a locked overflow list that the
+     * workers drain first. It only applies to Scheduling::kFifo.
+     */
+    bool lock_free_queue = false;
+
+    /// The capacity of the lock-free queue.
+    size_t lock_free_queue_capacity = 65536;
+
+    /**
+     * \brief The maximal number of pause loops that an idle worker spins
+     * on the FIFO queue before parking.
+     *
+     * Each worker adapts its own budget up to this value, so that short
+     * gaps between tasks do not cost a futex wake-up, while idle workers
+     * soon stop burning CPU. 0, the default, parks right away; compare
+     * e.g. 4000 with thread_pool_bench before turning it on. It is ignored
+     * on single-CPU machines.
+     */
+    size_t idle_spins = 0;
+
+    /// The maximal number of queued tasks. 0 means unbounded.
+    size_t queue_capacity = 0;
+
+    /// The policy when queue_capacity is reached.
+    Overflow overflow = Overflow::kBlock;
+
+    /// Records the per-worker metrics returned by metrics(). It costs two
+    /// clock reads and two uncontended locks per task.
+    bool collect_metrics = false;
+
+    /// The number of priority classes of Scheduling::kPriority.
+    size_t num_priorities = 3;
+
+    /// The waiting time in seconds that promotes a task by one class. 0
+    /// disables aging.
+    double aging_interval = 1;
+
+    /// The clock of the deadlines and the waiting times. Defaults to the
+    /// real clock.
+    Clock* clock = nullptr;
+
+    /// Pins each worker to one CPU. The consecutive workers go to
+    /// different NUMA nodes.
+    bool pin_threads = false;
+
+    /**
+     * \brief Spreads the workers over the NUMA nodes, and binds each worker
+     * to the CPUs of its node (or to one of them with pin_threads).
+     *
+     * With Scheduling::kWorkStealing, the workers of each node also form a
+     * sub-pool with its own injector queue, which takes the tasks hinted by
+     * TaskOptions::node; the idle workers steal from their own node first.
+     */
+    bool numa_aware = false;
+
+    /// The topology to place the workers on. Defaults to
+    /// CpuTopology::machine().
+    const CpuTopology* topology = nullptr;
+  };
+
+  /// The scheduling hints of a task, used by Scheduling::kPriority.
+  struct TaskOptions {
+    /// The priority class, from 0 (the most urgent) to `num_priorities - 1`.
+    size_t priority = 0;
+
+    /// The deadline as a timestamp of Options::clock. 0 means none.
+    double deadline = 0;
+
+    /// The NUMA node to run the task on, with Options::numa_aware and
+    /// Scheduling::kWorkStealing. -1 means any node.
+    int node = -1;
+  };
+
+  /// The metrics of one worker slot. The workers of an elastic pool that
+  /// reuse the slot of a retired worker add to its metrics.
+  struct WorkerMetrics {
+    /// The number of tasks run.
+    uint64_t completed = 0;
+
+    /// The seconds spent running tasks.
+    double busy_time = 0;
+
+    /// The seconds spent waiting for tasks.
+    double idle_time = 0;
+  };
+
+  /**
+   * \brief A snapshot of the metrics recorded with Options::collect_metrics.
+   *
+   * The counters, the times and the histograms are cumulative since the
+   * pool started. To get the rates over an interval, e.g., to drive an
+   * autoscaler, take snapshots periodically and diff them, as
+   * utilization_since() does.
+   */
+  struct Metrics {
+    /// The seconds between adding and starting each task. The tasks run
+    /// in the calling thread are not counted.
+    Histogram queue_wait;
+
+    /// The seconds that each task ran.
+    Histogram run_time;
+
+    /// The number of tasks run by the workers.
+    uint64_t completed = 0;
+
+    /// The total busy and idle seconds of the workers, including the
+    /// current task or wait of each worker.
+    double busy_time = 0;
+
+    double idle_time = 0;
+
+    /// The number of queued tasks at the time of the snapshot.
+    size_t queue_depth = 0;
+
+    size_t num_threads = 0;
+
+    /// Indexed by the worker slot.
+    std::vector<WorkerMetrics> workers;
+
+    /// Returns the fraction of the worker time spent running tasks.
+    double utilization() const;
+
+    /// Returns the utilization between an earlier snapshot and this one.
+    double utilization_since(const Metrics& earlier) const;
+  };
+
   /// Constructs a thread pool with `2 * num_cpus` threads.
   ThreadPool();
 
   /// Constructs a thread pool with 'num_threads' threads.
   explicit ThreadPool(size_t num_threads);
 
+  /// Constructs a thread pool with the given options.
+  explicit ThreadPool(const Options& options);
+
   virtual ~ThreadPool();
 
   /// Closes this pool.
@@ -55,6 +301,25 @@ class ThreadPool : boost::noncopyable {
   /// Waits all tasks to finish.
   virtual void join();
 
+  using Executor::post;
+
+  /**
+   * \brief Adds a task to the task queue.
+   *
+   * The task always runs: if the queue is full, it waits for room, or runs
+   * the task in the calling thread with Overflow::kCallerRuns.
+   */
+  virtual void execute(Task task);
+
+  /// Adds a task with scheduling hints.
+  virtual void execute(Task task, const TaskOptions& options);
+
+  /// Runs a callable with no result, with scheduling hints.
+  template <typename F>
+  void post(const TaskOptions& options, F&& func) {
+    execute(Task(std::forward<F>(func)), options);
+  }
+
   /**
    * \brief Add a task to the task queue.
    *
@@ -62,25 +327,235 @@ class ThreadPool : boost::noncopyable {
    */
   virtual FutureType add_task(TaskType task);
 
+  /// Adds a task with scheduling hints.
+  virtual FutureType add_task(TaskType task, const TaskOptions& options);
+
+  /**
+   * \brief Adds a task if the queue is not full, without blocking.
+   * \param[out] future set to the future of the task, if not null.
+   * \return -EAGAIN if the queue is full, whatever Options::overflow is.
+   */
+  Status try_add_task(TaskType task, FutureType* future = nullptr);
+
+  /// Adds a task if the queue is not full. Returns -EAGAIN otherwise.
+  Status try_execute(Task task);
+
+  /// Adds a task with scheduling hints if the queue is not full.
+  Status try_execute(Task task, const TaskOptions& options);
+
+  /// Runs a callable with no result if the queue is not full.
+  template <typename F>
+  Status try_post(F&& func) {
+    return try_execute(Task(std::forward<F>(func)));
+  }
+
+  /// Returns the number of queued tasks.
+  size_t queue_depth() const;
+
+  /// Returns the number of tasks rejected because the queue was full.
+  uint64_t num_rejected() const {
+    return rejected_;
+  }
+
+  /// Returns the number of tasks dropped by Overflow::kDropOldest.
+  uint64_t num_dropped() const {
+    return dropped_;
+  }
+
+  /// Returns the number of tasks run in the calling thread because the
+  /// queue was full.
+  uint64_t num_caller_runs() const {
+    return caller_runs_;
+  }
+
   /// Returns the number of working threads
   size_t num_threads() const;
 
+  /// Returns true if the number of threads changes with the load.
+  bool elastic() const {
+    return elastic_;
+  }
+
+  /**
+   * \brief Changes the bounds of the number of threads of an elastic pool.
+   *
+   * It spawns threads up to `min_threads` right away, while the threads
+   * beyond `max_threads` exit when they finish their current tasks.
+   */
+  Status set_thread_bounds(size_t min_threads, size_t max_threads);
+
+  /// Returns the number of threads running a task. Only tracked by the
+  /// elastic pools.
+  size_t num_busy_threads() const;
+
+  /// Returns the fraction of the threads that are running a task. Only
+  /// tracked by the elastic pools.
+  double utilization() const;
+
+  /// Returns the scheduling policy.
+  Scheduling scheduling() const {
+    return options_.scheduling;
+  }
+
+  /// Returns the number of worker groups, i.e., the NUMA nodes with
+  /// Options::numa_aware and Scheduling::kWorkStealing, or 1.
+  size_t num_nodes() const;
+
+  /// Returns the worker group of a worker.
+  size_t node_of_worker(size_t index) const;
+
+  /// Returns the CPUs that a worker is bound to. Empty if not bound.
+  const std::vector<int>& cpus_of_worker(size_t index) const;
+
+  /**
+   * \brief Returns the histograms of the queueing delays in seconds, one
+   * per priority class.
+   *
+   * It is only recorded with Scheduling::kPriority, and is empty otherwise.
+   */
+  std::vector<Histogram> queue_wait_times() const;
+
+  /// Returns true if the pool records metrics().
+  bool collects_metrics() const {
+    return options_.collect_metrics;
+  }
+
+  /// Aggregates the metrics of the workers. The histograms and the
+  /// per-worker metrics are empty without Options::collect_metrics.
+  Metrics metrics() const;
+
  private:
-  void worker();
+  /// Decides the order in which the workers run the tasks.
+  class Scheduler;
+
+  class FifoScheduler;
+
+  class LockFreeFifoScheduler;
 
-  size_t num_threads_;
+  class PriorityScheduler;
+
+  class WorkStealingScheduler;
+
+  /// The metrics recorded by one worker.
+  struct WorkerSlot;
+
+  /// What to do with a new task.
+  enum class Admission {
+    kQueue,
+    kRunInline,
+    kReject,
+  };
+
+  /// How a new task is added to a full queue.
+  enum class Submission {
+    /// try_add_task() and try_execute() fail.
+    kTry,
+    /// add_task() applies Options::overflow.
+    kTask,
+    /// execute() only blocks or runs the task in the calling thread.
+    kExecute,
+  };
+
+  void start();
+
+  Clock* clock() const;
+
+  /// Returns true if the calling thread is running a task of this pool.
+  bool in_task() const;
+
+  /**
+   * \brief Takes a slot of the queue for a new task, applying the overflow
+   * policy if it is full. Only called with Options::queue_capacity.
+   */
+  Admission admit(Submission submission);
+
+  /// Takes a slot once the queue has room, or over the capacity from a
+  /// task of this pool.
+  Admission wait_for_room();
+
+  /**
+   * \brief Pushes an admitted task to the scheduler.
+   * \param droppable whether Overflow::kDropOldest can drop it.
+   */
+  void enqueue(Task task, const TaskOptions& options, bool droppable);
+
+  /// Runs a task in the calling thread, with Overflow::kCallerRuns.
+  void run_inline(Task* task);
+
+  /// Frees the slot of a task taken by a worker.
+  void release_slot();
+
+  /// Starts a worker. The caller holds threads_mutex_.
+  void spawn_locked();
+
+  /// Spawns a worker if all workers are busy and the tasks wait too long.
+  void maybe_grow();
+
+  /**
+   * \brief Lets a worker exit if there are more than min_threads_ (if it
+   * is idle) or max_threads_ workers.
+   */
+  bool retire(size_t index, bool idle);
+
+  /// Decides the group and the CPUs of each worker.
+  void place_workers();
+
+  /// Runs the tasks. `slot` is null without Options::collect_metrics.
+  void worker(size_t index, WorkerSlot* slot);
+
+  Options options_;
+
+  /// Guards threads_, retired_, slots_ and min_threads_, and serializes
+  /// the changes of the number of threads.
+  mutable std::mutex threads_mutex_;
 
   std::vector<std::thread> threads_;
 
-  typedef std::packaged_task<ReturnType()> PackagedTask;
+  /// Whether the worker of each slot has exited.
+  std::vector<bool> retired_;
+
+  /// The metrics of each worker slot, with Options::collect_metrics.
+  std::vector<std::unique_ptr<WorkerSlot>> slots_;
+
+  /// Set by join().
+  bool joining_ = false;
+
+  bool elastic_ = false;
+
+  size_t min_threads_ = 0;
+
+  std::atomic<size_t> max_threads_{0};
+
+  /// The number of the workers that have not retired.
+  std::atomic<size_t> live_{0};
+
+  std::atomic<size_t> busy_{0};
+
+  std::vector<size_t> worker_nodes_;
+
+  std::vector<std::vector<int>> worker_cpus_;
+
+  std::unique_ptr<Scheduler> scheduler_;
+
+  /// The number of queued tasks, counting the ones being pushed. Only
+  /// counted with Options::queue_capacity, so that an unbounded pool does
+  /// not share a counter on every task.
+  std::atomic<int64_t> queued_{0};
+
+  /// The number of submitters waiting with Overflow::kBlock.
+  std::atomic<int> num_blocked_{0};
+
+  std::mutex blocked_mutex_;
+
+  std::condition_variable not_full_;
 
-  std::queue<PackagedTask> task_queue_;
+  std::atomic<uint64_t> rejected_{0};
 
-  std::mutex mutex_;
+  std::atomic<uint64_t> dropped_{0};
 
-  std::condition_variable condition_;
+  std::atomic<uint64_t> caller_runs_{0};
 
-  bool closed_;
+  std::atomic<bool> closed_;
 };
 
 }  // namespace vobla
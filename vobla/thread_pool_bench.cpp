@@ -0,0 +1,276 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/thread_pool_bench.cpp
+ * \brief Measures the throughput of ThreadPool on fine-grained tasks.
+ *
+ * Usage: thread_pool_bench [NUM_TASKS]
+ *
+ * - flat: the main thread adds NUM_TASKS empty tasks with add_task().
+ * - post: the same tasks with post(), which has no future to fulfill.
+ * - fork: each task adds two children until NUM_TASKS tasks have run, as
+ *   in divide-and-conquer algorithms.
+ *
+ * Both run with 1, 2, 4, ... up to 2 * num_cpus threads for each
+ * scheduling policy.
+ *
+ * - mixed: a backlog of 200 us background tasks, plus a 1 ms foreground
+ *   task every millisecond. It reports the queueing delays of the
+ *   foreground tasks with the FIFO queue and with priority classes.
+ * - ping-pong: the main thread posts one empty task and waits for it to
+ *   run, NUM_TASKS / 100 times, and reports the round-trip latencies.
+ * - bursty: bursts of 32 tasks separated by 200 us of sleep, reporting
+ *   the queueing delays of the tasks.
+ *
+ * The latencies are measured with the FIFO queues, with and without
+ * spinning the idle workers (Options::idle_spins).
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vobla/clock.h"
+#include "vobla/histogram.h"
+#include "vobla/status.h"
+#include "vobla/sysinfo.h"
+#include "vobla/thread_pool.h"
+#include "vobla/timer.h"
+
+using std::string;
+using std::vector;
+using vobla::Clock;
+using vobla::Histogram;
+using vobla::Status;
+using vobla::SysInfo;
+using vobla::ThreadPool;
+using vobla::Timer;
+
+namespace {
+
+void wait_for(const std::atomic<int64_t>& counter, int64_t expected) {
+  while (counter.load() < expected) {
+    std::this_thread::yield();
+  }
+}
+
+/// Returns million tasks per second.
+double run_flat(ThreadPool* pool, int64_t num_tasks) {
+  std::atomic<int64_t> done(0);
+  Timer timer;
+  timer.start();
+  for (int64_t i = 0; i < num_tasks; i++) {
+    pool->add_task([&done]() -> Status {
+        done++;
+        return Status::OK;
+      });
+  }
+  wait_for(done, num_tasks);
+  timer.stop();
+  return num_tasks / timer.get_in_second() / 1e6;
+}
+
+/// Returns million tasks per second.
+double run_post(ThreadPool* pool, int64_t num_tasks) {
+  std::atomic<int64_t> done(0);
+  Timer timer;
+  timer.start();
+  for (int64_t i = 0; i < num_tasks; i++) {
+    pool->post([&done] { done++; });
+  }
+  wait_for(done, num_tasks);
+  timer.stop();
+  return num_tasks / timer.get_in_second() / 1e6;
+}
+
+/// Returns million tasks per second.
+double run_fork(ThreadPool* pool, int64_t num_tasks) {
+  int depth = 0;
+  while ((int64_t(2) << depth) - 1 < num_tasks) {
+    depth++;
+  }
+  int64_t total = (int64_t(2) << depth) - 1;
+  std::atomic<int64_t> done(0);
+  std::function<Status(int)> spawn = [&](int level) -> Status {
+    if (level > 0) {
+      pool->add_task(std::bind(spawn, level - 1));
+      pool->add_task(std::bind(spawn, level - 1));
+    }
+    done++;
+    return Status::OK;
+  };
+  Timer timer;
+  timer.start();
+  pool->add_task(std::bind(spawn, depth));
+  wait_for(done, total);
+  timer.stop();
+  return total / timer.get_in_second() / 1e6;
+}
+
+void spin_for(double seconds) {
+  double until = Clock::real_clock()->now() + seconds;
+  while (Clock::real_clock()->now() < until) {
+  }
+}
+
+/// Returns the queueing delays of the foreground tasks.
+Histogram run_mixed(ThreadPool::Scheduling scheduling, size_t num_threads) {
+  const int kNumForeground = 200;
+  ThreadPool::Options options;
+  options.num_threads = num_threads;
+  options.scheduling = scheduling;
+  ThreadPool pool(options);
+  ThreadPool::TaskOptions background;
+  background.priority = 2;
+  for (size_t i = 0; i < 2000 * num_threads; i++) {
+    pool.post(background, [] { spin_for(200e-6); });
+  }
+  std::mutex mutex;
+  Histogram waits;
+  std::atomic<int64_t> done(0);
+  for (int i = 0; i < kNumForeground; i++) {
+    double submitted = Clock::real_clock()->now();
+    pool.post(ThreadPool::TaskOptions(), [&, submitted] {
+        double wait = Clock::real_clock()->now() - submitted;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          waits.add(wait);
+        }
+        done++;
+      });
+    spin_for(1e-3);
+  }
+  wait_for(done, kNumForeground);
+  return waits;
+}
+
+/// Returns the round-trip latencies of single tasks.
+Histogram run_ping_pong(ThreadPool* pool, int64_t rounds) {
+  Histogram latencies;
+  Clock* clock = Clock::real_clock();
+  for (int64_t i = 0; i < rounds; i++) {
+    std::atomic<bool> done(false);
+    double start = clock->now();
+    pool->post([&done] { done = true; });
+    while (!done.load()) {
+      std::this_thread::yield();
+    }
+    latencies.add(clock->now() - start);
+  }
+  return latencies;
+}
+
+/// Returns the queueing delays of the tasks submitted in bursts.
+Histogram run_bursty(ThreadPool* pool, int64_t num_bursts) {
+  const int kBurstSize = 32;
+  Clock* clock = Clock::real_clock();
+  std::mutex mutex;
+  Histogram waits;
+  std::atomic<int64_t> done(0);
+  for (int64_t i = 0; i < num_bursts; i++) {
+    for (int j = 0; j < kBurstSize; j++) {
+      double submitted = clock->now();
+      pool->post([&, submitted] {
+          double wait = clock->now() - submitted;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            waits.add(wait);
+          }
+          done++;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  wait_for(done, num_bursts * kBurstSize);
+  return waits;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int64_t num_tasks = argc > 1 ? strtoll(argv[1], nullptr, 10) : 1000000;
+  size_t max_threads = 2 * SysInfo::get_num_cpus();
+
+  struct Mode {
+    string name;
+    ThreadPool::Scheduling scheduling;
+    bool lock_free_queue;
+  };
+  vector<Mode> modes = {
+    { "fifo", ThreadPool::Scheduling::kFifo, false },
+    { "fifo_lock_free", ThreadPool::Scheduling::kFifo, true },
+    { "work_stealing", ThreadPool::Scheduling::kWorkStealing, false },
+  };
+
+  printf("%-16s %8s %14s %14s %14s\n", "scheduling", "threads",
+         "flat Mtasks/s", "post Mtasks/s", "fork Mtasks/s");
+  for (const auto& mode : modes) {
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+      ThreadPool::Options options;
+      options.num_threads = threads;
+      options.scheduling = mode.scheduling;
+      options.lock_free_queue = mode.lock_free_queue;
+      ThreadPool pool(options);
+      double flat = run_flat(&pool, num_tasks);
+      double post = run_post(&pool, num_tasks);
+      double fork = run_fork(&pool, num_tasks);
+      printf("%-16s %8lu %14.2f %14.2f %14.2f\n", mode.name.c_str(),
+             static_cast<unsigned long>(threads), flat, post,  // NOLINT
+             fork);
+    }
+  }
+
+  printf("\n%-16s %8s %14s %14s\n", "mixed", "threads", "fg p50 ms",
+         "fg p99 ms");
+  size_t num_threads = SysInfo::get_num_cpus();
+  for (auto scheduling : { ThreadPool::Scheduling::kFifo,
+                           ThreadPool::Scheduling::kPriority }) {
+    Histogram waits = run_mixed(scheduling, num_threads);
+    printf("%-16s %8lu %14.3f %14.3f\n",
+           scheduling == ThreadPool::Scheduling::kFifo ? "fifo" : "priority",
+           static_cast<unsigned long>(num_threads),  // NOLINT
+           waits.percentile(50) * 1e3, waits.percentile(99) * 1e3);
+  }
+
+  printf("\n%-16s %8s %10s %10s %10s %10s\n", "latency", "spins",
+         "ping p50", "ping p99", "burst p50", "burst p99");
+  for (bool lock_free : { false, true }) {
+    for (size_t spins : { size_t(0), size_t(4000) }) {
+      ThreadPool::Options options;
+      options.num_threads = num_threads;
+      options.lock_free_queue = lock_free;
+      options.idle_spins = spins;
+      ThreadPool pool(options);
+      Histogram ping = run_ping_pong(&pool, std::max<int64_t>(
+          num_tasks / 100, 1));
+      Histogram burst = run_bursty(&pool, std::max<int64_t>(
+          num_tasks / 1000, 1));
+      printf("%-16s %8lu %8.1fus %8.1fus %8.1fus %8.1fus\n",
+             lock_free ? "fifo_lock_free" : "fifo",
+             static_cast<unsigned long>(spins),  // NOLINT
+             ping.percentile(50) * 1e6, ping.percentile(99) * 1e6,
+             burst.percentile(50) * 1e6, burst.percentile(99) * 1e6);
+    }
+  }
+  return 0;
+}
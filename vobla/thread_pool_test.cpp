@@ -15,10 +15,21 @@
  */
 
 #include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
+#include "vobla/clock.h"
+#include "vobla/cpu_topology.h"
+#include "vobla/histogram.h"
 #include "vobla/status.h"
+#include "vobla/strand.h"
 #include "vobla/sysinfo.h"
 #include "vobla/thread_pool.h"
 
@@ -92,6 +103,33 @@ TEST(ThreadPoolTest, TestTaskObjects) {
   EXPECT_EQ(100, execute_count);
 }
 
+TEST(ThreadPoolTest, TestPost) {
+  std::atomic<int> execute_count(0);
+  {
+    ThreadPool pool(4);
+    for (int i = 0; i < 100; i++) {
+      pool.post([&execute_count] { execute_count++; });
+    }
+  }
+  EXPECT_EQ(100, execute_count);
+}
+
+TEST(ThreadPoolTest, TestSubmit) {
+  ThreadPool pool(4);
+  std::future<int> answer = pool.submit([] { return 42; });
+  std::future<std::string> concat = pool.submit(
+      [](const std::string& a, const std::string& b) { return a + b; },
+      std::string("foo"), std::string("bar"));
+  std::future<void> done = pool.submit([] {});
+  std::future<int> failed = pool.submit([]() -> int {
+      throw std::runtime_error("failed");
+    });
+  EXPECT_EQ(42, answer.get());
+  EXPECT_EQ("foobar", concat.get());
+  done.get();
+  EXPECT_THROW(failed.get(), std::runtime_error);
+}
+
 TEST(ThreadPoolTest, TestDefaultNumberThreads) {
   ThreadPool p1;
   EXPECT_EQ(2u * SysInfo::get_num_cpus(), p1.num_threads());
@@ -103,4 +141,620 @@ TEST(ThreadPoolTest, TestDefaultNumberThreads) {
   EXPECT_EQ(3u, p3.num_threads());
 }
 
+TEST(ThreadPoolTest, TestWorkStealingExternalTasks) {
+  ThreadPool::Options options;
+  options.num_threads = 4;
+  options.scheduling = ThreadPool::Scheduling::kWorkStealing;
+  ThreadPool pool(options);
+  EXPECT_EQ(4u, pool.num_threads());
+  std::atomic<int> execute_count(0);
+  std::vector<ThreadPool::FutureType> results;
+  for (int i = 0; i < 1000; i++) {
+    results.emplace_back(pool.add_task([&execute_count]() -> Status {
+          execute_count++;
+          return Status::OK;
+        }));
+  }
+  for (auto& rst : results) {
+    EXPECT_TRUE(rst.get().ok());
+  }
+  EXPECT_EQ(1000, execute_count);
+}
+
+TEST(ThreadPoolTest, TestWorkStealingRecursiveTasks) {
+  std::atomic<int> execute_count(0);
+  {
+    ThreadPool::Options options;
+    options.num_threads = 4;
+    options.scheduling = ThreadPool::Scheduling::kWorkStealing;
+    ThreadPool pool(options);
+    // Each task spawns two children from a worker thread, into the local
+    // deque of that worker.
+    std::function<Status(int)> spawn = [&](int depth) -> Status {
+      execute_count++;
+      if (depth > 0) {
+        pool.add_task(std::bind(spawn, depth - 1));
+        pool.add_task(std::bind(spawn, depth - 1));
+      }
+      return Status::OK;
+    };
+    pool.add_task(std::bind(spawn, 12));
+    while (execute_count < (1 << 13) - 1) {
+      std::this_thread::yield();
+    }
+  }
+  EXPECT_EQ((1 << 13) - 1, execute_count);
+}
+
+TEST(ThreadPoolTest, TestNumaAwareWorkStealing) {
+  // Two fake nodes on the real CPUs.
+  const auto& machine = CpuTopology::machine();
+  std::vector<CpuTopology::Cpu> cpus;
+  for (size_t i = 0; i < 4; i++) {
+    CpuTopology::Cpu cpu = machine.cpus()[i % machine.num_cpus()];
+    cpu.node = i % 2;
+    cpus.push_back(cpu);
+  }
+  CpuTopology topology(cpus);
+
+  ThreadPool::Options options;
+  options.num_threads = 4;
+  options.scheduling = ThreadPool::Scheduling::kWorkStealing;
+  options.numa_aware = true;
+  options.pin_threads = true;
+  options.topology = &topology;
+  std::atomic<int> execute_count(0);
+  {
+    ThreadPool pool(options);
+    EXPECT_EQ(2u, pool.num_nodes());
+    for (size_t i = 0; i < 4; i++) {
+      EXPECT_EQ(i % 2, pool.node_of_worker(i));
+      EXPECT_EQ(1u, pool.cpus_of_worker(i).size());
+    }
+    EXPECT_EQ(cpus[1].id, pool.cpus_of_worker(1)[0]);
+    ThreadPool::TaskOptions task_options;
+    for (int i = 0; i < 1000; i++) {
+      // Including the invalid nodes.
+      task_options.node = i % 4 - 1;
+      pool.post(task_options, [&execute_count] { execute_count++; });
+    }
+  }
+  EXPECT_EQ(1000, execute_count);
+
+  ThreadPool unplaced(2);
+  EXPECT_EQ(1u, unplaced.num_nodes());
+  EXPECT_TRUE(unplaced.cpus_of_worker(0).empty());
+}
+
+/// Waits up to 10 seconds for a condition.
+bool eventually(std::function<bool()> condition) {
+  for (int i = 0; i < 10000 && !condition(); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return condition();
+}
+
+TEST(ThreadPoolTest, TestElasticPoolGrowsAndShrinks) {
+  ThreadPool::Options options;
+  options.num_threads = 1;
+  options.max_threads = 3;
+  options.spawn_wait = 0.001;
+  options.idle_timeout = 0.05;
+  ThreadPool pool(options);
+  EXPECT_TRUE(pool.elastic());
+  EXPECT_EQ(1u, pool.num_threads());
+
+  std::promise<void> gate;
+  std::shared_future<void> opened = gate.get_future().share();
+  std::atomic<int> execute_count(0);
+  for (int i = 0; i < 5; i++) {
+    pool.post([opened, &execute_count] {
+        opened.wait();
+        execute_count++;
+      });
+    // Lets the queued tasks wait longer than spawn_wait.
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_TRUE(eventually([&] { return pool.num_busy_threads() == 3; }));
+  EXPECT_EQ(3u, pool.num_threads());
+  EXPECT_DOUBLE_EQ(1, pool.utilization());
+
+  gate.set_value();
+  EXPECT_TRUE(eventually([&] { return execute_count == 5; }));
+  // The extra threads retire after idle_timeout.
+  EXPECT_TRUE(eventually([&] { return pool.num_threads() == 1; }));
+  EXPECT_EQ(0u, pool.num_busy_threads());
+
+  // Runs the tasks with the reused worker slots.
+  pool.post([&execute_count] { execute_count++; });
+  EXPECT_TRUE(eventually([&] { return execute_count == 6; }));
+}
+
+TEST(ThreadPoolTest, TestSetThreadBounds) {
+  ThreadPool fixed(2);
+  EXPECT_FALSE(fixed.elastic());
+  EXPECT_FALSE(fixed.set_thread_bounds(1, 4).ok());
+
+  ThreadPool::Options options;
+  options.num_threads = 1;
+  options.max_threads = 2;
+  options.idle_timeout = 0.01;
+  ThreadPool pool(options);
+  EXPECT_FALSE(pool.set_thread_bounds(0, 4).ok());
+  EXPECT_FALSE(pool.set_thread_bounds(4, 2).ok());
+  EXPECT_TRUE(pool.set_thread_bounds(4, 8).ok());
+  EXPECT_EQ(4u, pool.num_threads());
+  // The idle threads retire down to the new minimum.
+  EXPECT_TRUE(pool.set_thread_bounds(2, 8).ok());
+  EXPECT_TRUE(eventually([&] { return pool.num_threads() == 2; }));
+}
+
+/// Blocks the only worker of a pool until open() is called.
+class Gate {
+ public:
+  explicit Gate(ThreadPool* pool) {
+    std::shared_future<void> opened = opened_.get_future().share();
+    std::promise<void>* entered = &entered_;
+    pool->post([opened, entered] {
+        entered->set_value();
+        opened.wait();
+      });
+    entered_.get_future().wait();
+  }
+
+  void open() {
+    opened_.set_value();
+  }
+
+ private:
+  std::promise<void> entered_;
+
+  std::promise<void> opened_;
+};
+
+TEST(ThreadPoolTest, TestPriorities) {
+  ThreadPool::Options options;
+  options.num_threads = 1;
+  options.scheduling = ThreadPool::Scheduling::kPriority;
+  options.aging_interval = 0;
+  FakeClock clock(100);
+  options.clock = &clock;
+  std::vector<int> order;
+  {
+    ThreadPool pool(options);
+    EXPECT_EQ(ThreadPool::Scheduling::kPriority, pool.scheduling());
+    Gate gate(&pool);
+    struct {
+      int id;
+      size_t priority;
+      double deadline;
+    } tasks[] = {
+      { 1, 2, 0 },
+      { 2, 1, 0 },
+      { 3, 0, 0 },
+      { 4, 0, 0 },
+      // Earliest deadline first within a class.
+      { 5, 1, 90 },
+      // The out-of-range classes are the least urgent.
+      { 6, 10, 0 },
+    };
+    for (const auto& task : tasks) {
+      ThreadPool::TaskOptions task_options;
+      task_options.priority = task.priority;
+      task_options.deadline = task.deadline;
+      int id = task.id;
+      pool.post(task_options, [&order, id] { order.push_back(id); });
+    }
+    gate.open();
+  }
+  EXPECT_EQ((std::vector<int>{3, 4, 5, 2, 1, 6}), order);
+}
+
+TEST(ThreadPoolTest, TestPriorityAging) {
+  ThreadPool::Options options;
+  options.num_threads = 1;
+  options.scheduling = ThreadPool::Scheduling::kPriority;
+  options.aging_interval = 1;
+  FakeClock clock(100);
+  options.clock = &clock;
+  std::vector<int> order;
+  std::vector<Histogram> wait_times;
+  {
+    ThreadPool pool(options);
+    Gate gate(&pool);
+    ThreadPool::TaskOptions background;
+    background.priority = 2;
+    pool.post(background, [&order] { order.push_back(1); });
+    clock.advance(3);
+    pool.post([&order] { order.push_back(2); });
+    pool.post(ThreadPool::TaskOptions(), [&order] { order.push_back(3); });
+    gate.open();
+    pool.close();
+    pool.join();
+    wait_times = pool.queue_wait_times();
+  }
+  // The background task waited 3 intervals, which promotes it ahead of
+  // the new foreground tasks.
+  EXPECT_EQ((std::vector<int>{1, 2, 3}), order);
+  ASSERT_EQ(3u, wait_times.size());
+  EXPECT_EQ(3u, wait_times[0].count());  // Including the gate.
+  EXPECT_EQ(0u, wait_times[1].count());
+  EXPECT_EQ(1u, wait_times[2].count());
+  EXPECT_DOUBLE_EQ(3, wait_times[2].max());
+}
+
+TEST(ThreadPoolTest, TestLockFreeQueue) {
+  ThreadPool::Options options;
+  options.num_threads = 3;
+  options.lock_free_queue = true;
+  // Small enough to make add_task() wait for free slots.
+  options.lock_free_queue_capacity = 4;
+  std::atomic<int> execute_count(0);
+  std::vector<ThreadPool::FutureType> results;
+  {
+    ThreadPool pool(options);
+    for (int i = 0; i < 1000; i++) {
+      results.emplace_back(pool.add_task([&execute_count]() -> Status {
+            execute_count++;
+            return Status::OK;
+          }));
+    }
+  }
+  EXPECT_EQ(1000, execute_count);
+  for (auto& rst : results) {
+    EXPECT_TRUE(rst.get().ok());
+  }
+}
+
+TEST(ThreadPoolTest, TestLockFreeQueueNestedTasksDoNotDeadlock) {
+  ThreadPool::Options options;
+  options.num_threads = 2;
+  options.lock_free_queue = true;
+  options.lock_free_queue_capacity = 2;
+  std::atomic<int> execute_count(0);
+  {
+    ThreadPool pool(options);
+    for (int i = 0; i < 100; i++) {
+      pool.add_task([&pool, &execute_count]() -> Status {
+          // Fills up the queue from the workers.
+          for (int j = 0; j < 10; j++) {
+            pool.add_task([&execute_count]() -> Status {
+                execute_count++;
+                return Status::OK;
+              });
+          }
+          return Status::OK;
+        });
+    }
+  }
+  EXPECT_EQ(1000, execute_count);
+}
+
+/// Makes a pool of one worker, blocked by `gate`, with a queue of 2 tasks.
+ThreadPool::Options bounded_options(ThreadPool::Overflow overflow) {
+  ThreadPool::Options options;
+  options.num_threads = 1;
+  options.queue_capacity = 2;
+  options.overflow = overflow;
+  return options;
+}
+
+TEST(ThreadPoolTest, TestBoundedQueueRejects) {
+  ThreadPool pool(bounded_options(ThreadPool::Overflow::kReject));
+  Gate gate(&pool);
+  std::atomic<int> execute_count(0);
+  auto task = [&execute_count]() -> Status {
+    execute_count++;
+    return Status::OK;
+  };
+  auto first = pool.add_task(task);
+  EXPECT_TRUE(pool.try_add_task(task).ok());
+  EXPECT_EQ(2u, pool.queue_depth());
+
+  EXPECT_EQ(-EAGAIN, pool.add_task(task).get().error());
+  EXPECT_EQ(-EAGAIN, pool.try_add_task(task).error());
+  EXPECT_EQ(-EAGAIN, pool.try_post([&execute_count] { execute_count++; })
+            .error());
+  EXPECT_EQ(3u, pool.num_rejected());
+  EXPECT_EQ(2u, pool.queue_depth());
+
+  // post() does not drop the task, it waits for room.
+  std::thread submitter([&] {
+      pool.post([&execute_count] { execute_count++; });
+    });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(3u, pool.num_rejected());
+  gate.open();
+  submitter.join();
+  EXPECT_TRUE(first.get().ok());
+  pool.close();
+  pool.join();
+  EXPECT_EQ(3, execute_count);
+  EXPECT_EQ(0u, pool.queue_depth());
+}
+
+TEST(ThreadPoolTest, TestBoundedQueueCallerRuns) {
+  ThreadPool pool(bounded_options(ThreadPool::Overflow::kCallerRuns));
+  Gate gate(&pool);
+  auto caller = std::this_thread::get_id();
+  std::vector<std::thread::id> ran_in(3);
+  for (int i = 0; i < 3; i++) {
+    pool.post([&ran_in, i] { ran_in[i] = std::this_thread::get_id(); });
+  }
+  // The third task ran before post() returned.
+  EXPECT_EQ(caller, ran_in[2]);
+  EXPECT_EQ(1u, pool.num_caller_runs());
+  // try_post() does not apply the policy.
+  EXPECT_EQ(-EAGAIN, pool.try_post([] {}).error());
+  gate.open();
+  pool.close();
+  pool.join();
+  EXPECT_NE(caller, ran_in[0]);
+  EXPECT_NE(caller, ran_in[1]);
+}
+
+TEST(ThreadPoolTest, TestBoundedQueueDropsOldest) {
+  struct {
+    ThreadPool::Scheduling scheduling;
+    bool lock_free;
+  } configs[] = {
+    { ThreadPool::Scheduling::kFifo, false },
+    { ThreadPool::Scheduling::kFifo, true },
+    { ThreadPool::Scheduling::kWorkStealing, false },
+    { ThreadPool::Scheduling::kPriority, false },
+  };
+  for (const auto& config : configs) {
+    auto options = bounded_options(ThreadPool::Overflow::kDropOldest);
+    options.scheduling = config.scheduling;
+    options.lock_free_queue = config.lock_free;
+    ThreadPool pool(options);
+    Gate gate(&pool);
+    std::vector<int> order;
+    // Only the tasks of add_task() are dropped.
+    pool.post([&order] { order.push_back(0); });
+    std::vector<ThreadPool::FutureType> futures;
+    for (int i = 1; i < 4; i++) {
+      futures.push_back(pool.add_task([&order, i]() -> Status {
+            order.push_back(i);
+            return Status::OK;
+          }));
+    }
+    EXPECT_EQ(2u, pool.num_dropped());
+    EXPECT_EQ(2u, pool.queue_depth());
+    gate.open();
+    pool.close();
+    pool.join();
+    EXPECT_EQ((std::vector<int>{0, 3}), order);
+    EXPECT_THROW(futures[0].get(), std::future_error);
+    EXPECT_THROW(futures[1].get(), std::future_error);
+    EXPECT_TRUE(futures[2].get().ok());
+  }
+}
+
+TEST(ThreadPoolTest, TestBoundedQueueBlocks) {
+  ThreadPool pool(bounded_options(ThreadPool::Overflow::kBlock));
+  Gate gate(&pool);
+  std::atomic<int> execute_count(0);
+  pool.post([&execute_count] { execute_count++; });
+  pool.post([&execute_count] { execute_count++; });
+  std::atomic<bool> added(false);
+  std::thread submitter([&] {
+      pool.post([&execute_count] { execute_count++; });
+      added = true;
+    });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(added);
+  gate.open();
+  submitter.join();
+  EXPECT_TRUE(added);
+  pool.close();
+  pool.join();
+  EXPECT_EQ(3, execute_count);
+  EXPECT_EQ(0u, pool.num_rejected());
+}
+
+TEST(ThreadPoolTest, TestBoundedQueueTasksAddOverCapacity) {
+  for (auto overflow : { ThreadPool::Overflow::kBlock,
+                         ThreadPool::Overflow::kCallerRuns }) {
+    ThreadPool pool(bounded_options(overflow));
+    std::atomic<bool> in_outer(false);
+    std::atomic<int> nested(0);
+    std::atomic<int> execute_count(0);
+    size_t depth = 0;
+    pool.post([&] {
+        in_outer = true;
+        // The third task neither waits for the only worker nor runs here.
+        for (int i = 0; i < 3; i++) {
+          pool.post([&] {
+              if (in_outer) {
+                nested++;
+              }
+              execute_count++;
+            });
+        }
+        depth = pool.queue_depth();
+        in_outer = false;
+      });
+    pool.close();
+    pool.join();
+    EXPECT_EQ(3u, depth);
+    EXPECT_EQ(3, execute_count);
+    EXPECT_EQ(0, nested);
+    EXPECT_EQ(0u, pool.num_caller_runs());
+  }
+}
+
+TEST(ThreadPoolTest, TestBoundedQueueKeepsStrandsRunning) {
+  for (auto overflow : { ThreadPool::Overflow::kBlock,
+                         ThreadPool::Overflow::kReject,
+                         ThreadPool::Overflow::kCallerRuns,
+                         ThreadPool::Overflow::kDropOldest }) {
+    ThreadPool pool(bounded_options(overflow));
+    std::atomic<int> execute_count(0);
+    {
+      Gate gate(&pool);
+      pool.post([&execute_count] { execute_count++; });
+      pool.post([&execute_count] { execute_count++; });
+      std::thread opener([&gate] {
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          gate.open();
+        });
+      // The drain tasks of the strand are posted to a full queue, and
+      // re-post themselves after each batch.
+      Strand strand(&pool);
+      for (int i = 0; i < 1000; i++) {
+        strand.post([&execute_count] { execute_count++; });
+      }
+      opener.join();
+      EXPECT_TRUE(eventually([&] { return execute_count == 1002; }));
+    }
+    EXPECT_EQ(0u, pool.num_rejected());
+    EXPECT_EQ(0u, pool.num_dropped());
+  }
+}
+
+TEST(ThreadPoolTest, TestQueueDepthOfUnboundedPools) {
+  ThreadPool pool(1);
+  Gate gate(&pool);
+  for (int i = 0; i < 3; i++) {
+    pool.post([] {});
+  }
+  EXPECT_EQ(3u, pool.queue_depth());
+  gate.open();
+  EXPECT_TRUE(eventually([&] { return pool.queue_depth() == 0; }));
+}
+
+TEST(ThreadPoolTest, TestBurstsWithSpinningWorkers) {
+  for (bool lock_free : { false, true }) {
+    ThreadPool::Options options;
+    options.num_threads = 2;
+    options.lock_free_queue = lock_free;
+    options.idle_spins = 100;
+    std::atomic<int> execute_count(0);
+    {
+      ThreadPool pool(options);
+      for (int i = 0; i < 50; i++) {
+        for (int j = 0; j < 10; j++) {
+          pool.post([&execute_count] { execute_count++; });
+        }
+        // Lets the workers go idle between the bursts.
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+    EXPECT_EQ(500, execute_count);
+  }
+}
+
+TEST(ThreadPoolTest, TestMetrics) {
+  ThreadPool::Options options;
+  options.num_threads = 1;
+  options.collect_metrics = true;
+  FakeClock clock(100);
+  options.clock = &clock;
+  ThreadPool pool(options);
+  EXPECT_TRUE(pool.collects_metrics());
+  {
+    Gate gate(&pool);
+    pool.post([] {});
+    pool.post([] {});
+    EXPECT_EQ(2u, pool.metrics().queue_depth);
+    clock.advance(3);
+    gate.open();
+  }
+  ASSERT_TRUE(eventually([&] { return pool.metrics().completed == 3; }));
+  auto before = pool.metrics();
+  EXPECT_EQ(0u, before.queue_depth);
+  EXPECT_EQ(1u, before.num_threads);
+  EXPECT_EQ(3u, before.queue_wait.count());
+  EXPECT_DOUBLE_EQ(3, before.queue_wait.max());
+  EXPECT_DOUBLE_EQ(6, before.queue_wait.sum());
+  EXPECT_EQ(3u, before.run_time.count());
+  EXPECT_DOUBLE_EQ(3, before.run_time.max());
+  EXPECT_DOUBLE_EQ(3, before.busy_time);
+  EXPECT_DOUBLE_EQ(0, before.idle_time);
+  ASSERT_EQ(1u, before.workers.size());
+  EXPECT_EQ(3u, before.workers[0].completed);
+
+  // The worker has been idle since.
+  clock.advance(5);
+  auto after = pool.metrics();
+  EXPECT_DOUBLE_EQ(5, after.idle_time);
+  EXPECT_DOUBLE_EQ(3.0 / 8, after.utilization());
+  EXPECT_DOUBLE_EQ(0, after.utilization_since(before));
+}
+
+TEST(ThreadPoolTest, TestMetricsOfElasticPool) {
+  ThreadPool::Options options;
+  options.num_threads = 1;
+  options.max_threads = 2;
+  options.spawn_wait = 0;
+  options.idle_timeout = 0.01;
+  options.collect_metrics = true;
+  FakeClock clock(100);
+  options.clock = &clock;
+  ThreadPool pool(options);
+  // Occupies both workers, then lets one of them retire.
+  auto occupy_both = [&pool] {
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    for (int i = 0; i < 2; i++) {
+      pool.post([opened] { opened.wait(); });
+    }
+    EXPECT_TRUE(eventually([&] { return pool.num_busy_threads() == 2; }));
+    gate.set_value();
+    EXPECT_TRUE(eventually([&] { return pool.num_threads() == 1; }));
+  };
+  occupy_both();
+  // The retired worker's slot is reused. Its retired time is not idle time.
+  clock.advance(1000);
+  occupy_both();
+  auto metrics = pool.metrics();
+  ASSERT_EQ(2u, metrics.workers.size());
+  EXPECT_EQ(4u, metrics.completed);
+  // Only the live worker was idle for the 1000 seconds.
+  EXPECT_DOUBLE_EQ(1000, metrics.idle_time);
+  EXPECT_DOUBLE_EQ(0, metrics.busy_time);
+}
+
+TEST(ThreadPoolTest, TestMetricsOfAllSchedulers) {
+  struct {
+    ThreadPool::Scheduling scheduling;
+    bool lock_free;
+  } configs[] = {
+    { ThreadPool::Scheduling::kFifo, false },
+    { ThreadPool::Scheduling::kFifo, true },
+    { ThreadPool::Scheduling::kWorkStealing, false },
+    { ThreadPool::Scheduling::kPriority, false },
+  };
+  for (const auto& config : configs) {
+    ThreadPool::Options options;
+    options.num_threads = 2;
+    options.scheduling = config.scheduling;
+    options.lock_free_queue = config.lock_free;
+    options.collect_metrics = true;
+    ThreadPool pool(options);
+    for (int i = 0; i < 100; i++) {
+      pool.post([] {});
+    }
+    pool.close();
+    pool.join();
+    auto metrics = pool.metrics();
+    EXPECT_EQ(100u, metrics.completed);
+    EXPECT_EQ(100u, metrics.queue_wait.count());
+    EXPECT_EQ(100u, metrics.run_time.count());
+    ASSERT_EQ(2u, metrics.workers.size());
+    EXPECT_EQ(100u, metrics.workers[0].completed +
+              metrics.workers[1].completed);
+  }
+
+  ThreadPool pool(1);
+  pool.post([] {});
+  pool.close();
+  pool.join();
+  auto metrics = pool.metrics();
+  EXPECT_FALSE(pool.collects_metrics());
+  EXPECT_EQ(0u, metrics.completed);
+  EXPECT_TRUE(metrics.workers.empty());
+}
+
 }  // namespace vobla
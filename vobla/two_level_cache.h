@@ -0,0 +1,299 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/two_level_cache.h
+ * \brief A shared LRU cache with unsynchronized per-thread front caches.
+ */
+
+#ifndef VOBLA_TWO_LEVEL_CACHE_H_
+#define VOBLA_TWO_LEVEL_CACHE_H_
+
+#include <boost/utility.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "vobla/sharded_lru_cache.h"
+#include "vobla/status.h"
+#include "vobla/thread_pool.h"
+
+namespace vobla {
+
+/**
+ * \class TwoLevelCache vobla/two_level_cache.h
+ * \brief A ShardedLRUCache (L2) with small per-thread direct-mapped caches
+ * (L1) in front of it.
+ *
+ * Each thread creates its own TwoLevelCache::Local, which serves the
+ * hottest keys without taking any lock or writing any shared memory.
+ *
+ * Staleness is detected with versions: the keys are hashed into a table of
+ * atomic version counters, and every write through TwoLevelCache bumps the
+ * version of the key after updating L2. An L1 slot remembers the version
+ * it was filled with and is ignored once the version has changed, so an
+ * L1 lookup costs one (usually L1-cached) atomic load.
+ *
+ * Usage:
+ * ~~~~~~~~~{cpp}
+ * TwoLevelCache<string, Inode> cache(100000);
+ * // In each thread:
+ * TwoLevelCache<string, Inode>::Local local(&cache);
+ * const Inode* inode = local.find(path);
+ * ~~~~~~~~~
+ *
+ * \note All writes must go through TwoLevelCache (or its Local caches),
+ * otherwise the L1 caches are not invalidated. The L1 caches hold on to
+ * their values even after L2 evicts them, which is fine for immutable
+ * values.
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class TwoLevelCache : boost::noncopyable {
+ public:
+  typedef ShardedLRUCache<Key, Value, Hash> l2_type;
+
+  typedef typename l2_type::pointer_type pointer_type;
+
+  typedef typename l2_type::LoaderType LoaderType;
+
+  class Local;
+
+  /**
+   * \brief Constructs a two-level cache.
+   * \param capacity the capacity of L2.
+   * \param num_shards the number of shards of L2.
+   * \param pool the thread pool to run the loaders of get_or_load().
+   * \param num_versions the number of the version counters, rounded up to
+   * a power of 2. More counters mean fewer false invalidations.
+   */
+  explicit TwoLevelCache(size_t capacity, size_t num_shards = 16,
+                         ThreadPool* pool = nullptr,
+                         size_t num_versions = 4096)
+      : l2_(capacity, num_shards, pool) {
+    size_t size = 1;
+    while (size < num_versions) {
+      size <<= 1;
+    }
+    version_mask_ = size - 1;
+    versions_.reset(new std::atomic<uint64_t>[size]());
+  }
+
+  ~TwoLevelCache() {
+  }
+
+  /// Returns the capacity of L2.
+  size_t capacity() const {
+    return l2_.capacity();
+  }
+
+  /// Returns the number of values in L2.
+  size_t size() const {
+    return l2_.size();
+  }
+
+  /// Inserts a value into L2 and invalidates the key in all L1 caches.
+  void insert(const Key& key, pointer_type value) {
+    l2_.insert(key, std::move(value));
+    invalidate(key);
+  }
+
+  /// Removes a key from L2 and all L1 caches.
+  bool erase(const Key& key) {
+    bool erased = l2_.erase(key);
+    invalidate(key);
+    return erased;
+  }
+
+  /// Invalidates a key in all L1 caches, e.g., after its value is mutated.
+  void invalidate(const Key& key) {
+    versions_[version_index(mix(hasher_(key)))].fetch_add(
+        1, std::memory_order_release);
+  }
+
+  /// Removes all values from L2 and all L1 caches.
+  void clear() {
+    l2_.clear();
+    for (size_t i = 0; i <= version_mask_; i++) {
+      versions_[i].fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  /**
+   * \class Local vobla/two_level_cache.h
+   * \brief A per-thread direct-mapped L1 cache.
+   *
+   * It must be used by one thread at a time, and must not outlive its
+   * TwoLevelCache.
+   */
+  class Local : boost::noncopyable {
+   public:
+    /**
+     * \brief Constructs an L1 cache.
+     * \param cache the shared cache.
+     * \param num_slots the number of slots, rounded up to a power of 2.
+     */
+    explicit Local(TwoLevelCache* cache, size_t num_slots = 256)
+        : cache_(cache) {
+      size_t size = 1;
+      while (size < num_slots) {
+        size <<= 1;
+      }
+      slot_mask_ = size - 1;
+      slots_.resize(size);
+    }
+
+    /**
+     * \brief Finds the value of a key in L1 or L2.
+     * \return the value, or nullptr if the key is not cached. The pointer
+     * stays valid until the next call on this Local cache.
+     *
+     * It does not copy the shared_ptr, so an L1 hit does not touch the
+     * shared reference count.
+     */
+    const Value* find(const Key& key) {
+      size_t hash = mix(cache_->hasher_(key));
+      Slot& slot = slots_[hash & slot_mask_];
+      uint64_t version = cache_->version_of(hash);
+      if (slot.valid && slot.version == version && slot.key == key) {
+        hits_++;
+        return slot.value.get();
+      }
+      misses_++;
+      pointer_type value;
+      if (!cache_->l2_.find(key, &value)) {
+        return nullptr;
+      }
+      fill(&slot, key, std::move(value), version);
+      return slot.value.get();
+    }
+
+    /// Finds the value of a key in L1 or L2. Returns false on a miss.
+    bool find(const Key& key, pointer_type* value) {
+      if (!find(key)) {
+        return false;
+      }
+      *value = slots_[mix(cache_->hasher_(key)) & slot_mask_].value;
+      return true;
+    }
+
+    /// Same as ShardedLRUCache::get_or_load(), with L1 in front of it.
+    Status get_or_load(const Key& key, const LoaderType& loader,
+                       pointer_type* value) {
+      size_t hash = mix(cache_->hasher_(key));
+      Slot& slot = slots_[hash & slot_mask_];
+      uint64_t version = cache_->version_of(hash);
+      if (slot.valid && slot.version == version && slot.key == key) {
+        hits_++;
+        *value = slot.value;
+        return Status::OK;
+      }
+      misses_++;
+      Status status = cache_->l2_.get_or_load(key, loader, value);
+      if (status.ok()) {
+        fill(&slot, key, *value, version);
+      }
+      return status;
+    }
+
+    /// Inserts a value through the shared cache.
+    void insert(const Key& key, pointer_type value) {
+      cache_->insert(key, std::move(value));
+    }
+
+    /// Removes a key through the shared cache.
+    bool erase(const Key& key) {
+      return cache_->erase(key);
+    }
+
+    /// Returns the number of lookups served by L1.
+    uint64_t hits() const {
+      return hits_;
+    }
+
+    /// Returns the number of lookups that went to L2.
+    uint64_t misses() const {
+      return misses_;
+    }
+
+   private:
+    struct Slot {
+      Key key;
+
+      pointer_type value;
+
+      uint64_t version = 0;
+
+      bool valid = false;
+    };
+
+    void fill(Slot* slot, const Key& key, pointer_type value,
+              uint64_t version) {
+      slot->key = key;
+      slot->value = std::move(value);
+      slot->version = version;
+      slot->valid = true;
+    }
+
+    TwoLevelCache* cache_;
+
+    size_t slot_mask_;
+
+    std::vector<Slot> slots_;
+
+    uint64_t hits_ = 0;
+
+    uint64_t misses_ = 0;
+  };
+
+ private:
+  static size_t mix(size_t hash) {
+    hash ^= hash >> 17;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 29;
+    return hash;
+  }
+
+  /// Uses the high bits, since the L1 slot index uses the low bits.
+  size_t version_index(size_t hash) const {
+    return (hash >> (sizeof(size_t) * 4)) & version_mask_;
+  }
+
+  /**
+   * \brief Returns the current version of a key.
+   *
+   * It must be read before looking up L2: the writers update L2 before
+   * bumping the version, so a value read from L2 is at least as new as the
+   * version read here.
+   */
+  uint64_t version_of(size_t hash) const {
+    return versions_[version_index(hash)].load(std::memory_order_acquire);
+  }
+
+  l2_type l2_;
+
+  Hash hasher_;
+
+  size_t version_mask_;
+
+  std::unique_ptr<std::atomic<uint64_t>[]> versions_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_TWO_LEVEL_CACHE_H_
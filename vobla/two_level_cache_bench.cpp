@@ -0,0 +1,132 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/two_level_cache_bench.cpp
+ * \brief Compares ShardedLRUCache and TwoLevelCache on a skewed workload.
+ *
+ * Usage: two_level_cache_bench [NUM_THREADS] [OPS_PER_THREAD]
+ *
+ * Each thread looks up keys drawn from a Zipf distribution (s = 0.99), so
+ * that a few hot keys take most of the lookups and all threads fight over
+ * the shards holding them.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include "vobla/sharded_lru_cache.h"
+#include "vobla/timer.h"
+#include "vobla/two_level_cache.h"
+
+using std::vector;
+using vobla::ShardedLRUCache;
+using vobla::Timer;
+using vobla::TwoLevelCache;
+
+namespace {
+
+const int kNumKeys = 100000;
+
+/// Generates `count` keys in [0, kNumKeys) with a Zipf distribution.
+vector<int> zipf_keys(size_t count, unsigned seed) {
+  vector<double> cdf(kNumKeys);
+  double sum = 0;
+  for (int i = 0; i < kNumKeys; i++) {
+    sum += 1.0 / std::pow(i + 1, 0.99);
+    cdf[i] = sum;
+  }
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> dist(0, sum);
+  vector<int> keys(count);
+  for (auto& key : keys) {
+    key = std::lower_bound(cdf.begin(), cdf.end(), dist(rng)) - cdf.begin();
+  }
+  return keys;
+}
+
+/// Runs `body(thread_index)` in `num_threads` threads and returns the
+/// million operations per second.
+template <typename Function>
+double run(int num_threads, size_t ops_per_thread, Function body) {
+  Timer timer;
+  timer.start();
+  vector<std::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back(body, i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  timer.stop();
+  return num_threads * ops_per_thread / timer.get_in_second() / 1e6;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int num_threads = argc > 1 ? atoi(argv[1])
+      : std::max(1u, std::thread::hardware_concurrency());
+  size_t ops_per_thread = argc > 2 ? strtoull(argv[2], nullptr, 10)
+      : 2000000;
+
+  vector<vector<int>> keys;
+  for (int i = 0; i < num_threads; i++) {
+    keys.push_back(zipf_keys(ops_per_thread, i));
+  }
+
+  ShardedLRUCache<int, int> sharded(kNumKeys, 16);
+  TwoLevelCache<int, int> two_level(kNumKeys, 16);
+  for (int i = 0; i < kNumKeys; i++) {
+    sharded.insert(i, std::make_shared<int>(i));
+    two_level.insert(i, std::make_shared<int>(i));
+  }
+
+  double sharded_mops = run(num_threads, ops_per_thread,
+      [&sharded, &keys](int thread) {
+        ShardedLRUCache<int, int>::pointer_type value;
+        for (int key : keys[thread]) {
+          sharded.find(key, &value);
+        }
+      });
+
+  vector<double> hit_ratios(num_threads);
+  double two_level_mops = run(num_threads, ops_per_thread,
+      [&two_level, &keys, &hit_ratios](int thread) {
+        TwoLevelCache<int, int>::Local local(&two_level, 1024);
+        for (int key : keys[thread]) {
+          local.find(key);
+        }
+        hit_ratios[thread] = static_cast<double>(local.hits()) /
+            (local.hits() + local.misses());
+      });
+
+  double hit_ratio = 0;
+  for (auto ratio : hit_ratios) {
+    hit_ratio += ratio / num_threads;
+  }
+  printf("threads: %d, lookups per thread: %lu\n", num_threads,
+         static_cast<unsigned long>(ops_per_thread));  // NOLINT
+  printf("ShardedLRUCache: %8.2f Mops/s\n", sharded_mops);
+  printf("TwoLevelCache:   %8.2f Mops/s (L1 hit ratio %.3f)\n",
+         two_level_mops, hit_ratio);
+  return 0;
+}
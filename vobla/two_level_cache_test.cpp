@@ -0,0 +1,150 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vobla/status.h"
+#include "vobla/two_level_cache.h"
+
+using std::string;
+using std::vector;
+
+namespace vobla {
+
+typedef TwoLevelCache<int, string> cache_type;
+
+TEST(TwoLevelCacheTest, TestFindThroughL1) {
+  cache_type cache(64, 4);
+  cache_type::Local local(&cache, 16);
+  EXPECT_EQ(nullptr, local.find(1));
+  cache.insert(1, std::make_shared<string>("1"));
+
+  const string* value = local.find(1);
+  ASSERT_NE(nullptr, value);
+  EXPECT_EQ("1", *value);
+  EXPECT_EQ(0u, local.hits());
+  EXPECT_EQ(2u, local.misses());
+
+  value = local.find(1);
+  ASSERT_NE(nullptr, value);
+  EXPECT_EQ("1", *value);
+  EXPECT_EQ(1u, local.hits());
+
+  cache_type::pointer_type ptr;
+  EXPECT_TRUE(local.find(1, &ptr));
+  EXPECT_EQ("1", *ptr);
+  EXPECT_EQ(2u, local.hits());
+}
+
+TEST(TwoLevelCacheTest, TestWritesInvalidateOtherThreads) {
+  cache_type cache(64, 4);
+  cache_type::Local local1(&cache);
+  cache_type::Local local2(&cache);
+  cache.insert(1, std::make_shared<string>("1"));
+  EXPECT_EQ("1", *local1.find(1));
+  EXPECT_EQ("1", *local2.find(1));
+
+  local1.insert(1, std::make_shared<string>("one"));
+  EXPECT_EQ("one", *local2.find(1));
+  EXPECT_EQ("one", *local1.find(1));
+
+  EXPECT_TRUE(local2.erase(1));
+  EXPECT_EQ(nullptr, local1.find(1));
+  EXPECT_EQ(nullptr, local2.find(1));
+
+  cache.insert(2, std::make_shared<string>("2"));
+  EXPECT_EQ("2", *local1.find(2));
+  cache.clear();
+  EXPECT_EQ(nullptr, local1.find(2));
+}
+
+TEST(TwoLevelCacheTest, TestConflictingSlots) {
+  cache_type cache(64, 4);
+  cache_type::Local local(&cache, 1);
+  for (int i = 0; i < 8; i++) {
+    cache.insert(i, std::make_shared<string>(std::to_string(i)));
+  }
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 8; i++) {
+      ASSERT_NE(nullptr, local.find(i));
+      EXPECT_EQ(std::to_string(i), *local.find(i));
+    }
+  }
+}
+
+TEST(TwoLevelCacheTest, TestGetOrLoad) {
+  cache_type cache(64, 4);
+  cache_type::Local local(&cache);
+  int num_loads = 0;
+  auto loader = [&num_loads](const int& key, cache_type::pointer_type* value)
+      -> Status {
+    num_loads++;
+    value->reset(new string(std::to_string(key)));
+    return Status::OK;
+  };
+  cache_type::pointer_type value;
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(local.get_or_load(5, loader, &value).ok());
+    EXPECT_EQ("5", *value);
+  }
+  EXPECT_EQ(1, num_loads);
+  EXPECT_EQ(2u, local.hits());
+  EXPECT_EQ(1u, cache.size());
+}
+
+TEST(TwoLevelCacheTest, TestConcurrentReadersSeeUpdates) {
+  cache_type cache(1024, 8);
+  const int kNumKeys = 32;
+  const int kNumRounds = 200;
+  for (int i = 0; i < kNumKeys; i++) {
+    cache.insert(i, std::make_shared<string>("0"));
+  }
+  std::atomic<int> round(0);
+  std::atomic<bool> failed(false);
+  vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&] {
+        cache_type::Local local(&cache, 8);
+        while (round.load() < kNumRounds) {
+          for (int i = 0; i < kNumKeys; i++) {
+            // A value read after a round is published must not be older
+            // than that round.
+            int min_round = round.load();
+            const string* value = local.find(i);
+            if (!value || std::stoi(*value) < min_round) {
+              failed = true;
+            }
+          }
+        }
+      });
+  }
+  for (int r = 1; r <= kNumRounds; r++) {
+    for (int i = 0; i < kNumKeys; i++) {
+      cache.insert(i, std::make_shared<string>(std::to_string(r)));
+    }
+    round = r;
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_FALSE(failed);
+}
+
+}  // namespace vobla
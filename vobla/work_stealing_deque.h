@@ -0,0 +1,189 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file vobla/work_stealing_deque.h
+ * \brief A lock-free single-owner deque that other threads can steal from.
+ */
+
+#ifndef VOBLA_WORK_STEALING_DEQUE_H_
+#define VOBLA_WORK_STEALING_DEQUE_H_
+
+#include <boost/utility.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace vobla {
+
+/**
+ * \class WorkStealingDeque vobla/work_stealing_deque.h
+ * \brief The Chase-Lev work-stealing deque.
+ *
+ * The owner thread pushes and takes items at the bottom (LIFO), while any
+ * other thread steals items from the top (FIFO). push() and take() only
+ * synchronize with the thieves when the deque has at most one item, and
+ * the buffer grows without blocking the thieves.
+ *
+ * It follows "Correct and Efficient Work-Stealing for Weak Memory Models"
+ * (Lê et al., PPoPP'13).
+ *
+ * \tparam T a trivial type, usually a pointer.
+ */
+template <typename T>
+class WorkStealingDeque : boost::noncopyable {
+  static_assert(std::is_trivial<T>::value,
+                "WorkStealingDeque only holds trivial types.");
+
+ public:
+  /// Constructs a deque with an initial capacity, rounded up to a power
+  /// of 2.
+  explicit WorkStealingDeque(size_t capacity = 256)
+      : top_(0), bottom_(0) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    buffers_.emplace_back(new Buffer(size));
+    buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+  }
+
+  ~WorkStealingDeque() {
+  }
+
+  /// Pushes an item at the bottom. Only called by the owner.
+  void push(T item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    if (b - t > static_cast<int64_t>(buffer->mask)) {
+      buffer = grow(buffer, t, b);
+    }
+    buffer->put(b, item);
+    // Publishes the item to the thieves (a release fence followed by a
+    // relaxed store in the paper).
+    bottom_.store(b + 1, std::memory_order_release);
+  }
+
+  /// Takes the last pushed item. Only called by the owner.
+  bool take(T* item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      // Empty.
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    *item = buffer->get(b);
+    if (t == b) {
+      // The last item: races with the thieves.
+      bool won = top_.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  /**
+   * \brief Steals the first item. Can be called by any thread.
+   * \return false if the deque is empty or another thread won the race.
+   */
+  bool steal(T* item) {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    // The buffer is read with acquire (instead of consume) for simplicity.
+    Buffer* buffer = buffer_.load(std::memory_order_acquire);
+    T value = buffer->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return false;
+    }
+    *item = value;
+    return true;
+  }
+
+  /// Returns the approximate number of items.
+  size_t size() const {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+  }
+
+  /// Returns true if the deque seems empty.
+  bool empty() const {
+    return size() == 0;
+  }
+
+ private:
+  /// A circular buffer of atomic slots, so that the racy reads of the
+  /// thieves are well-defined.
+  struct Buffer {
+    explicit Buffer(size_t size)
+        : mask(size - 1), slots(new std::atomic<T>[size]) {}
+
+    T get(int64_t index) const {
+      return slots[index & mask].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t index, T item) {
+      slots[index & mask].store(item, std::memory_order_relaxed);
+    }
+
+    size_t mask;
+
+    std::unique_ptr<std::atomic<T>[]> slots;
+  };
+
+  /// Doubles the buffer. The old buffers are kept until the deque is
+  /// destroyed, since thieves might still read from them.
+  Buffer* grow(Buffer* old, int64_t top, int64_t bottom) {
+    buffers_.emplace_back(new Buffer((old->mask + 1) * 2));
+    Buffer* buffer = buffers_.back().get();
+    for (int64_t i = top; i < bottom; ++i) {
+      buffer->put(i, old->get(i));
+    }
+    buffer_.store(buffer, std::memory_order_release);
+    return buffer;
+  }
+
+  /// Thieves and the owner contend on top_, so it is kept on a separate
+  /// cache line from bottom_.
+  std::atomic<int64_t> top_;
+
+  char padding_[64];
+
+  std::atomic<int64_t> bottom_;
+
+  std::atomic<Buffer*> buffer_;
+
+  /// Only accessed by the owner.
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+}  // namespace vobla
+
+#endif  // VOBLA_WORK_STEALING_DEQUE_H_
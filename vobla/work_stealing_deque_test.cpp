@@ -0,0 +1,89 @@
+/*
+ * Copyright 2014 (c) Lei Xu <eddyxu@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "vobla/work_stealing_deque.h"
+
+using std::vector;
+
+namespace vobla {
+
+TEST(WorkStealingDequeTest, TestTakeAndSteal) {
+  WorkStealingDeque<int> deque(2);
+  int item = 0;
+  EXPECT_FALSE(deque.take(&item));
+  EXPECT_FALSE(deque.steal(&item));
+
+  // Grows beyond the initial capacity.
+  for (int i = 0; i < 10; i++) {
+    deque.push(i);
+  }
+  EXPECT_EQ(10u, deque.size());
+  EXPECT_TRUE(deque.take(&item));
+  EXPECT_EQ(9, item);
+  EXPECT_TRUE(deque.steal(&item));
+  EXPECT_EQ(0, item);
+  EXPECT_TRUE(deque.steal(&item));
+  EXPECT_EQ(1, item);
+  for (int i = 8; i >= 2; i--) {
+    EXPECT_TRUE(deque.take(&item));
+    EXPECT_EQ(i, item);
+  }
+  EXPECT_TRUE(deque.empty());
+  EXPECT_FALSE(deque.take(&item));
+}
+
+TEST(WorkStealingDequeTest, TestConcurrentSteals) {
+  const int kNumItems = 100000;
+  const int kNumThieves = 3;
+  WorkStealingDeque<int> deque(16);
+  vector<std::atomic<int>> seen(kNumItems);
+  std::atomic<bool> done(false);
+
+  vector<std::thread> thieves;
+  for (int t = 0; t < kNumThieves; t++) {
+    thieves.emplace_back([&] {
+        int item;
+        while (!done || !deque.empty()) {
+          if (deque.steal(&item)) {
+            seen[item]++;
+          }
+        }
+      });
+  }
+  int item;
+  for (int i = 0; i < kNumItems; i++) {
+    deque.push(i);
+    if (i % 3 == 0 && deque.take(&item)) {
+      seen[item]++;
+    }
+  }
+  while (deque.take(&item)) {
+    seen[item]++;
+  }
+  done = true;
+  for (auto& thief : thieves) {
+    thief.join();
+  }
+  for (int i = 0; i < kNumItems; i++) {
+    ASSERT_EQ(1, seen[i]) << "item " << i;
+  }
+}
+
+}  // namespace vobla